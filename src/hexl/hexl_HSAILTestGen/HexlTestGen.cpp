@@ -35,6 +35,53 @@ namespace TestGen {
 
 const std::string TestGenConfig::ID = "TestGenConfig";
 
+/// BRIG modules of tests generated in one batch (see -testgenbatch).
+/// Modules are renamed to be unique and every test of the batch adds all
+/// of them to its program and dispatches the kernel of its own module.
+/// So programs of the batch are identical and finalized only once (by
+/// the runtime's code object cache).
+class TestGenBatch {
+private:
+  std::vector<std::vector<char>> data;
+  std::vector<std::unique_ptr<BrigContainer>> brigs;
+
+public:
+  static std::string ModuleId(size_t index) { std::ostringstream ss; ss << "module" << index; return ss.str(); }
+
+  size_t Size() const { return brigs.size(); }
+
+  void Add(BrigContainer* brig)
+  {
+    std::string moduleName = "&" + ModuleId(brigs.size());
+    for (Code d = brig->code().begin(), e = brig->code().end(); d != e; d = d.next()) {
+      if (DirectiveModule m = d) { m.name() = moduleName; break; }
+    }
+    BrigModule_t module = brig->getBrigModule();
+    const char* bytes = reinterpret_cast<const char*>(module);
+    data.push_back(std::vector<char>(bytes, bytes + module->byteCount));
+    // Container created from module data does not own it.
+    brigs.push_back(std::unique_ptr<BrigContainer>(new BrigContainer(reinterpret_cast<BrigModule_t>(&data.back()[0]))));
+  }
+
+  /// Puts modules to test context, which shares the batch ownership.
+  static void PutModules(Context* context, const std::shared_ptr<TestGenBatch>& batch);
+};
+
+}
+
+template <>
+inline void Print(const std::shared_ptr<TestGen::TestGenBatch>& o, std::ostream& out) { }
+
+namespace TestGen {
+
+void TestGenBatch::PutModules(Context* context, const std::shared_ptr<TestGenBatch>& batch)
+{
+  for (size_t i = 0; i < batch->Size(); ++i) {
+    context->Put(ModuleId(i) + ".brig", batch->brigs[i].get());
+  }
+  context->Move("testgen.batch", new std::shared_ptr<TestGenBatch>(batch));
+}
+
 class HexlTestGenManager : public TestGenManager {
 private:
   std::string path;
@@ -43,14 +90,23 @@ private:
   unsigned opcode;
   TestSpecIterator& it;
   unsigned index;
+  unsigned batchSize;
   std::unique_ptr<TestEmitter> te;
   Module module;
   Dispatch dispatch;
 
+  struct BatchedTest {
+    std::string name;
+    std::unique_ptr<TestEmitter> te;
+    Dispatch dispatch;
+  };
+  std::shared_ptr<TestGenBatch> batch;
+  std::vector<BatchedTest> batched;
+
 public:
-  HexlTestGenManager(const std::string& path_, const std::string& prefix_, unsigned opcode_, TestSpecIterator& it_)
+  HexlTestGenManager(const std::string& path_, const std::string& prefix_, unsigned opcode_, TestSpecIterator& it_, unsigned batchSize_)
     : TestGenManager("LUA", true, false, true, true),
-      path(path_), prefix(prefix_), opcode(opcode_), it(it_), index(0)
+      path(path_), prefix(prefix_), opcode(opcode_), it(it_), index(0), batchSize(batchSize_)
   {
     fullpath = path;
     if (!fullpath.empty()) { fullpath += "/"; }
@@ -68,7 +124,17 @@ public:
 
   void testComplete(TestDesc& testDesc)
   {
-    it(fullpath, CreateTestSpec(testDesc));
+    if (batchSize > 1) {
+      AddToBatch(testDesc);
+    } else {
+      it(fullpath, CreateTestSpec(testDesc));
+    }
+  }
+
+  /// Creates tests of the last, possibly incomplete, batch.
+  void FinishBatch()
+  {
+    if (!batched.empty()) { FlushBatch(); }
   }
 
 private:
@@ -76,6 +142,62 @@ private:
   { return prefix + "src" + index2str(idx); }
 
   TestSpec* CreateTestSpec(TestDesc& testDesc)
+  {
+    std::string testName = StartTest(testDesc, "");
+    module = te->NewModule("sample");
+
+    dispatch->ScenarioInit();
+    te->TestScenario()->Commands()->ProgramCreate();
+    module->ScenarioProgram();
+    ScenarioExecution(module);
+
+    Context* initialContext = te->ReleaseContext();
+    initialContext->Put("sample.brig", testDesc.getContainer());
+    initialContext->Move("scenario", te->TestScenario()->ReleaseScenario());
+    Test* test = new ScenarioTest(testName, initialContext);
+    return new TestHolder(test);
+  }
+
+  void AddToBatch(TestDesc& testDesc)
+  {
+    if (!batch) { batch.reset(new TestGenBatch()); }
+    BatchedTest t;
+    t.name = StartTest(testDesc, "Test");
+    te->InitialContext()->Put("dispatch", "main_module_name", TestGenBatch::ModuleId(batch->Size()));
+    // Renaming the module modifies the container, so it is done after
+    // the test data and name are taken.
+    batch->Add(testDesc.getContainer());
+    t.te = std::move(te);
+    t.dispatch = dispatch;
+    batched.push_back(std::move(t));
+    if (batched.size() >= batchSize) { FlushBatch(); }
+  }
+
+  void FlushBatch()
+  {
+    for (BatchedTest& t : batched) {
+      te = std::move(t.te);
+      dispatch = t.dispatch;
+      dispatch->ScenarioInit();
+      te->TestScenario()->Commands()->ProgramCreate();
+      for (size_t i = 0; i < batch->Size(); ++i) {
+        te->TestScenario()->Commands()->ModuleCreateFromBrig(TestGenBatch::ModuleId(i), TestGenBatch::ModuleId(i) + ".brig");
+        te->TestScenario()->Commands()->ProgramAddModule("program", TestGenBatch::ModuleId(i));
+      }
+      ScenarioExecution(0);
+
+      Context* initialContext = te->ReleaseContext();
+      TestGenBatch::PutModules(initialContext, batch);
+      initialContext->Move("scenario", te->TestScenario()->ReleaseScenario());
+      it(fullpath, new TestHolder(new ScenarioTest(t.name, initialContext)));
+    }
+    batched.clear();
+    batch.reset();
+  }
+
+  /// Emits test buffers and returns test name. Module and scenario are
+  /// left to the caller.
+  std::string StartTest(TestDesc& testDesc, const std::string& kernelName)
   {
     BrigCodeOffset32_t ioffset = testDesc.getInst().brigOffset();
     // TODO: update inst because CreateBrigFromContainer can modify the container invalidatng sections.
@@ -84,13 +206,12 @@ private:
     TestDataMap* map = testDesc.getMap();
     te.reset(new TestEmitter());
     unsigned id = 0;
-    module = te->NewModule("sample");
 
     Grid geometry = new(te->Ap()) GridGeometry(
       1, 
       testGroup->getGroupsNum(), 1, 1, 
       (std::min)(testGroup->getGroupsNum(), (unsigned) 64), 1, 1);
-    dispatch = te->NewDispatch("dispatch", "executable", "", geometry);
+    dispatch = te->NewDispatch("dispatch", "executable", kernelName, geometry);
     for (unsigned i = map->getFirstSrcArgIdx(); i <= map->getLastSrcArgIdx(); ++i) {
       defSrcArray(testGroup, id, i);
       id++;
@@ -104,28 +225,22 @@ private:
       id++;
     }
 
-    dispatch->ScenarioInit();
-    te->TestScenario()->Commands()->ProgramCreate();
-    module->ScenarioProgram();
+    std::ostringstream ss;
+    ss << dumpInst(testDesc.getInst()) << "_" << std::setw(5) << std::setfill('0') << index++;
+    return ss.str();
+  }
+
+  void ScenarioExecution(Module sampleModule)
+  {
     te->TestScenario()->Commands()->ProgramFinalize();
     te->TestScenario()->Commands()->ExecutableCreate(dispatch->ExecutableId());
     te->TestScenario()->Commands()->ExecutableLoadCode();
     te->TestScenario()->Commands()->ExecutableFreeze();
-    module->SetupDispatch("dispatch");
+    if (sampleModule) { sampleModule->SetupDispatch("dispatch"); }
     dispatch->SetupDispatch("dispatch");
     dispatch->ScenarioDispatch();
     dispatch->ScenarioValidation();
     dispatch->ScenarioEnd();
-
-    std::ostringstream ss;
-    ss << dumpInst(testDesc.getInst()) << "_" << std::setw(5) << std::setfill('0') << index++;
-    std::string testName = ss.str();
-
-    Context* initialContext = te->ReleaseContext();
-    initialContext->Put("sample.brig", testDesc.getContainer());
-    initialContext->Move("scenario", te->TestScenario()->ReleaseScenario());
-    Test* test = new ScenarioTest(testName, initialContext);
-    return new TestHolder(test);
   }
 
   void defSrcArray(TestGroupArray* testGroup, unsigned id, unsigned operandIdx) {
@@ -310,8 +425,9 @@ void TestGenTestSet::Iterate(TestSpecIterator& it)
   BrigSettings::init(testGenConfig->Model(), testGenConfig->Profile(), context->IsDumpEnabled("hsail"));
   TESTGEN::TestGen::init(true);
 
-  HexlTestGenManager m(path, prefix, opcode, it);
+  HexlTestGenManager m(path, prefix, opcode, it, context->Opts()->GetUnsigned("testgenbatch", 1));
   m.generate();
+  m.FinishBatch();
 
   TESTGEN::TestGen::clean();
   TestDataProvider::clean();
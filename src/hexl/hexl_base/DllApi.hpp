@@ -101,6 +101,20 @@ public:
 
   const ApiTable* operator->() const { return apiTable; }
 
+  /// Returns file name of loaded library, found by address of symbol.
+  std::string LibraryFileName(const char *symbolName) {
+#ifdef _WIN32
+    char fileName[MAX_PATH];
+    DWORD length = GetModuleFileNameA(dllHandle, fileName, MAX_PATH);
+    return std::string(fileName, length);
+#else
+    Dl_info info;
+    void *symbol = dlsym(dllHandle, symbolName);
+    if (!symbol || !dladdr(symbol, &info) || !info.dli_fname) { return libName; }
+    return info.dli_fname;
+#endif
+  }
+
   virtual const ApiTable* InitApiTable() = 0;
 
   bool Init() {
@@ -0,0 +1,526 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "HexlAgent.hpp"
+
+#ifndef _WIN32
+
+#include "HexlTest.hpp"
+#include "HexlTestFactory.hpp"
+#include "HexlMessage.hpp"
+#include "Stats.hpp"
+#include "RuntimeCommon.hpp"
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+namespace hexl {
+
+enum AgentMessage { AGENT_INFO = 1, AGENT_TEST, AGENT_RESULT };
+ENUM_SERIALIZER(AgentMessage);
+
+// Returns connected (or listening) socket or -1.
+static int OpenSocket(const std::string& address, bool listening, std::string& error)
+{
+  if (address.compare(0, 5, "unix:") == 0) {
+    std::string path = address.substr(5);
+    sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (path.empty() || path.length() >= sizeof(sa.sun_path)) { error = "bad socket path"; return -1; }
+    strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { error = strerror(errno); return -1; }
+    if (listening) {
+      unlink(path.c_str());
+      if (bind(fd, (sockaddr*) &sa, sizeof(sa)) == 0 && listen(fd, 1) == 0) { return fd; }
+    } else {
+      if (connect(fd, (sockaddr*) &sa, sizeof(sa)) == 0) { return fd; }
+    }
+    error = strerror(errno);
+    close(fd);
+    return -1;
+  }
+  std::string hostPort = address.compare(0, 4, "tcp:") == 0 ? address.substr(4) : address;
+  std::string host, port;
+  std::string::size_type colon = hostPort.rfind(':');
+  if (colon == std::string::npos) {
+    port = hostPort;
+  } else {
+    host = hostPort.substr(0, colon);
+    port = hostPort.substr(colon + 1);
+  }
+  if (port.empty()) { error = "port is not specified"; return -1; }
+  if (host.empty() && !listening) { host = "localhost"; }
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+  addrinfo* ais = 0;
+  int res = getaddrinfo(host.empty() ? 0 : host.c_str(), port.c_str(), &hints, &ais);
+  if (res != 0) { error = gai_strerror(res); return -1; }
+  int fd = -1;
+  error = "no address";
+  for (addrinfo* ai = ais; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) { error = strerror(errno); continue; }
+    int one = 1;
+    if (listening) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 1) == 0) { break; }
+    } else {
+      if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        break;
+      }
+    }
+    error = strerror(errno);
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(ais);
+  return fd;
+}
+
+class RemoteTestSender : public TestSpecIterator {
+private:
+  RemoteTestRunner* runner;
+
+public:
+  explicit RemoteTestSender(RemoteTestRunner* runner_)
+    : runner(runner_) { }
+
+  void operator()(const std::string& path, TestSpec* spec) override
+  {
+    runner->Send(path, spec);
+  }
+};
+
+RemoteTestRunner::RemoteTestRunner(Context* context_, const std::string& addresses_)
+  : HTestRunner(context_), count(0), nextRecord(0)
+{
+  inflight = context->Opts()->GetUnsigned("inflight", 4);
+  if (inflight == 0) { inflight = 1; }
+  std::string::size_type start = 0;
+  for (;;) {
+    std::string::size_type comma = addresses_.find(',', start);
+    std::string address = addresses_.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+    if (!address.empty()) { addresses.push_back(address); }
+    if (comma == std::string::npos) { break; }
+    start = comma + 1;
+  }
+}
+
+RemoteTestRunner::~RemoteTestRunner()
+{
+  for (Connection& c : connections) {
+    if (c.fd >= 0) { close(c.fd); }
+  }
+}
+
+bool RemoteTestRunner::Connect()
+{
+  if (addresses.empty()) {
+    RunnerLog() << "No agent address specified" << std::endl;
+    return false;
+  }
+  for (const std::string& address : addresses) {
+    std::string error;
+    int fd = OpenSocket(address, false, error);
+    if (fd < 0) {
+      RunnerLog() << "Failed to connect to agent " << address << ": " << error << std::endl;
+      return false;
+    }
+    Attach(fd, address);
+  }
+  return true;
+}
+
+void RemoteTestRunner::Attach(int fd, const std::string& address)
+{
+  // Lost connection is detected by write error.
+  signal(SIGPIPE, SIG_IGN);
+  Connection c;
+  c.address = address;
+  c.fd = fd;
+  connections.push_back(c);
+}
+
+RemoteTestRunner::Connection* RemoteTestRunner::SelectConnection()
+{
+  Connection* selected = 0;
+  for (Connection& c : connections) {
+    if (c.fd >= 0 && c.running.size() < inflight &&
+        (!selected || c.running.size() < selected->running.size())) {
+      selected = &c;
+    }
+  }
+  return selected;
+}
+
+bool RemoteTestRunner::HasRunning() const
+{
+  for (const Connection& c : connections) {
+    if (!c.running.empty()) { return true; }
+  }
+  return false;
+}
+
+void RemoteTestRunner::Send(const std::string& path, TestSpec* spec)
+{
+  spec->InitContext(context);
+  if (!spec->IsValid()) { delete spec; return; }
+  uint64_t index = count++;
+  Test* test = spec->Create();
+  std::string fullTestName = path + "/" + test->TestName();
+  std::ostringstream message;
+  WriteData(message, AGENT_TEST);
+  WriteData(message, index);
+  WriteData(message, path);
+  context->Factory()->Serialize(message, test);
+  delete test;
+  delete spec;
+
+  Connection* c;
+  while (!(c = SelectConnection()) && HasRunning()) { Poll(-1); }
+  if (!c) {
+    Record record;
+    record.fullTestName = fullTestName;
+    record.result = TestResult(ERROR, "No agent to run the test\n");
+    records[index] = record;
+  } else {
+    c->running[index] = fullTestName;
+    // Results are read while the test is written: the agent does not read
+    // while it writes a result, so blocking on a full socket would deadlock.
+    if (!SendMessage(c->fd, message, [this, c]() { return ReadMessage(*c); })) { Disconnected(*c); }
+  }
+  Poll(0);
+}
+
+void RemoteTestRunner::Poll(int timeout)
+{
+  std::vector<pollfd> fds;
+  std::vector<Connection*> fdConnections;
+  for (Connection& c : connections) {
+    if (c.fd >= 0) {
+      pollfd p;
+      p.fd = c.fd;
+      p.events = POLLIN;
+      p.revents = 0;
+      fds.push_back(p);
+      fdConnections.push_back(&c);
+    }
+  }
+  if (fds.empty()) { return; }
+  int n = poll(&fds[0], fds.size(), timeout);
+  if (n < 0 && errno != EINTR) {
+    RunnerLog() << "poll failed: " << errno << std::endl;
+    for (Connection* c : fdConnections) { Disconnected(*c); }
+  }
+  for (size_t i = 0; n > 0 && i < fds.size(); ++i) {
+    if (!fds[i].revents) { continue; }
+    if (!ReadMessage(*fdConnections[i])) { Disconnected(*fdConnections[i]); }
+  }
+  FlushRecords();
+}
+
+bool RemoteTestRunner::ReadMessage(Connection& c)
+{
+  std::string data;
+  if (!ReceiveMessage(c.fd, data)) { return false; }
+  std::istringstream message(data);
+  AgentMessage type;
+  ReadData(message, type);
+  switch (type) {
+  case AGENT_INFO: {
+    std::string info;
+    ReadData(message, info);
+    SummaryLog() << "Agent " << c.address << ":" << std::endl << info << std::endl << std::endl;
+    return true;
+  }
+  case AGENT_RESULT: {
+    uint64_t index;
+    Record record;
+    ReadData(message, index);
+    ReadData(message, record.result);
+    std::map<uint64_t, std::string>::iterator r = c.running.find(index);
+    if (r == c.running.end()) { return false; }
+    record.fullTestName = r->second;
+    records[index] = record;
+    c.running.erase(r);
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+void RemoteTestRunner::Disconnected(Connection& c)
+{
+  if (c.fd < 0) { return; }
+  close(c.fd);
+  c.fd = -1;
+  RunnerLog() << "Lost connection to agent " << c.address << std::endl;
+  for (std::map<uint64_t, std::string>::iterator r = c.running.begin(); r != c.running.end(); ++r) {
+    Record record;
+    record.fullTestName = r->second;
+    record.result = TestResult(ERROR, "Connection to agent " + c.address + " lost while running the test\n");
+    records[r->first] = record;
+  }
+  c.running.clear();
+}
+
+void RemoteTestRunner::FlushRecords()
+{
+  while (!records.empty() && records.begin()->first == nextRecord) {
+    std::map<uint64_t, Record>::iterator r = records.begin();
+    LogTestPath(r->second.fullTestName);
+    LogTestResult(r->second.fullTestName, r->second.result, r->second.result.Output());
+    r->second.result.IncStats(stats);
+    records.erase(r);
+    ++nextRecord;
+  }
+}
+
+void RemoteTestRunner::Wait()
+{
+  while (HasRunning()) { Poll(-1); }
+  FlushRecords();
+}
+
+bool RemoteTestRunner::RunTests(TestSet& tests)
+{
+  Init();
+  if (!BeforeTestSet(tests)) { return false; }
+  RemoteTestSender sender(this);
+  tests.Iterate(sender);
+  Wait();
+  if (!AfterTestSet(tests)) { return false; }
+  return true;
+}
+
+class AgentTestRunner : public TestRunnerBase {
+private:
+  std::ostringstream testOut;
+  TestResult lastResult;
+
+protected:
+  std::ostream* TestOut() override { return &testOut; }
+
+  void AfterTest(const std::string& path, Test* test, const TestResult& result) override
+  {
+    TestRunnerBase::AfterTest(path, test, result);
+    lastResult = result;
+    lastResult.SetOutput(testOut.str());
+    testOut.str(std::string());
+    testOut.clear();
+  }
+
+public:
+  AgentTestRunner(Context* context_)
+    : TestRunnerBase(context_) { }
+
+  const TestResult& LastResult() const { return lastResult; }
+};
+
+void Agent::Serve(int fd)
+{
+  signal(SIGPIPE, SIG_IGN);
+  Context* context = runner->GetContext();
+  AgentTestRunner testRunner(context);
+  if (context->Contains(CK_RUNTIME)) {
+    std::ostringstream info;
+    context->Runtime()->PrintInfo(info);
+    std::ostringstream message;
+    WriteData(message, AGENT_INFO);
+    WriteData(message, info.str());
+    if (!SendMessage(fd, message)) { close(fd); return; }
+  }
+  // Strict turn-taking: a result is written only after the whole test is
+  // read, and nothing is read while it is written.
+  std::string data;
+  unsigned tests = 0;
+  while (ReceiveMessage(fd, data)) {
+    std::istringstream message(data);
+    AgentMessage type;
+    uint64_t index;
+    std::string path;
+    ReadData(message, type);
+    if (type != AGENT_TEST) {
+      std::cout << "Agent: unexpected message " << type << std::endl;
+      break;
+    }
+    ReadData(message, index);
+    ReadData(message, path);
+    TestResult result;
+    Test* test = testFactory->CreateTest(message);
+    if (!test) {
+      result = TestResult(ERROR, "Agent failed to deserialize the test\n");
+    } else {
+      testRunner.RunTest(path, test);
+      result = testRunner.LastResult();
+      delete test;
+    }
+    std::ostringstream reply;
+    WriteData(reply, AGENT_RESULT);
+    WriteData(reply, index);
+    WriteData(reply, result);
+    if (!SendMessage(fd, reply)) { break; }
+    ++tests;
+  }
+  close(fd);
+  std::cout << "Agent: connection closed after " << tests << " tests" << std::endl;
+}
+
+bool Agent::Loop()
+{
+  std::string error;
+  int listenFd = OpenSocket(address, true, error);
+  if (listenFd < 0) {
+    std::cout << "Agent: failed to listen on " << address << ": " << error << std::endl;
+    return false;
+  }
+  std::cout << "Agent: listening on " << address << std::endl;
+  for (;;) {
+    int fd = accept(listenFd, 0, 0);
+    if (fd < 0) {
+      if (errno == EINTR) { continue; }
+      std::cout << "Agent: accept failed: " << strerror(errno) << std::endl;
+      close(listenFd);
+      return false;
+    }
+    std::cout << "Agent: connection accepted" << std::endl;
+    Serve(fd);
+  }
+}
+
+static std::string EchoPayload(uint64_t size)
+{
+  std::string payload((size_t) size, ' ');
+  for (size_t i = 0; i < payload.size(); ++i) { payload[i] = (char) ('a' + i % 26); }
+  return payload;
+}
+
+/// Sent to the agent by AgentLoopbackTest: checks that the payload arrived
+/// intact and echoes it to test output, which is sent back with the result.
+class AgentEchoTest : public TestImpl {
+private:
+  uint64_t size;
+  std::string payload;
+
+protected:
+  void SerializeData(std::ostream& out) const override { WriteData(out, size); WriteData(out, payload); }
+
+public:
+  explicit AgentEchoTest(uint64_t size_)
+    : size(size_), payload(EchoPayload(size_)) { }
+  explicit AgentEchoTest(std::istream& in) { ReadData(in, size); ReadData(in, payload); }
+
+  std::string Type() const override { return "agent_echo"; }
+  void Name(std::ostream& out) const override { out << "echo_" << size; }
+  void Description(std::ostream& out) const override { out << "Echo " << size << " bytes"; }
+
+  void Run() override
+  {
+    if (payload != EchoPayload(size)) { Fail("Payload is corrupted"); return; }
+    context->Info() << payload << std::endl;
+  }
+};
+
+class AgentEchoTestFactory : public DefaultTestFactory {
+public:
+  Test* CreateTestDeserialize(const std::string& type, std::istream& in) override
+  {
+    if (type == "agent_echo") { return new AgentEchoTest(in); }
+    return DefaultTestFactory::CreateTestDeserialize(type, in);
+  }
+};
+
+/// Sends echo tests to an agent served in another thread over a socketpair.
+/// Tests larger than socket buffers make both ends write at the same time.
+class AgentLoopbackTest : public TestImpl {
+private:
+  unsigned count;
+  uint64_t size;
+
+public:
+  AgentLoopbackTest(unsigned count_, uint64_t size_)
+    : count(count_), size(size_) { }
+
+  std::string Type() const override { return "agent_loopback"; }
+  void Name(std::ostream& out) const override { out << "loopback_" << count << "x" << size; }
+  void Description(std::ostream& out) const override { out << "Run " << count << " tests of " << size << " bytes on agent over socketpair"; }
+
+  void Run() override
+  {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      Fail(std::string("socketpair failed: ") + strerror(errno));
+      return;
+    }
+    // Tests run by the agent thread do not share stats of this test.
+    context->Move(CK_STATS, new AllStats());
+    AgentEchoTestFactory factory;
+    context->Put(CK_TEST_FACTORY, (TestFactory*) &factory);
+    SimpleTestRunner agentRunner(context.get());
+    Agent agent(&agentRunner, &factory, "");
+    std::thread agentThread([&agent, &fds]() { agent.Serve(fds[1]); });
+    unsigned passed;
+    {
+      // Closing the runner's end stops the agent.
+      RemoteTestRunner remote(context.get(), "");
+      remote.Attach(fds[0], "loopback");
+      for (unsigned i = 0; i < count; ++i) {
+        remote.Send("hexl/agent/loopback", new TestHolder(new AgentEchoTest(size)));
+      }
+      remote.Wait();
+      const TestRunner& runner = remote;
+      passed = runner.Stats().TestSet().Passed();
+    }
+    agentThread.join();
+    if (passed != count) {
+      Fail("Passed " + std::to_string(passed) + " of " + std::to_string(count) + " tests");
+    }
+  }
+};
+
+DECLARE_TESTSET(AgentTests, "agent");
+
+void AgentTests::Iterate(TestSpecIterator& it)
+{
+  it("agent", new TestHolder(new AgentLoopbackTest(1, 1024)));
+  it("agent", new TestHolder(new AgentLoopbackTest(16, 4 << 20)));
+}
+
+TestSet* NewAgentTests()
+{
+  return new AgentTests();
+}
+
+}
+
+#endif // _WIN32
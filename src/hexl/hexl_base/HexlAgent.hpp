@@ -0,0 +1,105 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_AGENT_HPP
+#define HEXL_AGENT_HPP
+
+#include "HexlTestRunner.hpp"
+#include <map>
+#include <vector>
+
+#ifndef _WIN32
+
+namespace hexl {
+
+class TestFactory;
+
+/// Sends serialized tests to one or more agents and logs their results.
+///
+/// Address list is comma-separated, every address is either "unix:Path",
+/// "tcp:Host:Port" or "Host:Port". Up to "inflight" tests are sent to each
+/// agent before waiting for results. Results are written to test log and
+/// summary in test order, same as with HTestRunner. Tests of an agent
+/// which drops connection are reported as ERROR.
+class RemoteTestRunner : public HTestRunner {
+public:
+  RemoteTestRunner(Context* context_, const std::string& addresses_);
+  ~RemoteTestRunner();
+
+  bool Connect();
+  /// Adds agent connected with fd (e.g. a socketpair), fd is closed by the runner.
+  void Attach(int fd, const std::string& address);
+  bool RunTests(TestSet& tests) override;
+  void Send(const std::string& path, TestSpec* spec);
+  /// Waits for results of all sent tests.
+  void Wait();
+
+private:
+  struct Connection {
+    Connection() : fd(-1) { }
+    std::string address;
+    int fd;
+    std::map<uint64_t, std::string> running;
+  };
+
+  struct Record {
+    std::string fullTestName;
+    TestResult result;
+  };
+
+  std::vector<std::string> addresses;
+  std::vector<Connection> connections;
+  unsigned inflight;
+  uint64_t count;
+  std::map<uint64_t, Record> records;
+  uint64_t nextRecord;
+
+  Connection* SelectConnection();
+  bool HasRunning() const;
+  void Poll(int timeout);
+  bool ReadMessage(Connection& c);
+  void Disconnected(Connection& c);
+  void FlushRecords();
+};
+
+/// Executes tests received from RemoteTestRunner in context of given runner
+/// and sends results back. Listens on "unix:Path", "tcp:Host:Port",
+/// "Host:Port" or "Port" and serves one connection at a time.
+class Agent {
+public:
+  Agent(TestRunner* runner_, TestFactory* testFactory_, const std::string& address_)
+    : runner(runner_), testFactory(testFactory_), address(address_) { }
+
+  /// Serves connections, returns only if listening socket can not be set up.
+  bool Loop();
+
+  /// Runs tests received over connected fd until it is closed.
+  void Serve(int fd);
+
+private:
+  TestRunner* runner;
+  TestFactory* testFactory;
+  std::string address;
+};
+
+/// Tests of RemoteTestRunner and Agent connected with a socketpair.
+TestSet* NewAgentTests();
+
+}
+
+#endif // _WIN32
+
+#endif // HEXL_AGENT_HPP
@@ -7,6 +7,10 @@
 #include "Options.hpp"
 #include "HSAILTool.h"
 #include "HSAILBrigContainer.h"
+#include "Scenario.hpp"
+#include <sstream>
+#include <cstring>
+#include <deque>
 #ifdef _WIN32
 #include <windows.h>
 #include <strsafe.h>
@@ -14,9 +18,241 @@
 
 namespace hexl {
 
+  namespace {
+    uint32_t KeyHash(uint32_t h, const char* s, size_t length)
+    {
+      for (size_t i = 0; i < length; ++i) { h = (h ^ (uint8_t) s[i]) * 16777619u; }
+      return h;
+    }
+
+    uint32_t KeyHash(const char* path, size_t pathLength, const char* key, size_t keyLength)
+    {
+      uint32_t h = KeyHash(2166136261u, path, pathLength);
+      if (key) { h = KeyHash(h, ".", 1); h = KeyHash(h, key, keyLength); }
+      return h;
+    }
+
+    bool KeyEquals(const std::string& name, const char* path, size_t pathLength, const char* key, size_t keyLength)
+    {
+      if (!key) { return name.size() == pathLength && name.compare(0, pathLength, path, pathLength) == 0; }
+      return name.size() == pathLength + 1 + keyLength &&
+        name.compare(0, pathLength, path, pathLength) == 0 &&
+        name[pathLength] == '.' &&
+        name.compare(pathLength + 1, keyLength, key, keyLength) == 0;
+    }
+
+    std::string KeyName(const char* path, size_t pathLength, const char* key, size_t keyLength)
+    {
+      std::string name(path, pathLength);
+      if (key) { name += '.'; name.append(key, keyLength); }
+      return name;
+    }
+
+    /// Process-wide table of interned context key names. Ids are never
+    /// released and deque does not move its elements when growing, so
+    /// names returned by Name stay valid.
+    class ContextKeyTable {
+    private:
+      std::mutex mutex;
+      std::deque<std::string> names;
+      std::vector<uint32_t> slots;
+
+      void Insert(uint32_t id)
+      {
+        const std::string& name = names[id];
+        size_t mask = slots.size() - 1;
+        size_t i = KeyHash(name.data(), name.size(), 0, 0) & mask;
+        while (slots[i] != CK_NONE) { i = (i + 1) & mask; }
+        slots[i] = id;
+      }
+
+      uint32_t Add(const std::string& name)
+      {
+        uint32_t id = (uint32_t) names.size();
+        names.push_back(name);
+        if (names.size() * 2 > slots.size()) {
+          slots.assign(slots.size() * 2, CK_NONE);
+          for (uint32_t k = CK_NONE + 1; k < names.size(); ++k) { Insert(k); }
+        } else {
+          Insert(id);
+        }
+        return id;
+      }
+
+    public:
+      ContextKeyTable()
+        : slots(64, CK_NONE)
+      {
+        static const char* wellKnown[CK_LAST] = {
+          "",
+          "hexl.options",
+          "hexl.stats",
+          "hexl.rm",
+          "hexl.runtime",
+          "hexl.testFactory",
+          "hexl.outputPath",
+          "hexl.log.stream.debug",
+          "hexl.log.stream.info",
+          "hexl.log.stream.error",
+          "hexl.timing",
+          "hexl.worker",
+        };
+        names.push_back(wellKnown[CK_NONE]);
+        for (unsigned k = CK_NONE + 1; k < CK_LAST; ++k) {
+          Add(wellKnown[k]);
+        }
+      }
+
+      uint32_t Intern(uint32_t hash, const char* path, size_t pathLength, const char* key, size_t keyLength)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; slots[i] != CK_NONE; i = (i + 1) & mask) {
+          if (KeyEquals(names[slots[i]], path, pathLength, key, keyLength)) { return slots[i]; }
+        }
+        return Add(KeyName(path, pathLength, key, keyLength));
+      }
+
+      const std::string& Name(uint32_t id)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        assert(id < names.size());
+        return names[id];
+      }
+    };
+
+    ContextKeyTable& KeyTable()
+    {
+      static ContextKeyTable table;
+      return table;
+    }
+
+    /// Ids of the keys already interned by one thread, with copies of their
+    /// names, so that they are found again without locking KeyTable.
+    class LocalKeyTable {
+    private:
+      struct Slot {
+        uint32_t id;
+        uint32_t hash;
+        std::string name;
+        Slot() : id(CK_NONE), hash(0) { }
+      };
+      std::vector<Slot> slots;
+      size_t count;
+
+    public:
+      LocalKeyTable()
+        : slots(64), count(0) { }
+
+      uint32_t Find(uint32_t hash, const char* path, size_t pathLength, const char* key, size_t keyLength) const
+      {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; slots[i].id != CK_NONE; i = (i + 1) & mask) {
+          if (slots[i].hash == hash && KeyEquals(slots[i].name, path, pathLength, key, keyLength)) { return slots[i].id; }
+        }
+        return CK_NONE;
+      }
+
+      void Add(uint32_t hash, std::string name, uint32_t id)
+      {
+        if ((count + 1) * 2 > slots.size()) {
+          std::vector<Slot> old(slots.size() * 2);
+          old.swap(slots);
+          count = 0;
+          for (Slot& slot : old) {
+            if (slot.id != CK_NONE) { Add(slot.hash, std::move(slot.name), slot.id); }
+          }
+        }
+        size_t mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i].id != CK_NONE) { i = (i + 1) & mask; }
+        slots[i].id = id;
+        slots[i].hash = hash;
+        slots[i].name = std::move(name);
+        ++count;
+      }
+    };
+  }
+
+  uint32_t ContextKey::Intern(const char* path, size_t pathLength, const char* key, size_t keyLength)
+  {
+    // Ids never change, so only keys new to this thread lock the table.
+    thread_local LocalKeyTable local;
+    uint32_t hash = KeyHash(path, pathLength, key, keyLength);
+    uint32_t id = local.Find(hash, path, pathLength, key, keyLength);
+    if (id == CK_NONE) {
+      id = KeyTable().Intern(hash, path, pathLength, key, keyLength);
+      local.Add(hash, KeyName(path, pathLength, key, keyLength), id);
+    }
+    return id;
+  }
+
+  const std::string& ContextKey::Name() const
+  {
+    return KeyTable().Name(id);
+  }
+
+  namespace {
+    /// Generation of the last change of a context with children.
+    std::atomic<uint64_t> lastGeneration(0);
+  }
+
+  uint64_t Context::CurrentGeneration()
+  {
+    return lastGeneration.load();
+  }
+
+  void Context::Touch()
+  {
+    // Changes of contexts without children (most test contexts) do not
+    // invalidate any cached lookup.
+    if (hasChildren) { ++lastGeneration; }
+  }
+
+  void Context::SetParent(Context* parent)
+  {
+    auto lock = Lock();
+    this->parent = parent;
+    {
+      std::lock_guard<std::mutex> cacheLock(cacheMutex);
+      ContextTable<CachedLookup> empty;
+      parentCache.Swap(empty);
+    }
+    Touch();
+  }
+
+  ContextObject* Context::FindObject(ContextKey key) const
+  {
+    {
+      auto lock = Lock();
+      const std::unique_ptr<ContextObject>* local = map.Get(key.Id());
+      if (local) { return local->get(); }
+      if (!parent) { return 0; }
+    }
+    {
+      std::lock_guard<std::mutex> lock(cacheMutex);
+      const CachedLookup* cached = parentCache.Get(key.Id());
+      if (cached && CurrentGeneration() <= cached->generation) { return cached->object; }
+    }
+    // Any ancestor change from now on gets a later generation: parent is
+    // marked here, its ancestors by its own lookup or when it cached one.
+    parent->hasChildren = true;
+    uint64_t g = CurrentGeneration();
+    ContextObject* o = parent->FindObject(key);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    CachedLookup& cached = parentCache[key.Id()];
+    cached.object = o;
+    cached.generation = g;
+    return o;
+  }
+
   void Context::Print(std::ostream& out) const
   {
-    for (auto i = map.begin(); i != map.end(); ++i) {
+    std::map<std::string, const ContextObject*> objects;
+    map.ForEach([&](uint32_t id, const std::unique_ptr<ContextObject>& o) {
+      objects[ContextKey::FromId(id).Name()] = o.get();
+    });
+    for (auto i = objects.begin(); i != objects.end(); ++i) {
       out << i->first << ":" << std::endl;
       {
         IndentStream indent(out);
@@ -30,16 +266,108 @@ namespace hexl {
   void Context::Dump() const
   {
     std::string outputPath = RM()->GetOutputDirName(GetOutputPath());
-    for (auto i = map.begin(); i != map.end(); ++i) {
-      i->second->Dump(outputPath, i->first);
+    map.ForEach([&](uint32_t id, const std::unique_ptr<ContextObject>& o) {
+      o->Dump(outputPath, ContextKey::FromId(id).Name());
+    });
+  }
+
+  // BrigContainer created from received module does not own module data.
+  class ContextReceivedBrig : public ContextPointer<HSAIL_ASM::BrigContainer> {
+  private:
+    std::vector<char> data;
+
+  public:
+    ContextReceivedBrig(std::vector<char>& data_)
+      : ContextPointer<HSAIL_ASM::BrigContainer>(0)
+    {
+      data.swap(data_);
+      t = new HSAIL_ASM::BrigContainer(reinterpret_cast<BrigModule_t>(&data[0]));
     }
+    ~ContextReceivedBrig() { delete t; }
+  };
+
+  void Context::Serialize(std::ostream& out) const
+  {
+    // Ids depend on the order in which keys were interned, sort by name so
+    // that the same context is always serialized the same way.
+    std::map<std::string, std::string> objects;
+    map.ForEach([&](uint32_t id, const std::unique_ptr<ContextObject>& object) {
+      const std::string& name = ContextKey::FromId(id).Name();
+      std::ostringstream o;
+      WriteData(o, name);
+      if (object->Serialize(o)) { objects[name] = o.str(); }
+    });
+    WriteData(out, (uint32_t) objects.size());
+    for (auto& o : objects) { out << o.second; }
+  }
+
+  bool Context::Deserialize(std::istream& in)
+  {
+    uint32_t count;
+    ReadData(in, count);
+    for (uint32_t i = 0; i < count && in.good(); ++i) {
+      std::string key;
+      uint32_t managed;
+      ContextObjectKind kind;
+      ReadData(in, key);
+      ReadData(in, managed);
+      ReadData(in, kind);
+      switch (kind) {
+      case CO_VALUE: {
+        Value value;
+        ReadData(in, value);
+        Put(key, value);
+        break;
+      }
+      case CO_VALUES: {
+        Values values;
+        ReadData(in, values);
+        if (managed) { Move(key, values); } else { Put(key, values); }
+        break;
+      }
+      case CO_STRING: {
+        std::string s;
+        ReadData(in, s);
+        Put(key, s);
+        break;
+      }
+      case CO_IMAGE_PARAMS: {
+        ImageParams* imageParams = new ImageParams();
+        imageParams->Deserialize(in);
+        Move(key, imageParams);
+        break;
+      }
+      case CO_SAMPLER_PARAMS: {
+        SamplerParams* samplerParams = new SamplerParams();
+        samplerParams->Deserialize(in);
+        Move(key, samplerParams);
+        break;
+      }
+      case CO_BRIG: {
+        uint64_t size;
+        ReadData(in, size);
+        if (size == 0) { return false; }
+        std::vector<char> data((size_t) size);
+        in.read(&data[0], size);
+        if (!in) { return false; }
+        PutObject(ContextKey(key), new ContextReceivedBrig(data));
+        break;
+      }
+      case CO_SCENARIO:
+        Move(key, scenario::Scenario::Deserialize(in));
+        break;
+      default:
+        return false;
+      }
+    }
+    return in.good();
   }
 
   void Context::Move(const std::string& key, Values& values)
   {
     Values* newvalues = new Values();
     newvalues->swap(values);
-    PutObject(key, new ContextManagedPointer<Values>(newvalues));
+    PutObject(ContextKey(key), new ContextManagedPointer<Values>(newvalues));
   }
 
   bool Context::IsVerbose(const std::string& what, bool enabledWithPlainVerboseOption) const
@@ -144,6 +472,40 @@ namespace hexl {
     }
   }
 
+  static std::string ValuesImageKey(const std::string& valuesId)
+  {
+    return valuesId + ".image";
+  }
+
+  void MoveValues(Context* context, const std::string& valuesId, Values* values)
+  {
+    if (IsPlainData(*values)) {
+      std::vector<char>* image = new std::vector<char>(SizeOf(*values));
+      if (!image->empty()) { WriteTo(&(*image)[0], *values); }
+      context->Move(ValuesImageKey(valuesId), image);
+    }
+    context->Move(valuesId, values);
+  }
+
+  size_t WriteRuntimeValues(Context* context, const std::string& valuesId, void* dest)
+  {
+    // Image is not sent to remote agents, so it may be missing.
+    std::string imageKey = ValuesImageKey(valuesId);
+    if (context->Contains(imageKey)) {
+      const std::vector<char>* image = context->Get<std::vector<char>>(imageKey);
+      if (!image->empty()) { memcpy(dest, &(*image)[0], image->size()); }
+      return image->size();
+    }
+    const Values* values = context->Get<Values>(valuesId);
+    char* ptr = (char*) dest;
+    for (const Value& value : *values) {
+      Value v = context->GetRuntimeValue(value);
+      v.WriteTo(ptr);
+      ptr += v.Size();
+    }
+    return ptr - (char*) dest;
+  }
+
   static const unsigned MAX_SHOWN_FAILURES = 16;
 
   bool ValidateMemory(Context* context, ValueType vtype, const Values& expected, const void *actualPtr, const std::string& method)
@@ -157,15 +519,32 @@ namespace hexl {
     unsigned shownFailures = 0;
     Value actualValue;
     const char *aptr = (const char *) actualPtr;
-    for (unsigned i = 0; i < expected.size(); ++i) {
-      Value expectedValue = context->GetRuntimeValue(expected[i]);
-      actualValue.ReadFrom(aptr, expectedValue.Type()); aptr += actualValue.Size();
-      bool passed = comparison->Compare(expectedValue, actualValue);
-      if ((!passed && comparison->GetFailed() < maxShownFailures) || verboseData) {
+    if (expected.HasMemoryLayout() && !verboseData) {
+      // Compare in bulk, then report the same failures as the loop below:
+      // those found while fewer than maxShownFailures have failed.
+      std::vector<size_t> failures;
+      comparison->CompareArrays(expected.ColumnType(), expected.ColumnData(), actualPtr, expected.size(),
+                                failures, maxShownFailures > 0 ? maxShownFailures - 1 : 0);
+      size_t size = expected.ColumnElementSize();
+      for (size_t i : failures) {
+        actualValue.ReadFrom(aptr + i * size, expected.ColumnType());
+        comparison->Recompare(expected[i], actualValue);
         context->Info() << "  " << "[" << std::setw(2) << i << "]" << ": ";
         comparison->PrintLong(context->Info());
         context->Info() << std::endl;
-        if (!passed) { shownFailures++; }
+        shownFailures++;
+      }
+    } else {
+      for (unsigned i = 0; i < expected.size(); ++i) {
+        Value expectedValue = context->GetRuntimeValue(expected[i]);
+        actualValue.ReadFrom(aptr, expectedValue.Type()); aptr += actualValue.Size();
+        bool passed = comparison->Compare(expectedValue, actualValue);
+        if ((!passed && comparison->GetFailed() < maxShownFailures) || verboseData) {
+          context->Info() << "  " << "[" << std::setw(2) << i << "]" << ": ";
+          comparison->PrintLong(context->Info());
+          context->Info() << std::endl;
+          if (!passed) { shownFailures++; }
+        }
       }
     }
     if (comparison->GetFailed() > shownFailures) {
@@ -1,9 +1,14 @@
 #ifndef HEXL_CONTEXT_HPP
 #define HEXL_CONTEXT_HPP
 
+#include <atomic>
 #include <map>
+#include <cassert>
+#include <iostream>
+#include <mutex>
 #include <string>
 #include <ostream>
+#include <vector>
 #include "MObject.hpp"
 #include "HexlObjects.hpp"
 
@@ -14,6 +19,9 @@ namespace hexl {
     virtual ~ContextObject() { }
     virtual void Print(std::ostream& out) const = 0;
     virtual void Dump(const std::string& path, const std::string& name) const = 0;
+    /// Writes managed flag, object kind and data. Returns false if object
+    /// can not be sent to remote agent.
+    virtual bool Serialize(std::ostream& out) const { return false; }
   };
 
   template <typename T>
@@ -26,6 +34,7 @@ namespace hexl {
     T* Get() { return t; }
     void Print(std::ostream& out) const override { hexl::Print(*t, out); }
     void Dump(const std::string& path, const std::string& name) const override { hexl::Dump(*t, path, name); }
+    bool Serialize(std::ostream& out) const override { WriteData(out, (uint32_t) 1); return hexl::Serialize(*t, out); }
   };
 
   template <>
@@ -65,86 +74,284 @@ namespace hexl {
     const T& Get() { return value; }
     void Print(std::ostream& out) const { hexl::Print<T>(value, out); }
     void Dump(const std::string& path, const std::string& name) const override { hexl::Dump(value, path, name); }
+    bool Serialize(std::ostream& out) const override { WriteData(out, (uint32_t) 0); return hexl::Serialize(value, out); }
+  };
+
+  /// Context keys with ids fixed at compile time.
+  enum WellKnownContextKey {
+    CK_NONE = 0,
+    CK_OPTIONS,
+    CK_STATS,
+    CK_RM,
+    CK_RUNTIME,
+    CK_TEST_FACTORY,
+    CK_OUTPUT_PATH,
+    CK_LOG_DEBUG,
+    CK_LOG_INFO,
+    CK_LOG_ERROR,
+    CK_TIMING,
+    CK_WORKER,
+    CK_LAST,
+  };
+
+  /// Interned name of a context object. Every name gets a process-wide id
+  /// the first time it is used, lookups then compare ids only.
+  class ContextKey {
+  public:
+    ContextKey(WellKnownContextKey key) : id(key) { }
+    explicit ContextKey(const std::string& name) : id(Intern(name.data(), name.size(), 0, 0)) { }
+    /// Same key as path + "." + key, without building the string.
+    ContextKey(const std::string& path, const std::string& key) : id(Intern(path.data(), path.size(), key.data(), key.size())) { }
+
+    uint32_t Id() const { return id; }
+    const std::string& Name() const;
+
+    static ContextKey FromId(uint32_t id) { ContextKey key(CK_NONE); key.id = id; return key; }
+
+  private:
+    uint32_t id;
+
+    static uint32_t Intern(const char* path, size_t pathLength, const char* key, size_t keyLength);
+  };
+
+  /// Open addressing hash table indexed by key id, with linear probing and
+  /// backward shift deletion.
+  template <typename T>
+  class ContextTable {
+  private:
+    struct Slot {
+      uint32_t id;
+      T value;
+      Slot() : id(CK_NONE), value() { }
+    };
+    std::vector<Slot> slots;
+    size_t count;
+
+    size_t Mask() const { return slots.size() - 1; }
+    size_t Home(uint32_t id) const { return (size_t) ((id * 2654435761u) & Mask()); }
+
+    size_t Find(uint32_t id) const
+    {
+      if (slots.empty()) { return slots.size(); }
+      for (size_t i = Home(id); ; i = (i + 1) & Mask()) {
+        if (slots[i].id == id) { return i; }
+        if (slots[i].id == CK_NONE) { return slots.size(); }
+      }
+    }
+
+    void Grow()
+    {
+      std::vector<Slot> old(slots.empty() ? 16 : slots.size() * 2);
+      old.swap(slots);
+      for (Slot& slot : old) {
+        if (slot.id == CK_NONE) { continue; }
+        size_t i = Home(slot.id);
+        while (slots[i].id != CK_NONE) { i = (i + 1) & Mask(); }
+        slots[i].id = slot.id;
+        slots[i].value = std::move(slot.value);
+      }
+    }
+
+  public:
+    ContextTable() : count(0) { }
+
+    size_t Size() const { return count; }
+
+    T* Get(uint32_t id)
+    {
+      size_t i = Find(id);
+      return i < slots.size() ? &slots[i].value : 0;
+    }
+    const T* Get(uint32_t id) const
+    {
+      size_t i = Find(id);
+      return i < slots.size() ? &slots[i].value : 0;
+    }
+
+    /// Value for id, inserted default constructed if there is none.
+    T& operator[](uint32_t id)
+    {
+      assert(id != CK_NONE);
+      size_t i = Find(id);
+      if (i < slots.size()) { return slots[i].value; }
+      if ((count + 1) * 4 > slots.size() * 3) { Grow(); }
+      i = Home(id);
+      while (slots[i].id != CK_NONE) { i = (i + 1) & Mask(); }
+      slots[i].id = id;
+      ++count;
+      return slots[i].value;
+    }
+
+    /// Removes id, its value is moved to removed.
+    bool Remove(uint32_t id, T& removed)
+    {
+      size_t i = Find(id);
+      if (i == slots.size()) { return false; }
+      removed = std::move(slots[i].value);
+      // Shift following entries of the cluster back into the hole.
+      for (size_t j = (i + 1) & Mask(); slots[j].id != CK_NONE; j = (j + 1) & Mask()) {
+        size_t home = Home(slots[j].id);
+        if (((j - home) & Mask()) >= ((j - i) & Mask())) {
+          slots[i].id = slots[j].id;
+          slots[i].value = std::move(slots[j].value);
+          i = j;
+        }
+      }
+      slots[i].id = CK_NONE;
+      slots[i].value = T();
+      --count;
+      return true;
+    }
+
+    void Swap(ContextTable& table) { slots.swap(table.slots); std::swap(count, table.count); }
+
+    template <typename F>
+    void ForEach(F f) const
+    {
+      for (const Slot& slot : slots) {
+        if (slot.id != CK_NONE) { f(slot.id, slot.value); }
+      }
+    }
   };
 
   class Context {
   private:
+    /// Object found in an ancestor (0 if none), valid while no ancestor
+    /// changed after generation.
+    struct CachedLookup {
+      ContextObject* object;
+      uint64_t generation;
+      CachedLookup() : object(0), generation(0) { }
+    };
+
     Context* parent;
-    std::map<std::string, std::unique_ptr<ContextObject>> map;
+    ContextTable<std::unique_ptr<ContextObject>> map;
+    /// Filled by lookups through child contexts too, which may run on
+    /// other threads, so it is always locked with cacheMutex.
+    mutable ContextTable<CachedLookup> parentCache;
+    mutable std::mutex cacheMutex;
+    /// Set once a child looked up an object through this context. Only
+    /// changes of such contexts invalidate cached lookups, see Touch.
+    mutable std::atomic<bool> hasChildren;
+    mutable std::mutex mutex;
+    bool shared;
+
+    /// Locks the map only while it is shared by host threads, see SetShared.
+    std::unique_lock<std::mutex> Lock() const
+    {
+      return shared ? std::unique_lock<std::mutex>(mutex) : std::unique_lock<std::mutex>();
+    }
 
-    void PutObject(const std::string& key, ContextObject* o)
+    void PutObject(ContextKey key, ContextObject* o)
     {
-      map[key] = std::unique_ptr<ContextObject>(o);
+      // Replaced object is destroyed outside of the lock.
+      std::unique_ptr<ContextObject> old(o);
+      auto lock = Lock();
+      map[key.Id()].swap(old);
+      Touch();
     }
 
+    static uint64_t CurrentGeneration();
+    void Touch();
+    /// Object with given key in this context or its ancestors, 0 if none.
+    ContextObject* FindObject(ContextKey key) const;
+
     template <typename T>
-    T* GetObject(const std::string& key) const
+    T* GetObject(ContextKey key) const
     {
-      auto f = map.find(key);
-      if (f != map.end()) {
-        return static_cast<T*>(f->second.get());
-      }
-      else {
-        if (parent) {
-          return parent->GetObject<T>(key);
-        }
-        else {
-          std::cout << "Key: " << key << std::endl;
-          assert(!"Value not found");
-          return 0;
-        }
+      ContextObject* o = FindObject(key);
+      if (!o) {
+        std::cout << "Key: " << key.Name() << std::endl;
+        assert(!"Value not found");
       }
+      return static_cast<T*>(o);
     }
 
   public:
     explicit Context(Context* parent_ = 0)
-      : parent(parent_) { }
+      : parent(parent_), hasChildren(false), shared(false) { }
+
+    void SetParent(Context* parent);
 
-    void SetParent(Context* parent) { this->parent = parent; }
+    /// Scenario threads access test context concurrently: while shared,
+    /// every access to this context (not parents) is serialized. Must be
+    /// changed only when no other thread uses the context.
+    void SetShared(bool shared) { this->shared = shared; }
 
     void Print(std::ostream& out) const;
 
     void Dump() const;
 
-    bool Has(const std::string& key) const { return map.find(key) != map.end(); }
-    bool Has(const std::string& path, const std::string& key) const { return Has(path + "." + key); }
+    /// Writes local objects that can be serialized, others are skipped.
+    void Serialize(std::ostream& out) const;
+    bool Deserialize(std::istream& in);
 
-    void Clear() { map.clear(); }
+    bool Has(ContextKey key) const { auto lock = Lock(); return map.Get(key.Id()) != 0; }
+    bool Has(const std::string& key) const { return Has(ContextKey(key)); }
+    bool Has(const std::string& path, const std::string& key) const { return Has(ContextKey(path, key)); }
+    bool Contains(ContextKey key) const { return FindObject(key) != 0; }
+    bool Contains(const std::string& key) const { return Contains(ContextKey(key)); }
 
-    void Put(const std::string& key, const Value& value) { PutObject(key, new ContextValue<Value>(value)); }
-    void Put(const std::string& path, const std::string& key, const Value& value) { Put(path + "." + key, value); }
-    const Value& GetValue(const std::string& key) const { return GetObject<ContextValue<Value>>(key)->Get(); }
-    const Value& GetValue(const std::string& path, const std::string& key) const { return GetValue(path + "." + key); }
+    void Clear()
+    {
+      ContextTable<std::unique_ptr<ContextObject>> old;
+      auto lock = Lock();
+      map.Swap(old);
+      Touch();
+    }
+
+    void Put(ContextKey key, const Value& value) { PutObject(key, new ContextValue<Value>(value)); }
+    void Put(const std::string& key, const Value& value) { Put(ContextKey(key), value); }
+    void Put(const std::string& path, const std::string& key, const Value& value) { Put(ContextKey(path, key), value); }
+    const Value& GetValue(ContextKey key) const { return GetObject<ContextValue<Value>>(key)->Get(); }
+    const Value& GetValue(const std::string& key) const { return GetValue(ContextKey(key)); }
+    const Value& GetValue(const std::string& path, const std::string& key) const { return GetValue(ContextKey(path, key)); }
 
     void Put(const std::string& key, uint64_t handle) { Put(key, Value(MV_UINT64, handle)); }
     uint64_t GetHandle(const std::string& key) const { return GetValue(key).U64(); }
 
-    void Put(const std::string& key, const Values& values) { PutObject(key, new ContextValue<Values>(values)); }
+    void Put(const std::string& key, const Values& values) { PutObject(ContextKey(key), new ContextValue<Values>(values)); }
     void Move(const std::string& key, Values& values);
-    const Values& GetValues(const std::string& key) const { return GetObject<ContextValue<Values>>(key)->Get(); }
+    const Values& GetValues(const std::string& key) const { return GetObject<ContextValue<Values>>(ContextKey(key))->Get(); }
 
-    void Put(const std::string& key, const std::string& s) { PutObject(key, new ContextValue<std::string>(s)); }
-    void Put(const std::string& path, const std::string& key, const std::string& s) { Put(path + "." + key, s); }
-    const std::string& GetString(const std::string& path, const std::string& key) const { return GetString(path + "." + key); }
-    const std::string& GetString(const std::string& key) const { return GetObject<ContextValue<std::string>>(key)->Get(); }
+    void Put(ContextKey key, const std::string& s) { PutObject(key, new ContextValue<std::string>(s)); }
+    void Put(const std::string& key, const std::string& s) { Put(ContextKey(key), s); }
+    void Put(const std::string& path, const std::string& key, const std::string& s) { Put(ContextKey(path, key), s); }
+    const std::string& GetString(ContextKey key) const { return GetObject<ContextValue<std::string>>(key)->Get(); }
+    const std::string& GetString(const std::string& key) const { return GetString(ContextKey(key)); }
+    const std::string& GetString(const std::string& path, const std::string& key) const { return GetString(ContextKey(path, key)); }
 
     template <typename T>
-    void Put(const std::string& key, T* t) { PutObject(key, new ContextUnmanagedPointer<T>(t)); }
+    void Put(ContextKey key, T* t) { PutObject(key, new ContextUnmanagedPointer<T>(t)); }
+    template <typename T>
+    void Put(const std::string& key, T* t) { Put(ContextKey(key), t); }
     template <typename T>
-    void Move(const std::string& key, T* t) { PutObject(key, new ContextManagedPointer<T>(t)); }
+    void Move(ContextKey key, T* t) { PutObject(key, new ContextManagedPointer<T>(t)); }
+    template <typename T>
+    void Move(const std::string& key, T* t) { Move(ContextKey(key), t); }
+    template<class T>
+    T* Get(ContextKey key) { return GetObject<ContextPointer<T>>(key)->Get(); }
     template<class T>
-    T* Get(const std::string& key) { return GetObject<ContextPointer<T>>(key)->Get(); }
+    T* Get(const std::string& key) { return Get<T>(ContextKey(key)); }
     template<class T>
-    const T* Get(const std::string& key) const { return GetObject<ContextPointer<T>>(key)->Get(); }
+    const T* Get(ContextKey key) const { return GetObject<ContextPointer<T>>(key)->Get(); }
+    template<class T>
+    const T* Get(const std::string& key) const { return Get<T>(ContextKey(key)); }
 
     Value GetRuntimeValue(Value v);
 
-    void Delete(const std::string& key) { map.erase(key); }
+    void Delete(ContextKey key)
+    {
+      std::unique_ptr<ContextObject> old;
+      auto lock = Lock();
+      if (map.Remove(key.Id(), old)) { Touch(); }
+    }
+    void Delete(const std::string& key) { Delete(ContextKey(key)); }
 
     // Logging helpers.
-    std::ostream& Debug() { return *Get<std::ostream>("hexl.log.stream.debug"); }
-    std::ostream& Info() { return *Get<std::ostream>("hexl.log.stream.info"); }
-    std::ostream& Error() { return *Get<std::ostream>("hexl.log.stream.error"); }
+    std::ostream& Debug() { return *Get<std::ostream>(CK_LOG_DEBUG); }
+    std::ostream& Info() { return *Get<std::ostream>(CK_LOG_INFO); }
+    std::ostream& Error() { return *Get<std::ostream>(CK_LOG_ERROR); }
 
 #ifdef _WIN32
     void Win32Error(const std::string& msg = "");
@@ -161,24 +368,33 @@ namespace hexl {
       }
     }
     bool IsDumpEnabled(const std::string& what, bool enableWithPlainDumpOption = true) const;
-    void SetOutputPath(const std::string& path) { Put("hexl.outputPath", path); }
-    const std::string& GetOutputPath() const { return GetString("hexl.outputPath"); }
+    void SetOutputPath(const std::string& path) { Put(CK_OUTPUT_PATH, path); }
+    const std::string& GetOutputPath() const { return GetString(CK_OUTPUT_PATH); }
     std::string GetOutputName(const std::string& name, const std::string& what);
     bool DumpTextIfEnabled(const std::string& name, const std::string& what, const std::string& text);
     bool DumpBinaryIfEnabled(const std::string& name, const std::string& what, const void *buffer, size_t bufferSize);
     void DumpBrigIfEnabled(const std::string& name, HSAIL_ASM::BrigContainer* brig);
 
     // Helper methods. Include HexlTest.hpp to use them.
-    ResourceManager* RM() { return Get<ResourceManager>("hexl.rm"); }
-    const ResourceManager* RM() const { return Get<ResourceManager>("hexl.rm"); }
-    TestFactory* Factory() { return Get<TestFactory>("hexl.testFactory"); }
+    ResourceManager* RM() { return Get<ResourceManager>(CK_RM); }
+    const ResourceManager* RM() const { return Get<ResourceManager>(CK_RM); }
+    TestFactory* Factory() { return Get<TestFactory>(CK_TEST_FACTORY); }
     //runtime::RuntimeState* State() { return Get<runtime::RuntimeState>("hexl.runtimestate"); }
-    runtime::RuntimeContext* Runtime() { return Get<runtime::RuntimeContext>("hexl.runtime"); }
-    const Options* Opts() const { return Get<Options>("hexl.options"); }
-    AllStats& Stats() { return *Get<AllStats>("hexl.stats"); }
+    runtime::RuntimeContext* Runtime() { return Get<runtime::RuntimeContext>(CK_RUNTIME); }
+    const Options* Opts() const { return Get<Options>(CK_OPTIONS); }
+    AllStats& Stats() { return *Get<AllStats>(CK_STATS); }
   };
 
   bool ValidateMemory(Context* context, ValueType vtype, const Values& expected, const void *actualPtr, const std::string& method);
+
+  /// Stores values under valuesId. Values that do not need to be resolved
+  /// at run time are also stored as a byte image (valuesId + ".image"), which
+  /// WriteRuntimeValues copies at once.
+  void MoveValues(Context* context, const std::string& valuesId, Values* values);
+
+  /// Writes values stored under valuesId to dest, resolving them in context.
+  /// Returns the number of bytes written.
+  size_t WriteRuntimeValues(Context* context, const std::string& valuesId, void* dest);
 }
 
 #endif // HEXL_CONTEXT_HPP
@@ -0,0 +1,105 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "HexlMessage.hpp"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace hexl {
+
+static bool WriteBytes(int fd, const char* data, size_t size)
+{
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+    data += n; size -= n;
+  }
+  return true;
+}
+
+static bool ReadBytes(int fd, char* data, size_t size)
+{
+  while (size > 0) {
+    ssize_t n = read(fd, data, size);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return false; }
+    data += n; size -= n;
+  }
+  return true;
+}
+
+static bool SendBytes(int fd, const char* data, size_t size, const std::function<bool()>& receive)
+{
+  while (size > 0) {
+    pollfd p;
+    p.fd = fd;
+    p.events = POLLIN | POLLOUT;
+    p.revents = 0;
+    if (poll(&p, 1, -1) < 0) {
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+    if (p.revents & POLLIN) {
+      if (!receive()) { return false; }
+      continue;
+    }
+    if (!(p.revents & POLLOUT)) { return false; }
+    ssize_t n = send(fd, data, size, MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) { continue; }
+      return false;
+    }
+    data += n; size -= n;
+  }
+  return true;
+}
+
+bool SendMessage(int fd, const std::ostringstream& message)
+{
+  std::string data = message.str();
+  uint64_t size = data.size();
+  return WriteBytes(fd, reinterpret_cast<const char*>(&size), sizeof(size)) &&
+         WriteBytes(fd, data.data(), data.size());
+}
+
+bool SendMessage(int fd, const std::ostringstream& message, const std::function<bool()>& receive)
+{
+  std::string data = message.str();
+  uint64_t size = data.size();
+  return SendBytes(fd, reinterpret_cast<const char*>(&size), sizeof(size), receive) &&
+         SendBytes(fd, data.data(), data.size(), receive);
+}
+
+bool ReceiveMessage(int fd, std::string& data)
+{
+  uint64_t size;
+  if (!ReadBytes(fd, reinterpret_cast<char*>(&size), sizeof(size))) { return false; }
+  data.resize((size_t) size);
+  return size == 0 || ReadBytes(fd, &data[0], (size_t) size);
+}
+
+}
+
+#endif // _WIN32
@@ -0,0 +1,43 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_MESSAGE_HPP
+#define HEXL_MESSAGE_HPP
+
+#ifndef _WIN32
+
+#include <functional>
+#include <string>
+#include <sstream>
+
+namespace hexl {
+
+/// Length-prefixed messages over a pipe or socket, used by the shard
+/// runner and remote agents. Both return false on error or end of stream.
+bool SendMessage(int fd, const std::ostringstream& message);
+bool ReceiveMessage(int fd, std::string& data);
+
+/// Sends message over a socket without blocking on a full socket buffer:
+/// receive is called whenever data arrives before the message is written,
+/// so a peer which writes a whole message of its own before reading (see
+/// Agent) is not deadlocked. Returns false if receive does.
+bool SendMessage(int fd, const std::ostringstream& message, const std::function<bool()>& receive);
+
+}
+
+#endif // _WIN32
+
+#endif // HEXL_MESSAGE_HPP
@@ -26,6 +26,28 @@ namespace hexl {
   template <>
   void Print(const SamplerParams& samplerParams, std::ostream& out) { samplerParams.Print(out); }
 
+  template <>
+  bool Serialize(const HSAIL_ASM::BrigContainer& brig, std::ostream& out)
+  {
+    BrigModule_t module = const_cast<HSAIL_ASM::BrigContainer *>(&brig)->getBrigModule();
+    WriteData(out, CO_BRIG);
+    WriteData(out, (uint64_t) module->byteCount);
+    out.write(reinterpret_cast<const char *>(module), module->byteCount);
+    return true;
+  }
+
+  template <>
+  bool Serialize(const Value& value, std::ostream& out) { WriteData(out, CO_VALUE); WriteData(out, value); return true; }
+
+  template <>
+  bool Serialize(const Values& values, std::ostream& out) { WriteData(out, CO_VALUES); WriteData(out, values); return true; }
+
+  template <>
+  bool Serialize(const ImageParams& imageParams, std::ostream& out) { WriteData(out, CO_IMAGE_PARAMS); imageParams.Serialize(out); return true; }
+
+  template <>
+  bool Serialize(const SamplerParams& samplerParams, std::ostream& out) { WriteData(out, CO_SAMPLER_PARAMS); samplerParams.Serialize(out); return true; }
+
   std::string GetOutputName(const std::string& path, const std::string& name, const std::string& ext)
   {
     if (ext.empty()) {
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <ostream>
+#include <vector>
 #include "HSAILBrigContainer.h"
 #include "MObject.hpp"
 
@@ -60,6 +61,11 @@ namespace hexl {
   template <>
   inline void Print<runtime::RuntimeContext>(const runtime::RuntimeContext& tf, std::ostream& out) { }
 
+  template <>
+  inline void Print<std::vector<char>>(const std::vector<char>& data, std::ostream& out) {
+    out << "<" << data.size() << " bytes>";
+  }
+
   template <>
   void Print(const GridGeometry& grid, std::ostream& out);
 
@@ -72,6 +78,46 @@ namespace hexl {
   template <typename T>
   inline void Dump(const T& t, const std::string& path, const std::string& name) { }
 
+  /// Kinds of context objects that can be sent to remote agents.
+  enum ContextObjectKind {
+    CO_VALUE = 1,
+    CO_VALUES,
+    CO_STRING,
+    CO_IMAGE_PARAMS,
+    CO_SAMPLER_PARAMS,
+    CO_BRIG,
+    CO_SCENARIO,
+  };
+
+  ENUM_SERIALIZER(ContextObjectKind);
+
+  /// Writes object kind and data. Returns false if objects of this type
+  /// can not be serialized.
+  template <typename T>
+  inline bool Serialize(const T& t, std::ostream& out) { return false; }
+
+  template <>
+  inline bool Serialize<std::string>(const std::string& s, std::ostream& out) {
+    WriteData(out, CO_STRING);
+    WriteData(out, s);
+    return true;
+  }
+
+  template <>
+  bool Serialize(const HSAIL_ASM::BrigContainer& brig, std::ostream& out);
+
+  template <>
+  bool Serialize(const Value& value, std::ostream& out);
+
+  template <>
+  bool Serialize(const Values& values, std::ostream& out);
+
+  template <>
+  bool Serialize(const ImageParams& imageParams, std::ostream& out);
+
+  template <>
+  bool Serialize(const SamplerParams& samplerParams, std::ostream& out);
+
   template <>
   void Dump<HSAIL_ASM::BrigContainer>(const HSAIL_ASM::BrigContainer&, const std::string& path, const std::string& name);
 
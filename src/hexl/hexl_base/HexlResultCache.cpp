@@ -0,0 +1,88 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "HexlResultCache.hpp"
+#include <cstdio>
+#include <fstream>
+
+namespace hexl {
+
+// File is "HXRC", version, count and entries of name, hash and status.
+static const uint32_t RESULT_CACHE_MAGIC = 0x43525848;
+static const uint32_t RESULT_CACHE_VERSION = 1;
+
+bool TestResultCache::Load(const std::string& fileName)
+{
+  std::ifstream in(fileName.c_str(), std::ifstream::binary);
+  if (!in.is_open()) { return false; }
+  uint32_t magic = 0, version = 0;
+  uint64_t count = 0;
+  ReadData(in, magic);
+  ReadData(in, version);
+  ReadData(in, count);
+  if (!in.good() || magic != RESULT_CACHE_MAGIC || version != RESULT_CACHE_VERSION) { return false; }
+  std::unordered_map<std::string, Entry> loaded;
+  for (uint64_t i = 0; i < count; ++i) {
+    std::string name;
+    Entry entry;
+    ReadData(in, name);
+    ReadData(in, entry.hash);
+    ReadData(in, entry.status);
+    if (!in.good()) { return false; }
+    loaded[name] = entry;
+  }
+  entries.swap(loaded);
+  return true;
+}
+
+bool TestResultCache::Save(const std::string& fileName) const
+{
+  // Written to a temporary file first, so that interrupted run does not
+  // destroy the cache.
+  std::string tmpName = fileName + ".tmp";
+  {
+    std::ofstream out(tmpName.c_str(), std::ofstream::binary);
+    if (!out.is_open()) { return false; }
+    WriteData(out, RESULT_CACHE_MAGIC);
+    WriteData(out, RESULT_CACHE_VERSION);
+    WriteData(out, (uint64_t) entries.size());
+    for (auto e = entries.begin(); e != entries.end(); ++e) {
+      WriteData(out, e->first);
+      WriteData(out, e->second.hash);
+      WriteData(out, e->second.status);
+    }
+    if (!out.good()) { return false; }
+  }
+#ifdef _WIN32
+  std::remove(fileName.c_str());
+#endif // _WIN32
+  return std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+}
+
+void TestResultCache::Update(const std::string& fullTestName, uint64_t hash, TestStatus status)
+{
+  Entry& entry = entries[fullTestName];
+  entry.hash = hash;
+  entry.status = status;
+}
+
+bool TestResultCache::IsPassed(const std::string& fullTestName, uint64_t hash) const
+{
+  auto e = entries.find(fullTestName);
+  return e != entries.end() && e->second.hash == hash && e->second.status == PASSED;
+}
+
+}
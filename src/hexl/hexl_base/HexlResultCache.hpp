@@ -0,0 +1,49 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_RESULT_CACHE_HPP
+#define HEXL_RESULT_CACHE_HPP
+
+#include "HexlTest.hpp"
+#include <unordered_map>
+
+namespace hexl {
+
+/// Results of previous runs with hashes of tests (see TestResult::Hash),
+/// keyed by full test name. Used by -incremental to skip tests which
+/// passed and did not change since.
+class TestResultCache {
+public:
+  /// Reads results saved by Save. Missing or malformed file is treated
+  /// as empty cache.
+  bool Load(const std::string& fileName);
+  bool Save(const std::string& fileName) const;
+
+  void Update(const std::string& fullTestName, uint64_t hash, TestStatus status);
+  bool IsPassed(const std::string& fullTestName, uint64_t hash) const;
+
+private:
+  struct Entry {
+    uint64_t hash;
+    TestStatus status;
+  };
+
+  std::unordered_map<std::string, Entry> entries;
+};
+
+}
+
+#endif // HEXL_RESULT_CACHE_HPP
@@ -0,0 +1,423 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "HexlShardRunner.hpp"
+
+#ifndef _WIN32
+
+#include "HexlTest.hpp"
+#include "HexlMessage.hpp"
+#include "Stats.hpp"
+#include "RuntimeCommon.hpp"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+namespace hexl {
+
+enum ShardMessage { SHARD_INFO = 1, SHARD_START, SHARD_RESULT, SHARD_FINISH };
+ENUM_SERIALIZER(ShardMessage);
+
+static const unsigned SHARD_MAX_FAILURES = 3;
+
+class ShardWorkerTestRunner : public TestRunnerBase {
+private:
+  unsigned shard;
+  unsigned shards;
+  uint64_t start;
+  int fd;
+  const TestDurations* durations;
+  bool schedule;
+  std::ostringstream testOut;
+  std::vector<std::pair<std::string, TestSpec*>> specs;
+  uint64_t index;
+  uint64_t position;
+  std::string fullTestName;
+
+  void Send(const std::ostringstream& message)
+  {
+    if (!SendMessage(fd, message)) {
+      // Supervisor is gone, nobody is interested in the results.
+      exit(21);
+    }
+  }
+
+protected:
+  std::ostream* TestOut() override { return &testOut; }
+
+  void AfterTest(const std::string& path, Test* test, const TestResult& result) override
+  {
+    bool withOutput = !result.IsPassed() || context->IsVerbose("testlog", false);
+    TestResult sent(result);
+    sent.SetOutput(withOutput ? testOut.str() : std::string());
+    std::ostringstream message;
+    WriteData(message, SHARD_RESULT);
+    WriteData(message, index);
+    WriteData(message, fullTestName);
+    WriteData(message, sent);
+    Send(message);
+    testOut.str(std::string());
+    testOut.clear();
+  }
+
+public:
+  ShardWorkerTestRunner(Context* context_, unsigned shard_, unsigned shards_, uint64_t start_, int fd_,
+                        const TestDurations* durations_, bool schedule_, const TestResultCache* resultCache_)
+    : TestRunnerBase(context_), shard(shard_), shards(shards_), start(start_), fd(fd_),
+      durations(durations_), schedule(schedule_), index(0), position(0)
+  {
+    resultCache = resultCache_;
+  }
+
+  ~ShardWorkerTestRunner() { close(fd); }
+
+  void Collect(const std::string& path, TestSpec* spec)
+  {
+    spec->InitContext(context);
+    if (!spec->IsValid()) { delete spec; return; }
+    specs.push_back(std::make_pair(path, spec));
+  }
+
+  bool RunTests(TestSet& tests) override;
+};
+
+class ShardWorkerIterator : public TestSpecIterator {
+private:
+  ShardWorkerTestRunner* runner;
+
+public:
+  explicit ShardWorkerIterator(ShardWorkerTestRunner* runner_)
+    : runner(runner_) { }
+
+  void operator()(const std::string& path, TestSpec* spec) override
+  {
+    runner->Collect(path, spec);
+  }
+};
+
+bool ShardWorkerTestRunner::RunTests(TestSet& tests)
+{
+  Init();
+  if (shard == 0 && start == 0) {
+    std::ostringstream info;
+    context->Runtime()->PrintInfo(info);
+    std::ostringstream message;
+    WriteData(message, SHARD_INFO);
+    WriteData(message, info.str());
+    Send(message);
+  }
+  ShardWorkerIterator it(this);
+  tests.Iterate(it);
+  // All workers compute the same assignment of tests to shards, longest
+  // tests of previous runs are spread between shards and started first.
+  std::vector<std::string> names;
+  std::vector<size_t> order;
+  for (size_t i = 0; i < specs.size(); ++i) {
+    names.push_back(specs[i].first + "/" + specs[i].second->TestName());
+    order.push_back(i);
+  }
+  if (schedule) { order = durations->Schedule(names); }
+  std::vector<unsigned> assignment = durations->Assign(names, order, shards);
+  uint64_t shardPosition = 0;
+  for (size_t i : order) {
+    if (assignment[i] != shard) { continue; }
+    if (shardPosition++ < start) { continue; }
+    index = i;
+    position = shardPosition - 1;
+    fullTestName = names[i];
+    // Sent before the test is created, so that a crash in test creation is
+    // also reported as the result of this test.
+    std::ostringstream message;
+    WriteData(message, SHARD_START);
+    WriteData(message, index);
+    WriteData(message, position);
+    WriteData(message, fullTestName);
+    Send(message);
+    RunTestSpec(specs[i].first, specs[i].second);
+    specs[i].second = 0;
+  }
+  for (auto& s : specs) { delete s.second; }
+  specs.clear();
+  std::ostringstream message;
+  WriteData(message, SHARD_FINISH);
+  WriteData(message, (uint64_t) names.size());
+  std::ostringstream runtimeStats;
+  context->Runtime()->PrintStats(runtimeStats);
+  WriteData(message, runtimeStats.str());
+  Send(message);
+  return true;
+}
+
+ShardTestRunner::ShardTestRunner(Context* context_)
+  : HTestRunner(context_), nextRecord(0), testCount(0), workerShard(0), workerFd(-1)
+{
+  unsigned concurrency = std::thread::hardware_concurrency();
+  shards = context->Opts()->GetUnsigned("jobs", concurrency > 0 ? concurrency : 1);
+  if (shards == 0) { shards = 1; }
+  testTimeout = context->Opts()->GetUnsigned("shardtimeout", 600);
+  shardStates.resize(shards);
+}
+
+ShardTestRunner::~ShardTestRunner()
+{
+  for (Shard& s : shardStates) {
+    if (s.fd >= 0) { close(s.fd); }
+  }
+}
+
+pid_t ShardTestRunner::StartWorker(unsigned shard)
+{
+  Shard& s = shardStates[shard];
+  int fds[2];
+  if (pipe(fds) != 0) {
+    context->Error() << "Failed to create pipe for shard " << shard << std::endl;
+    return -1;
+  }
+  // Make sure buffered output is not written twice.
+  std::cout.flush();
+  TestLog().flush();
+  SummaryLog().flush();
+  TimingLog().flush();
+  pid_t pid = fork();
+  if (pid < 0) {
+    context->Error() << "Failed to start worker process for shard " << shard << std::endl;
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    for (Shard& other : shardStates) {
+      if (other.fd >= 0) { close(other.fd); other.fd = -1; }
+    }
+    TestLog().close();
+    SummaryLog().close();
+    TimingLog().close();
+    workerShard = shard;
+    workerFd = fds[1];
+    return 0;
+  }
+  close(fds[1]);
+  s.pid = pid;
+  s.fd = fds[0];
+  s.running = false;
+  s.timedOut = false;
+  return pid;
+}
+
+TestRunner* ShardTestRunner::CreateWorkerRunner()
+{
+  assert(workerFd >= 0);
+  return new ShardWorkerTestRunner(context, workerShard, shards, shardStates[workerShard].start, workerFd, &scheduleDurations, schedule, resultCache);
+}
+
+bool ShardTestRunner::ReadMessage(unsigned shard)
+{
+  Shard& s = shardStates[shard];
+  std::string data;
+  if (!ReceiveMessage(s.fd, data)) { return false; }
+  std::istringstream message(data);
+  ShardMessage type;
+  ReadData(message, type);
+  switch (type) {
+  case SHARD_INFO: {
+    std::string info;
+    ReadData(message, info);
+    SummaryLog() << info << std::endl << std::endl;
+    break;
+  }
+  case SHARD_START:
+    ReadData(message, s.runningIndex);
+    ReadData(message, s.runningPosition);
+    ReadData(message, s.runningName);
+    s.running = true;
+    s.runningSince = Clock::now();
+    LogTestStart(s.runningName);
+    break;
+  case SHARD_RESULT: {
+    uint64_t index;
+    Record record;
+    ReadData(message, index);
+    ReadData(message, record.fullTestName);
+    ReadData(message, record.result);
+    records[index] = record;
+    s.running = false;
+    s.start = s.runningPosition + 1;
+    s.failures = 0;
+    break;
+  }
+  case SHARD_FINISH: {
+    uint64_t count;
+    ReadData(message, count);
+    testCount = (std::max)(testCount, count);
+    ReadData(message, s.runtimeStats);
+    s.finished = true;
+    break;
+  }
+  default:
+    assert(false);
+    return false;
+  }
+  return true;
+}
+
+void ShardTestRunner::WorkerExited(unsigned shard)
+{
+  Shard& s = shardStates[shard];
+  close(s.fd);
+  s.fd = -1;
+  int status = 0;
+  waitpid(s.pid, &status, 0);
+  s.pid = -1;
+  if (s.finished) { return; }
+  std::ostringstream reason;
+  reason << "Worker process for shard " << shard;
+  if (s.timedOut) {
+    reason << " timed out after " << testTimeout << "s";
+  } else if (WIFSIGNALED(status)) {
+    reason << " terminated by signal " << WTERMSIG(status);
+  } else if (WIFEXITED(status)) {
+    reason << " exited with code " << WEXITSTATUS(status);
+  }
+  if (s.running) {
+    Record record;
+    record.fullTestName = s.runningName;
+    record.result = TestResult(ERROR, reason.str() + " while running the test\n");
+    records[s.runningIndex] = record;
+    s.start = s.runningPosition + 1;
+    s.running = false;
+    s.failures = 0;
+  } else if (++s.failures >= SHARD_MAX_FAILURES) {
+    context->Error() << reason.str() << ", giving up on this shard" << std::endl;
+    SummaryLog() << reason.str() << ", giving up on this shard" << std::endl;
+    s.abandoned = true;
+  } else {
+    context->Error() << reason.str() << std::endl;
+  }
+}
+
+void ShardTestRunner::CheckTimeouts()
+{
+  if (testTimeout == 0) { return; }
+  Clock::time_point now = Clock::now();
+  for (Shard& s : shardStates) {
+    if (s.pid > 0 && s.running && !s.timedOut &&
+        now - s.runningSince > std::chrono::seconds(testTimeout)) {
+      s.timedOut = true;
+      kill(s.pid, SIGKILL);
+    }
+  }
+}
+
+void ShardTestRunner::PrintRuntimeStats(std::ostream& out)
+{
+  for (unsigned shard = 0; shard < shards; ++shard) {
+    const std::string& stats = shardStates[shard].runtimeStats;
+    if (!stats.empty()) { out << "Shard " << shard << ": " << stats; }
+  }
+}
+
+void ShardTestRunner::FlushRecords(bool all)
+{
+  uint64_t notRun = 0;
+  while (!records.empty()) {
+    std::map<uint64_t, Record>::iterator r = records.begin();
+    if (r->first != nextRecord) {
+      // Tests of abandoned shards will never be reported. Supervisor does
+      // not know assignment of tests to shards, so they are counted only
+      // when all shards are done.
+      if (!all) { break; }
+      ++nextRecord;
+      ++notRun;
+      continue;
+    }
+    LogTestPath(r->second.fullTestName);
+    LogTestResult(r->second.fullTestName, r->second.result, r->second.result.Output());
+    r->second.result.IncStats(stats);
+    records.erase(r);
+    ++nextRecord;
+  }
+  if (!all) { return; }
+  if (testCount > nextRecord) { notRun += testCount - nextRecord; }
+  unsigned abandoned = 0;
+  for (const Shard& s : shardStates) { if (s.abandoned) { abandoned++; } }
+  if (abandoned == 0) { return; }
+  // Number of tests is known only if some shard finished, otherwise at
+  // least one test per abandoned shard is counted.
+  if (testCount == 0) { notRun = (std::max)(notRun, (uint64_t) abandoned); }
+  context->Error() << notRun << " tests of abandoned shards were not run" << std::endl;
+  SummaryLog() << notRun << " tests of abandoned shards were not run" << std::endl;
+  for (uint64_t i = 0; i < notRun; ++i) { stats.TestSet().IncError(); }
+}
+
+bool ShardTestRunner::Supervise()
+{
+  EmptyTestSet noTests;
+  Init();
+  if (!BeforeTestSet(noTests)) { return true; }
+  scheduleDurations = durations;
+  for (unsigned shard = 0; shard < shards; ++shard) {
+    pid_t pid = StartWorker(shard);
+    if (pid == 0) { return false; }
+    if (pid < 0) { shardStates[shard].abandoned = true; }
+  }
+  for (;;) {
+    std::vector<pollfd> fds;
+    std::vector<unsigned> fdShards;
+    for (unsigned shard = 0; shard < shards; ++shard) {
+      if (shardStates[shard].fd >= 0) {
+        pollfd p;
+        p.fd = shardStates[shard].fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        fds.push_back(p);
+        fdShards.push_back(shard);
+      }
+    }
+    if (fds.empty()) { break; }
+    int n = poll(&fds[0], fds.size(), 1000);
+    if (n < 0 && errno != EINTR) {
+      context->Error() << "poll failed: " << errno << std::endl;
+      break;
+    }
+    for (size_t i = 0; n > 0 && i < fds.size(); ++i) {
+      if (!fds[i].revents) { continue; }
+      unsigned shard = fdShards[i];
+      if (ReadMessage(shard)) { continue; }
+      WorkerExited(shard);
+      Shard& s = shardStates[shard];
+      if (!s.finished && !s.abandoned) {
+        pid_t pid = StartWorker(shard);
+        if (pid == 0) { return false; }
+        if (pid < 0) { s.abandoned = true; }
+      }
+    }
+    CheckTimeouts();
+    FlushRecords(false);
+  }
+  FlushRecords(true);
+  AfterTestSet(noTests);
+  return true;
+}
+
+}
+
+#endif // _WIN32
@@ -0,0 +1,103 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_SHARD_RUNNER_HPP
+#define HEXL_SHARD_RUNNER_HPP
+
+#include "HexlTestRunner.hpp"
+#include <map>
+#include <vector>
+#include <chrono>
+
+#ifndef _WIN32
+#include <sys/types.h>
+
+namespace hexl {
+
+/// Runs test set in several worker processes. Valid tests are assigned to
+/// shards by TestDurations::Assign, which is round-robin in iteration order
+/// when there is no history of test durations.
+///
+/// Supervisor process does not initialize the runtime. It forks workers,
+/// each of which creates own runtime and test set and reports results
+/// back through a pipe. Worker that dies while running a test is restarted
+/// after that test, which is reported as ERROR. Results are written to
+/// test log and summary in test order, same as with HTestRunner.
+class ShardTestRunner : public HTestRunner {
+public:
+  ShardTestRunner(Context* context_);
+  ~ShardTestRunner();
+
+  /// Returns true in supervisor process when all shards are completed.
+  /// Returns false in a new worker process, which should continue with
+  /// creating runtime and test set and run it with CreateWorkerRunner().
+  bool Supervise();
+  TestRunner* CreateWorkerRunner();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Shard {
+    Shard() : pid(-1), fd(-1), start(0), running(false), runningIndex(0), runningPosition(0), timedOut(false), failures(0), finished(false), abandoned(false) { }
+    pid_t pid;
+    int fd;
+    uint64_t start; // Position in shard tests to (re)start worker from.
+    bool running;
+    uint64_t runningIndex;
+    uint64_t runningPosition;
+    std::string runningName;
+    Clock::time_point runningSince;
+    bool timedOut;
+    unsigned failures;
+    bool finished;
+    bool abandoned;
+    std::string runtimeStats;
+  };
+
+  struct Record {
+    std::string fullTestName;
+    TestResult result;
+  };
+
+  unsigned shards;
+  unsigned testTimeout;
+  std::vector<Shard> shardStates;
+  std::map<uint64_t, Record> records;
+  uint64_t nextRecord;
+  // Number of tests in the test set, as reported by finished workers.
+  uint64_t testCount;
+  unsigned workerShard;
+  int workerFd;
+  // Durations as loaded before the first worker is started. Workers,
+  // including restarted ones, compute test order and assignment to shards
+  // from this snapshot, which is not affected by results of this run.
+  TestDurations scheduleDurations;
+
+  pid_t StartWorker(unsigned shard);
+  bool ReadMessage(unsigned shard);
+  void WorkerExited(unsigned shard);
+  void CheckTimeouts();
+  void FlushRecords(bool all);
+
+protected:
+  void PrintRuntimeStats(std::ostream& out) override;
+};
+
+}
+
+#endif // _WIN32
+
+#endif // HEXL_SHARD_RUNNER_HPP
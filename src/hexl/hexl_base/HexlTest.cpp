@@ -18,6 +18,11 @@
 
 #include "hsail_c.h"
 
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <set>
 #include <string>
 #include <cassert>
 #include <sstream>
@@ -41,6 +46,19 @@ const char *TestStatusString(TestStatus status)
   }
 }
 
+const char *TestPhaseString(TestPhase phase)
+{
+  switch (phase) {
+  case PHASE_CREATE: return "create";
+  case PHASE_MODULE: return "module";
+  case PHASE_FINALIZE: return "finalize";
+  case PHASE_LOAD: return "load";
+  case PHASE_DISPATCH: return "dispatch";
+  case PHASE_VALIDATE: return "validate";
+  default: assert(false); return "<ErrorTestPhase>";
+  }
+}
+
 void TestResult::IncStats(AllStats& allStats) const
 {
   switch (status) {
@@ -56,12 +74,40 @@ void TestResult::Serialize(std::ostream& out) const
 {
   WriteData(out, status);
   WriteData(out, output);
+  // Times are sent as microseconds.
+  WriteData(out, (uint64_t) (time * 1e6));
+  for (unsigned p = 0; p < PHASE_COUNT; ++p) {
+    WriteData(out, (uint64_t) (phaseTimes[p] * 1e6));
+  }
+  WriteData(out, hash);
+  WriteData(out, (uint32_t) reused);
 }
 
 void TestResult::Deserialize(std::istream& in)
 {
   ReadData(in, status);
   ReadData(in, output);
+  uint64_t us;
+  ReadData(in, us);
+  time = us / 1e6;
+  for (unsigned p = 0; p < PHASE_COUNT; ++p) {
+    ReadData(in, us);
+    phaseTimes[p] = us / 1e6;
+  }
+  uint32_t r;
+  ReadData(in, hash);
+  ReadData(in, r);
+  reused = r != 0;
+}
+
+void TestResult::PrintPhaseTimes(std::ostream& out) const
+{
+  bool first = true;
+  for (unsigned p = 0; p < PHASE_COUNT; ++p) {
+    if (phaseTimes[p] == 0) { continue; }
+    out << (first ? "" : " ") << TestPhaseString((TestPhase) p) << " " << phaseTimes[p] << "s";
+    first = false;
+  }
 }
 
 std::string Test::TestName() const
@@ -128,6 +174,18 @@ public:
 //    it(base + "/" + path, test);
     it((base.empty() ? "" : base + "/") + path, test);
   }
+
+  bool Includes(const std::string& path)
+  {
+    return it.Includes((base.empty() ? "" : base + "/") + path);
+  }
+
+  void BeginGroup(TestGroup& group)
+  {
+    group.path = (base.empty() ? "" : base + "/") + group.path;
+    it.BeginGroup(group);
+  }
+  void EndGroup() { it.EndGroup(); }
  
 private:
   const std::string& base;
@@ -136,8 +194,10 @@ private:
 
 bool TestNameFilter::Matches(const std::string& path, Test* test)
 {
-  std::string name = path + "/" + test->TestName();
-  return Matches(name);
+  if (!MayMatch(path)) { return false; }
+  size_t offset = path.length() + 1;
+  if (namePattern.length() <= offset) { return true; }
+  return test->TestName().compare(0, namePattern.length() - offset, namePattern, offset, std::string::npos) == 0;
 }
 
 bool TestNameFilter::Matches(const std::string& name)
@@ -146,20 +206,108 @@ bool TestNameFilter::Matches(const std::string& name)
          (name.substr(0, namePattern.length()) == namePattern);
 }
 
+bool TestNameFilter::MayMatch(const std::string& path)
+{
+  // Names of tests with this path start with path + "/".
+  size_t n = std::min(namePattern.length(), path.length());
+  if (namePattern.compare(0, n, path, 0, n) != 0) { return false; }
+  return namePattern.length() <= path.length() || namePattern[path.length()] == '/';
+}
+
+ExcludeListFilter::ExcludeListFilter()
+  : origin(this)
+{
+  Node root = { NO_NODE, NO_NODE, -1, 0 };
+  nodes.push_back(root);
+}
+
+ExcludeListFilter::ExcludeListFilter(ExcludeListFilter* origin_)
+  : origin(origin_)
+{
+  Node root = { NO_NODE, NO_NODE, -1, 0 };
+  nodes.push_back(root);
+}
+
+uint32_t ExcludeListFilter::Child(uint32_t node, char c) const
+{
+  for (uint32_t n = nodes[node].child; n != NO_NODE; n = nodes[n].sibling) {
+    if (nodes[n].c == c) { return n; }
+  }
+  return NO_NODE;
+}
+
+uint32_t ExcludeListFilter::AddChild(uint32_t node, char c)
+{
+  uint32_t n = Child(node, c);
+  if (n != NO_NODE) { return n; }
+  Node child = { NO_NODE, nodes[node].child, -1, c };
+  n = (uint32_t) nodes.size();
+  nodes.push_back(child);
+  nodes[node].child = n;
+  return n;
+}
+
+int32_t ExcludeListFilter::Walk(uint32_t& node, const std::string& s) const
+{
+  for (char c : s) {
+    node = Child(node, c);
+    if (node == NO_NODE) { return -1; }
+    if (nodes[node].entry >= 0) { return nodes[node].entry; }
+  }
+  return -1;
+}
+
+bool ExcludeListFilter::Result(int32_t entry)
+{
+  if (entry < 0) { return true; }
+  origin->entries[entry].excludedTests++;
+  return false;
+}
+
 bool ExcludeListFilter::Matches(const std::string& path, Test* test)
 {
-  std::string name = path + "/" + test->TestName();
-  return Matches(name);
+  uint32_t node = 0;
+  if (nodes[node].entry >= 0) { return Result(nodes[node].entry); }
+  int32_t entry = Walk(node, path);
+  if (entry >= 0 || node == NO_NODE) { return Result(entry); }
+  node = Child(node, '/');
+  if (node == NO_NODE) { return true; }
+  if (nodes[node].entry >= 0) { return Result(nodes[node].entry); }
+  return Result(Walk(node, test->TestName()));
 }
 
-bool ExcludeListFilter::Matches(const std::string& name)
+bool ExcludeListFilter::MayMatch(const std::string& path)
 {
-  for (std::string prefix : excludePrefixes) {
-    if (name.compare(0, prefix.length(), prefix) == 0) {
-      return false;
+  uint32_t node = 0;
+  int32_t entry = nodes[node].entry;
+  if (entry < 0) {
+    entry = Walk(node, path);
+    if (entry < 0 && node != NO_NODE) {
+      node = Child(node, '/');
+      if (node != NO_NODE) { entry = nodes[node].entry; }
     }
   }
-  return true;
+  if (entry < 0) { return true; }
+  origin->entries[entry].excludedTestSets++;
+  return false;
+}
+
+bool ExcludeListFilter::Matches(const std::string& name)
+{
+  uint32_t node = 0;
+  if (nodes[node].entry >= 0) { return Result(nodes[node].entry); }
+  return Result(Walk(node, name));
+}
+
+void ExcludeListFilter::AddPrefix(const std::string& prefix)
+{
+  assert(origin == this);
+  uint32_t node = 0;
+  for (char c : prefix) { node = AddChild(node, c); }
+  // Repeated entry never matches, so it is reported as unused.
+  if (nodes[node].entry < 0) { nodes[node].entry = (int32_t) entries.size(); }
+  Entry entry = { prefix, 0, 0 };
+  entries.push_back(entry);
 }
 
 bool ExcludeListFilter::Load(ResourceManager* rm, const std::string& name)
@@ -178,6 +326,60 @@ bool ExcludeListFilter::Load(ResourceManager* rm, const std::string& name)
   return true;
 }
 
+bool ExcludeListFilter::SubFilterCopy(uint32_t node, uint32_t subNode, bool leading, ExcludeListFilter* sub, int32_t& excluded) const
+{
+  for (uint32_t n = nodes[node].child; n != NO_NODE; n = nodes[n].sibling) {
+    // Separators right after base are cut, see CutTestNamePrefix.
+    bool slash = leading && nodes[n].c == '/';
+    uint32_t subChild = slash ? subNode : sub->AddChild(subNode, nodes[n].c);
+    if (nodes[n].entry >= 0) {
+      if (subChild == 0) { excluded = nodes[n].entry; return false; }
+      if (sub->nodes[subChild].entry < 0) { sub->nodes[subChild].entry = nodes[n].entry; }
+    }
+    if (!SubFilterCopy(n, subChild, slash, sub, excluded)) { return false; }
+  }
+  return true;
+}
+
+ExcludeListFilter* ExcludeListFilter::SubFilter(const std::string& base)
+{
+  ExcludeListFilter* sub = new ExcludeListFilter(origin);
+  // Entries shorter than base do not apply to test sets under base.
+  uint32_t node = 0;
+  for (char c : base) {
+    node = Child(node, c);
+    if (node == NO_NODE) { return sub; }
+  }
+  int32_t excluded = nodes[node].entry;
+  if (excluded < 0 && SubFilterCopy(node, 0, true, sub, excluded)) { return sub; }
+  origin->entries[excluded].excludedTestSets++;
+  delete sub;
+  return 0;
+}
+
+void ExcludeListFilter::PrintSummary(std::ostream& out) const
+{
+  uint64_t tests = 0, testSets = 0;
+  size_t unused = 0;
+  for (const Entry& entry : origin->entries) {
+    tests += entry.excludedTests;
+    testSets += entry.excludedTestSets;
+    if (entry.excludedTests == 0 && entry.excludedTestSets == 0) { unused++; }
+  }
+  // Tests of excluded test sets are not created, so they are not counted.
+  out << "Excluded: " << tests << " tests, " << testSets << " test sets";
+  if (unused > 0) { out << ", " << unused << " of " << origin->entries.size() << " exclude list entries excluded nothing"; }
+  out << std::endl;
+}
+
+void ExcludeListFilter::WriteStats(std::ostream& out) const
+{
+  out << "tests\ttestsets\tprefix" << std::endl;
+  for (const Entry& entry : origin->entries) {
+    out << entry.excludedTests << "\t" << entry.excludedTestSets << "\t" << entry.prefix << std::endl;
+  }
+}
+
 TestSet* BasicTestSet::Filter(TestNameFilter* filter)
 {
   return new FilteredTestSet(this, filter);
@@ -201,6 +403,14 @@ public:
       delete test;
     }
   }
+
+  bool Includes(const std::string& path)
+  {
+    return filter->MayMatch(path) && it.Includes(path);
+  }
+
+  void BeginGroup(TestGroup& group) { it.BeginGroup(group); }
+  void EndGroup() { it.EndGroup(); }
  
 private:
   TestSpecIterator& it;
@@ -224,6 +434,172 @@ void FilteredTestSet::Iterate(TestSpecIterator& it)
   parent->Iterate(fi);
 }
 
+uint64_t TestGroup::Count() const
+{
+  uint64_t count = 1;
+  for (uint64_t d : dimensions) { count *= d; }
+  return count;
+}
+
+// Tests are numbered in test set order, groups are numbered as a whole so
+// that tests not selected by this shard are never created.
+class ShardIterator : public TestSpecIterator {
+public:
+  ShardIterator(TestSpecIterator& it_, unsigned index_, unsigned count_)
+    : it(it_), index(index_), count(count_), next(0), group(false) { }
+
+  void operator()(const std::string& path, TestSpec* test)
+  {
+    if (group || next++ % count == index) {
+      it(path, test);
+    } else {
+      delete test;
+    }
+  }
+
+  // Groups excluded further down are still numbered (see BeginGroup), so
+  // that parts do not depend on -exclude.
+  bool Includes(const std::string& path) { return true; }
+
+  void BeginGroup(TestGroup& testGroup)
+  {
+    uint64_t selectedCount = testGroup.SelectedCount();
+    std::vector<uint64_t> indices;
+    if (it.Includes(testGroup.path)) {
+      for (uint64_t i = (index + count - next % count) % count; i < selectedCount; i += count) {
+        indices.push_back(testGroup.Selected(i));
+      }
+    }
+    next += selectedCount;
+    testGroup.indices.swap(indices);
+    testGroup.selected = true;
+    group = true;
+    it.BeginGroup(testGroup);
+  }
+
+  void EndGroup() { group = false; it.EndGroup(); }
+
+private:
+  TestSpecIterator& it;
+  unsigned index;
+  unsigned count;
+  uint64_t next;
+  bool group;
+};
+
+void ShardedTestSet::Iterate(TestSpecIterator& it)
+{
+  ShardIterator si(it, index, count);
+  parent->Iterate(si);
+}
+
+TestSet* ShardedTestSet::Filter(TestNameFilter* filter)
+{
+  return new FilteredTestSet(this, filter);
+}
+
+TestSet* ShardedTestSet::Filter(ExcludeListFilter* filter)
+{
+  return new FilteredTestSet(this, filter);
+}
+
+// Random numbers are drawn from mt19937_64 without std distributions, so
+// that samples are the same with every standard library.
+class SampleIterator : public TestSpecIterator {
+public:
+  SampleIterator(TestSpecIterator& it_, double fraction_, uint64_t count_, uint64_t seed_)
+    : it(it_), fraction(fraction_), count(count_), seed(seed_) { }
+
+  void operator()(const std::string& path, TestSpec* test) { it(path, test); }
+
+  bool Includes(const std::string& path) { return it.Includes(path); }
+
+  void BeginGroup(TestGroup& group)
+  {
+    assert(!group.selected);
+    Sample(group);
+    it.BeginGroup(group);
+  }
+
+  void EndGroup() { it.EndGroup(); }
+
+private:
+  TestSpecIterator& it;
+  double fraction;
+  uint64_t count;
+  uint64_t seed;
+  std::map<std::string, uint64_t> pathGroups;
+
+  void Sample(TestGroup& group)
+  {
+    uint64_t ordinal = pathGroups[group.path]++;
+    uint64_t total = group.Count();
+    uint64_t budget = fraction > 0 ? (uint64_t) std::ceil(fraction * total) : count;
+    uint64_t coverage = 0;
+    for (uint64_t d : group.dimensions) { coverage = std::max(coverage, d); }
+    budget = std::min(std::max(budget, coverage), total);
+    if (budget == total) { return; }
+
+    // Families may share a path, so their dimensions and ordinal among
+    // groups with the same path are hashed as well.
+    uint64_t h = 14695981039346656037ULL;
+    for (char c : group.path) { h = (h ^ (uint8_t) c) * 1099511628211ULL; }
+    for (uint64_t d : group.dimensions) { h = (h ^ d) * 1099511628211ULL; }
+    h = (h ^ ordinal) * 1099511628211ULL;
+    std::mt19937_64 random(h ^ seed);
+
+    // Every value of every dimension: row j uses value perm[j % size] of
+    // each dimension, dimensions permuted randomly.
+    std::vector<std::vector<uint64_t>> perms(group.dimensions.size());
+    for (size_t d = 0; d < perms.size(); ++d) {
+      perms[d].resize((size_t) group.dimensions[d]);
+      for (uint64_t v = 0; v < group.dimensions[d]; ++v) { perms[d][v] = v; }
+      for (size_t v = perms[d].size(); v > 1; --v) { std::swap(perms[d][v - 1], perms[d][random() % v]); }
+    }
+    std::set<uint64_t> selected;
+    for (uint64_t j = 0; j < coverage; ++j) {
+      uint64_t index = 0;
+      for (size_t d = 0; d < perms.size(); ++d) {
+        index = index * group.dimensions[d] + perms[d][j % perms[d].size()];
+      }
+      selected.insert(index);
+    }
+
+    // Fill the rest with random tests not selected yet.
+    uint64_t rest = budget - selected.size();
+    if (rest * 2 < total) {
+      while (selected.size() < budget) { selected.insert(random() % total); }
+    } else {
+      uint64_t candidates = total - selected.size();
+      std::vector<uint64_t> fill;
+      for (uint64_t i = 0; i < total && rest > 0; ++i) {
+        if (selected.count(i)) { continue; }
+        if (random() % candidates < rest) { fill.push_back(i); rest--; }
+        candidates--;
+      }
+      selected.insert(fill.begin(), fill.end());
+    }
+    group.indices.assign(selected.begin(), selected.end());
+    group.selected = true;
+  }
+};
+
+void SampledTestSet::Iterate(TestSpecIterator& it)
+{
+  SampleIterator si(it, fraction, count, seed);
+  parent->Iterate(si);
+}
+
+TestSet* SampledTestSet::Filter(TestNameFilter* filter)
+{
+  return new FilteredTestSet(this, filter);
+}
+
+TestSet* SampledTestSet::Filter(ExcludeListFilter* filter)
+{
+  return new FilteredTestSet(this, filter);
+}
+
 TestSet* OneTest::Filter(TestNameFilter* filter)
 {
   if (filter->Matches("", test)) {
@@ -274,18 +650,8 @@ TestSet* TestSetUnion::Filter(TestNameFilter* filter)
 
 TestSet* TestSetUnion::Filter(ExcludeListFilter* filter)
 {
-  std::string rest;
-  ExcludeListFilter* filter1 = new ExcludeListFilter();
-  for (std::string prefix : filter->ExcludePrefixes()) {
-    if (CutTestNamePrefix(prefix, base, rest)) {
-      if (rest.empty()) {
-        delete filter1;
-        return new EmptyTestSet();
-      } else {
-        filter1->AddPrefix(rest);
-      }
-    }
-  }
+  ExcludeListFilter* filter1 = filter->SubFilter(base);
+  if (!filter1) { return new EmptyTestSet(); }
   TestSetUnion* ts = new TestSetUnion(base);
   for (unsigned i = 0; i < testSets.size(); ++i) {
     ts->Add(testSets[i]->Filter(filter1));
@@ -28,7 +28,8 @@
 #include <cassert>
 #include <memory>
 #include <vector>
-#include <ctime>
+#include <chrono>
+#include <mutex>
 
 namespace hexl {
 
@@ -50,18 +51,43 @@ inline void Print<TestStatus>(const TestStatus& status, std::ostream& out) {
   out << TestStatusString(status); 
 }
 
+/// Phases of test execution which are timed separately.
+enum TestPhase {
+  PHASE_CREATE = 0,
+  PHASE_MODULE,
+  PHASE_FINALIZE,
+  PHASE_LOAD,
+  PHASE_DISPATCH,
+  PHASE_VALIDATE,
+  PHASE_COUNT
+};
+
+const char *TestPhaseString(TestPhase phase);
+
+/// Monotonic wall clock used for all test timing.
+typedef std::chrono::steady_clock TestClock;
+
+inline double ElapsedSeconds(TestClock::time_point begin, TestClock::time_point end = TestClock::now())
+{
+  return std::chrono::duration<double>(end - begin).count();
+}
+
 class TestResult {
 private:
   TestStatus status;
   std::string output;
-  clock_t t_begin;
-  clock_t t_end;
+  double time;
+  double phaseTimes[PHASE_COUNT];
+  uint64_t hash;
+  bool reused;
+
+  void ClearTime() { time = 0; for (unsigned p = 0; p < PHASE_COUNT; ++p) { phaseTimes[p] = 0; } }
 
 public:
   TestResult()
-    : status(PASSED) { }
+    : status(PASSED), hash(0), reused(false) { ClearTime(); }
   TestResult(TestStatus status_, const std::string& output_ = "")
-    : status(status_), output(output_) { }
+    : status(status_), output(output_), hash(0), reused(false) { ClearTime(); }
   TestStatus Status() const { return status; }
   const char *StatusString() const { return TestStatusString(status); }
   void SetStatus(TestStatus status) { this->status = status; }
@@ -77,8 +103,58 @@ public:
   void SetOutput(const std::string& output) { this->output = output; }
   void Serialize(std::ostream& out) const;
   void Deserialize(std::istream& in);
-  void SetTime(clock_t begin, clock_t end) { t_begin = begin; t_end = end; }
-  float ExecutionTime() const { return ((float)(t_end - t_begin))/CLOCKS_PER_SEC; }
+  /// Wall-clock execution time in seconds, including creation of the test.
+  void SetTime(double seconds) { time = seconds; }
+  double ExecutionTime() const { return time; }
+  void SetPhaseTime(TestPhase phase, double seconds) { phaseTimes[phase] = seconds; }
+  double PhaseTime(TestPhase phase) const { return phaseTimes[phase]; }
+  void PrintPhaseTimes(std::ostream& out) const;
+  /// Hash of test content and runtime fingerprint, 0 if not computed
+  /// (see -incremental).
+  void SetHash(uint64_t hash) { this->hash = hash; }
+  uint64_t Hash() const { return hash; }
+  /// Result was taken from previous run instead of executing the test.
+  void SetReused() { reused = true; }
+  bool IsReused() const { return reused; }
+};
+
+/// Accumulates phase times of a running test. Test runner puts it to test
+/// context as "hexl.timing", scenario commands add to it with PhaseTimer.
+class TestTiming {
+private:
+  std::mutex mutex;
+  double phaseTimes[PHASE_COUNT];
+
+public:
+  TestTiming() { for (unsigned p = 0; p < PHASE_COUNT; ++p) { phaseTimes[p] = 0; } }
+  void Add(TestPhase phase, double seconds)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    phaseTimes[phase] += seconds;
+  }
+  void CopyTo(TestResult& result)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (unsigned p = PHASE_CREATE + 1; p < PHASE_COUNT; ++p) { result.SetPhaseTime((TestPhase) p, phaseTimes[p]); }
+  }
+};
+
+template <>
+inline void Print<TestTiming>(const TestTiming& timing, std::ostream& out) { }
+
+/// Adds time between construction and destruction to the phase in
+/// "hexl.timing" of the context, if any.
+class PhaseTimer {
+private:
+  TestTiming* timing;
+  TestPhase phase;
+  TestClock::time_point begin;
+
+public:
+  PhaseTimer(Context* context, TestPhase phase_)
+    : timing(context->Contains(CK_TIMING) ? context->Get<TestTiming>(CK_TIMING) : 0),
+      phase(phase_), begin(TestClock::now()) { }
+  ~PhaseTimer() { if (timing) { timing->Add(phase, ElapsedSeconds(begin)); } }
 };
 
 ENUM_SERIALIZER(TestStatus);
@@ -96,6 +172,9 @@ public:
   virtual void Serialize(std::ostream& out) const = 0;
   virtual void Run() = 0;
   virtual TestResult Result() const = 0;
+  /// Computes hash of everything the test executes and validates. Returns
+  /// false if it is not supported by the test.
+  virtual bool ContentHash(uint64_t& hash) const { return false; }
 };
 
 class TestImpl : public Test {
@@ -159,9 +238,37 @@ public:
   virtual bool IsValid() const { return true; }
 };
 
+/// Tests which a test set is about to create from one parameter product,
+/// see TestSpecIterator::BeginGroup.
+class TestGroup {
+public:
+  /// Path of the tests.
+  std::string path;
+  /// Sizes of product dimensions. Index of a test is a mixed radix number
+  /// with a digit per dimension, the first dimension is most significant.
+  std::vector<uint64_t> dimensions;
+  /// Indices of tests to create in increasing order, if selected is set.
+  std::vector<uint64_t> indices;
+  bool selected;
+
+  TestGroup(const std::string& path_)
+    : path(path_), selected(false) { }
+
+  uint64_t Count() const;
+  uint64_t SelectedCount() const { return selected ? indices.size() : Count(); }
+  uint64_t Selected(uint64_t i) const { return selected ? indices[i] : i; }
+};
+
 class TestSpecIterator {
 public:
   virtual void operator()(const std::string& path, TestSpec* spec) = 0;
+  /// False if no test with given path is wanted, so test sets can skip
+  /// creating them.
+  virtual bool Includes(const std::string& path) { return true; }
+  /// Test set is about to create tests of group until EndGroup. Iterator
+  /// may select a subset of group indices to be created.
+  virtual void BeginGroup(TestGroup& group) { }
+  virtual void EndGroup() { }
 };
 
 class TestSpecList : public TestSpecIterator {
@@ -247,6 +354,49 @@ public:
   virtual TestSet* Filter(ExcludeListFilter* filter);
 };
 
+/// Part index of count parts of parent test set: every count-th test, so
+/// that all parts together run every test once. Filters which differ between
+/// parts (see CompletedTestsFilter) should be applied on top of it.
+class ShardedTestSet : public TestSet {
+private:
+  TestSet* parent;
+  unsigned index;
+  unsigned count;
+
+public:
+  ShardedTestSet(TestSet* parent_, unsigned index_, unsigned count_)
+    : parent(parent_), index(index_), count(count_) { assert(index < count); }
+  virtual void InitContext(Context* context) { parent->InitContext(context); }
+  virtual void Name(std::ostream& out) const { parent->Name(out); }
+  virtual void Description(std::ostream& out) const { parent->Description(out); }
+  virtual void Iterate(TestSpecIterator& it);
+  virtual TestSet* Filter(TestNameFilter* filter);
+  virtual TestSet* Filter(ExcludeListFilter* filter);
+};
+
+/// Tests of every group of parent test set are sampled: a deterministic
+/// (for given seed) subset in which every value of every dimension is used
+/// at least once, filled up with random tests to the given fraction of the
+/// group or count of tests. Tests created outside of groups are kept.
+class SampledTestSet : public TestSet {
+private:
+  TestSet* parent;
+  double fraction;
+  uint64_t count;
+  uint64_t seed;
+
+public:
+  /// Count is used if fraction is 0.
+  SampledTestSet(TestSet* parent_, double fraction_, uint64_t count_, uint64_t seed_)
+    : parent(parent_), fraction(fraction_), count(count_), seed(seed_) { }
+  virtual void InitContext(Context* context) { parent->InitContext(context); }
+  virtual void Name(std::ostream& out) const { parent->Name(out); }
+  virtual void Description(std::ostream& out) const { parent->Description(out); }
+  virtual void Iterate(TestSpecIterator& it);
+  virtual TestSet* Filter(TestNameFilter* filter);
+  virtual TestSet* Filter(ExcludeListFilter* filter);
+};
+
 class OneTest : public TestSet {
 public:
   OneTest(Test* test_) : test(test_) { assert(test); }
@@ -294,6 +444,8 @@ public:
   virtual ~TestFilter() { }
   virtual TestSet* Filter(TestSet* ts) = 0;
   virtual bool Matches(const std::string& path, Test* test) = 0;
+  /// False if no test with given path can match.
+  virtual bool MayMatch(const std::string& path) { return true; }
 };
 
 class TestNameFilter : public TestFilter {
@@ -306,20 +458,71 @@ public:
   virtual TestSet* Filter(TestSet* ts) { return ts->Filter(this); }
   bool Matches(const std::string& path, Test* test);
   bool Matches(const std::string& name);
+  bool MayMatch(const std::string& path);
   const std::string& NamePattern() const { return namePattern; }
 };
 
+/// Excludes tests with names starting with one of the exclude list entries.
+/// Entries are compiled into a character trie, so matching a name costs
+/// one step per character regardless of the number of entries.
 class ExcludeListFilter : public TestFilter {
 private:
-  std::vector<std::string> excludePrefixes;
+  struct Entry {
+    std::string prefix;
+    uint64_t excludedTests;
+    uint64_t excludedTestSets;
+  };
+
+  struct Node {
+    uint32_t child;
+    uint32_t sibling;
+    int32_t entry;
+    char c;
+  };
+
+  static const uint32_t NO_NODE = 0;
+
+  /// Filter which owns entries and counts matches: this, or the filter
+  /// this one was derived from by SubFilter.
+  ExcludeListFilter* origin;
+  std::vector<Entry> entries;
+  std::vector<Node> nodes;
+
+  explicit ExcludeListFilter(ExcludeListFilter* origin_);
+
+  uint32_t Child(uint32_t node, char c) const;
+  uint32_t AddChild(uint32_t node, char c);
+  /// Follows s from node, returns matched entry or -1. node is set to
+  /// NO_NODE if no entry starts with the text walked so far.
+  int32_t Walk(uint32_t& node, const std::string& s) const;
+  /// Matches result for entry matched by a test name (-1 if none).
+  bool Result(int32_t entry);
+  bool SubFilterCopy(uint32_t node, uint32_t subNode, bool leading, ExcludeListFilter* sub, int32_t& excluded) const;
 
 public:
+  ExcludeListFilter();
   virtual TestSet* Filter(TestSet* ts) { return ts->Filter(this); }
   bool Matches(const std::string& path, Test* test);
   bool Matches(const std::string& name);
-  const std::vector<std::string>& ExcludePrefixes() const { return excludePrefixes; }
-  void AddPrefix(const std::string& prefix) { excludePrefixes.push_back(prefix); }
+  /// Counts path as an excluded test set if it is excluded.
+  bool MayMatch(const std::string& path);
+  void AddPrefix(const std::string& prefix);
   bool Load(ResourceManager* rm, const std::string& name);
+
+  /// Filter for names relative to test set base (see TestSetUnion), counting
+  /// matches in this filter. Returns 0 if whole test set is excluded.
+  ExcludeListFilter* SubFilter(const std::string& base);
+
+  size_t EntryCount() const { return origin->entries.size(); }
+  const std::string& Prefix(size_t i) const { return origin->entries[i].prefix; }
+  uint64_t ExcludedTests(size_t i) const { return origin->entries[i].excludedTests; }
+  uint64_t ExcludedTestSets(size_t i) const { return origin->entries[i].excludedTestSets; }
+  /// Prints totals of excluded tests and test sets and the number of entries
+  /// which did not exclude anything. Tests of excluded test sets are not
+  /// included in the test total.
+  void PrintSummary(std::ostream& out) const;
+  /// Writes excluded test and test set counts of every entry, tab separated.
+  void WriteStats(std::ostream& out) const;
 };
 
 class AndFilter : public TestFilter {
@@ -332,6 +535,7 @@ public:
     : filter1(filter1_), filter2(filter2_) { }
   virtual TestSet* Filter(TestSet* ts) { return filter2->Filter(filter1->Filter(ts)); }
   bool Matches(const std::string& path, Test* test) { return filter1->Matches(path, test) && filter2->Matches(path, test); }
+  bool MayMatch(const std::string& path) { return filter1->MayMatch(path) && filter2->MayMatch(path); }
 };
 
 bool CutTestNamePrefix(const std::string& name, std::string& prefix, std::string& rest, bool allowPartial = false);
@@ -0,0 +1,158 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "HexlTestDurations.hpp"
+#include "MObject.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace hexl {
+
+// File is "HXDU", version, count and entries sorted by name. Every entry
+// stores only the part of the name not shared with the previous one.
+static const uint32_t DURATIONS_MAGIC = 0x55445848;
+static const uint32_t DURATIONS_VERSION = 1;
+
+bool TestDurations::Load(const std::string& fileName)
+{
+  std::ifstream in(fileName.c_str(), std::ifstream::binary);
+  if (!in.is_open()) { return false; }
+  uint32_t magic = 0, version = 0;
+  uint64_t count = 0;
+  ReadData(in, magic);
+  ReadData(in, version);
+  ReadData(in, count);
+  if (!in.good() || magic != DURATIONS_MAGIC || version != DURATIONS_VERSION) { return false; }
+  std::unordered_map<std::string, uint64_t> loaded;
+  std::string name;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint32_t common;
+    std::string suffix;
+    uint64_t us;
+    ReadData(in, common);
+    if (!in.good() || common > name.size()) { return false; }
+    ReadData(in, suffix);
+    ReadData(in, us);
+    if (!in.good()) { return false; }
+    name = name.substr(0, common) + suffix;
+    loaded[name] = us;
+  }
+  durations.swap(loaded);
+  return true;
+}
+
+bool TestDurations::Save(const std::string& fileName) const
+{
+  std::vector<std::string> names;
+  names.reserve(durations.size());
+  for (auto d = durations.begin(); d != durations.end(); ++d) { names.push_back(d->first); }
+  std::sort(names.begin(), names.end());
+  // Written to a temporary file first, so that interrupted run does not
+  // destroy the history.
+  std::string tmpName = fileName + ".tmp";
+  {
+    std::ofstream out(tmpName.c_str(), std::ofstream::binary);
+    if (!out.is_open()) { return false; }
+    WriteData(out, DURATIONS_MAGIC);
+    WriteData(out, DURATIONS_VERSION);
+    WriteData(out, (uint64_t) names.size());
+    const std::string* prev = 0;
+    for (const std::string& name : names) {
+      uint32_t common = 0;
+      if (prev) {
+        while (common < prev->size() && common < name.size() && (*prev)[common] == name[common]) { common++; }
+      }
+      WriteData(out, common);
+      WriteData(out, name.substr(common));
+      WriteData(out, durations.find(name)->second);
+      prev = &name;
+    }
+    if (!out.good()) { return false; }
+  }
+#ifdef _WIN32
+  std::remove(fileName.c_str());
+#endif // _WIN32
+  return std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+}
+
+void TestDurations::Update(const std::string& fullTestName, double seconds)
+{
+  durations[fullTestName] = (uint64_t) (seconds * 1e6);
+}
+
+bool TestDurations::Find(const std::string& fullTestName, double& seconds) const
+{
+  auto d = durations.find(fullTestName);
+  if (d == durations.end()) { return false; }
+  seconds = d->second / 1e6;
+  return true;
+}
+
+std::vector<size_t> TestDurations::Schedule(const std::vector<std::string>& fullTestNames) const
+{
+  std::vector<std::pair<uint64_t, size_t>> known;
+  std::vector<size_t> unknown;
+  for (size_t i = 0; i < fullTestNames.size(); ++i) {
+    auto d = durations.find(fullTestNames[i]);
+    if (d != durations.end()) {
+      known.push_back(std::make_pair(d->second, i));
+    } else {
+      unknown.push_back(i);
+    }
+  }
+  std::stable_sort(known.begin(), known.end(),
+    [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) { return a.first > b.first; });
+  std::vector<size_t> order;
+  order.reserve(fullTestNames.size());
+  size_t k = 0, u = 0;
+  for (size_t pos = 0; pos < fullTestNames.size(); ++pos) {
+    if (u < unknown.size() && (k == known.size() || u * fullTestNames.size() <= pos * unknown.size())) {
+      order.push_back(unknown[u++]);
+    } else {
+      order.push_back(known[k++].second);
+    }
+  }
+  return order;
+}
+
+std::vector<unsigned> TestDurations::Assign(const std::vector<std::string>& fullTestNames, const std::vector<size_t>& order, unsigned workers) const
+{
+  // Unknown tests are expected to take average time of known ones.
+  uint64_t total = 0, count = 0;
+  std::vector<uint64_t> expected(fullTestNames.size(), 0);
+  std::vector<bool> isKnown(fullTestNames.size(), false);
+  for (size_t i = 0; i < fullTestNames.size(); ++i) {
+    auto d = durations.find(fullTestNames[i]);
+    if (d != durations.end()) {
+      expected[i] = d->second;
+      isKnown[i] = true;
+      total += d->second;
+      count++;
+    }
+  }
+  uint64_t average = count > 0 ? std::max<uint64_t>(total / count, 1) : 1;
+  std::vector<uint64_t> load(workers, 0);
+  std::vector<unsigned> assignment(fullTestNames.size(), 0);
+  for (size_t i : order) {
+    unsigned w = (unsigned) (std::min_element(load.begin(), load.end()) - load.begin());
+    assignment[i] = w;
+    load[w] += isKnown[i] ? std::max<uint64_t>(expected[i], 1) : average;
+  }
+  return assignment;
+}
+
+}
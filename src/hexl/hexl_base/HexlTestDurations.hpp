@@ -0,0 +1,57 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_TEST_DURATIONS_HPP
+#define HEXL_TEST_DURATIONS_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+namespace hexl {
+
+/// Wall-clock durations of tests in previous runs, keyed by full test name.
+/// Used to start long tests first in parallel and sharded runs.
+class TestDurations {
+public:
+  /// Reads durations saved by Save. Missing or malformed file is treated
+  /// as empty history.
+  bool Load(const std::string& fileName);
+  bool Save(const std::string& fileName) const;
+
+  void Update(const std::string& fullTestName, double seconds);
+  bool Find(const std::string& fullTestName, double& seconds) const;
+  size_t Size() const { return durations.size(); }
+
+  /// Returns order in which tests should be started: tests with known
+  /// duration longest first, tests with unknown duration interleaved
+  /// evenly between them.
+  std::vector<size_t> Schedule(const std::vector<std::string>& fullTestNames) const;
+
+  /// Assigns tests to workers, returning worker for every test. Tests are
+  /// taken in given order, each goes to the worker with the least expected
+  /// total duration. Without history this is round-robin.
+  std::vector<unsigned> Assign(const std::vector<std::string>& fullTestNames, const std::vector<size_t>& order, unsigned workers) const;
+
+private:
+  // Stored in microseconds.
+  std::unordered_map<std::string, uint64_t> durations;
+};
+
+}
+
+#endif // HEXL_TEST_DURATIONS_HPP
@@ -16,6 +16,7 @@
 
 #include "HexlTestFactory.hpp"
 #include "BasicHexlTests.hpp"
+#include "Scenario.hpp"
 
 namespace hexl {
 
@@ -32,6 +33,9 @@ Test* DefaultTestFactory::CreateTest(const std::string& type, const std::string&
 
 Test* DefaultTestFactory::CreateTestDeserialize(const std::string& type, std::istream& in)
 {
+  if (type == "scenario_test") {
+    return new ScenarioTest(in);
+  }
   /*
   if (type == "finalize") {
     return new FinalizeHsailResourceTest(in);
@@ -0,0 +1,134 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "HexlTestJournal.hpp"
+#include "Stats.hpp"
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else // _WIN32
+#include <unistd.h>
+#endif // _WIN32
+
+namespace hexl {
+
+static const std::string JOURNAL_START = "START";
+
+bool TestJournal::Load(const std::string& fileName)
+{
+  std::ifstream in(fileName.c_str());
+  if (!in.is_open()) { return false; }
+  std::unordered_map<std::string, unsigned> started;
+  std::string line;
+  while (getline(in, line)) {
+    // Last line may be incomplete if the runner was killed while writing it.
+    if (in.eof()) { break; }
+    std::string::size_type space = line.find(' ');
+    if (space == std::string::npos) { continue; }
+    std::string status = line.substr(0, space);
+    std::string name = line.substr(space + 1);
+    if (status == JOURNAL_START) {
+      started[name]++;
+      continue;
+    }
+    for (unsigned s = PASSED; s <= NA; ++s) {
+      if (status == TestStatusString((TestStatus) s)) {
+        completed[name] = (TestStatus) s;
+        started.erase(name);
+        break;
+      }
+    }
+  }
+  for (auto s = started.begin(); s != started.end(); ++s) {
+    if (s->second > 1 && !IsCompleted(s->first)) { completed[s->first] = ERROR; }
+  }
+  return true;
+}
+
+bool TestJournal::Open(const std::string& fileName, bool resume)
+{
+  Close();
+#ifdef _WIN32
+  fd = _open(fileName.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY | (resume ? 0 : _O_TRUNC), _S_IREAD | _S_IWRITE);
+#else // _WIN32
+  fd = open(fileName.c_str(), O_WRONLY | O_APPEND | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+#endif // _WIN32
+  if (fd < 0) { return false; }
+  // Terminate possibly incomplete last line.
+  std::ifstream in(fileName.c_str(), std::ifstream::binary | std::ifstream::ate);
+  std::streamoff size = in.tellg();
+  if (size > 0) {
+    char last = 0;
+    in.seekg(size - 1);
+    in.get(last);
+    if (last != '\n') { Write(""); }
+  }
+  return true;
+}
+
+void TestJournal::Close()
+{
+  if (fd >= 0) {
+#ifdef _WIN32
+    _close(fd);
+#else // _WIN32
+    close(fd);
+#endif // _WIN32
+    fd = -1;
+  }
+}
+
+void TestJournal::Write(const std::string& line)
+{
+  std::string data = line + "\n";
+#ifdef _WIN32
+  _write(fd, data.data(), (unsigned) data.size());
+  _commit(fd);
+#else // _WIN32
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n <= 0) { return; }
+    written += n;
+  }
+  fsync(fd);
+#endif // _WIN32
+}
+
+void TestJournal::Start(const std::string& fullTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fd < 0) { return; }
+  Write(JOURNAL_START + " " + fullTestName);
+}
+
+void TestJournal::Complete(const std::string& fullTestName, TestStatus status)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fd < 0) { return; }
+  Write(std::string(TestStatusString(status)) + " " + fullTestName);
+}
+
+void TestJournal::IncStats(AllStats& stats) const
+{
+  for (auto c = completed.begin(); c != completed.end(); ++c) {
+    TestResult(c->second).IncStats(stats);
+  }
+}
+
+}
@@ -0,0 +1,73 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_TEST_JOURNAL_HPP
+#define HEXL_TEST_JOURNAL_HPP
+
+#include "HexlTest.hpp"
+#include <mutex>
+#include <unordered_map>
+
+namespace hexl {
+
+/// Append-only journal of test runs. Every line is "START <test>" or
+/// "<STATUS> <test>" and is synced to disk before the test proceeds, so
+/// that an interrupted run can be resumed from the journal.
+class TestJournal {
+public:
+  TestJournal() : fd(-1) { }
+  ~TestJournal() { Close(); }
+
+  /// Reads completed tests from journal. A test which was started twice
+  /// without completing (e.g. crashed the runner) is considered completed
+  /// with ERROR status.
+  bool Load(const std::string& fileName);
+  /// Opens journal for appending, existing journal is discarded unless
+  /// resuming.
+  bool Open(const std::string& fileName, bool resume);
+  void Close();
+  bool IsOpen() const { return fd >= 0; }
+
+  void Start(const std::string& fullTestName);
+  void Complete(const std::string& fullTestName, TestStatus status);
+
+  size_t CompletedCount() const { return completed.size(); }
+  bool IsCompleted(const std::string& fullTestName) const { return completed.find(fullTestName) != completed.end(); }
+  void IncStats(AllStats& stats) const;
+
+private:
+  int fd;
+  std::mutex mutex;
+  std::unordered_map<std::string, TestStatus> completed;
+
+  void Write(const std::string& line);
+};
+
+/// Filters out tests completed according to the journal.
+class CompletedTestsFilter : public TestFilter {
+private:
+  const TestJournal* journal;
+
+public:
+  explicit CompletedTestsFilter(const TestJournal* journal_)
+    : journal(journal_) { }
+  virtual TestSet* Filter(TestSet* ts) { return new FilteredTestSet(ts, this); }
+  bool Matches(const std::string& path, Test* test) { return !journal->IsCompleted(path + "/" + test->TestName()); }
+};
+
+}
+
+#endif // HEXL_TEST_JOURNAL_HPP
@@ -22,34 +22,48 @@
 #include <sstream>
 #include "Utils.hpp"
 #include <time.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 namespace hexl {
 
 TestRunnerBase::TestRunnerBase(Context* context_)
-  : TestRunner(context_), testContext(0)
+  : TestRunner(context_), createTime(0), testContext(0), resultCache(0), runtimeHash(0)
 {
+  lookahead = context->Opts()->GetUnsigned("lookahead", 0);
 }
 
 void TestRunnerBase::Init()
 {
+  // Runtime fingerprint is a part of test hashes, so that results are not
+  // reused with another runtime library or device.
+  if (resultCache && !runtimeHash && context->Contains(CK_RUNTIME)) {
+    std::string fingerprint = context->Runtime()->Fingerprint();
+    runtimeHash = HashBytes(fingerprint.data(), fingerprint.size());
+  }
 }
 
 void TestRunnerBase::RunTest(const std::string& path, Test* test)
 {
   assert(test);
   Init();
+  TestClock::time_point begin = TestClock::now();
   BeforeTest(path, test);
   TestResult result = ExecuteTest(test);
-  t_end = clock();
-  result.SetTime(t_begin, t_end);
+  result.SetTime(createTime + ElapsedSeconds(begin));
+  result.SetPhaseTime(PHASE_CREATE, createTime);
+  createTime = 0;
   AfterTest(path, test, result);
 }
 
 void TestRunnerBase::RunTestSpec(const std::string& path, TestSpec* spec)
 {
   spec->InitContext(context);
-  t_begin = clock();
+  TestClock::time_point begin = TestClock::now();
   Test *test = spec->Create();
+  createTime = ElapsedSeconds(begin);
   RunTest(path, test);
   if (test) { delete test; }
   delete spec;
@@ -57,13 +71,18 @@ void TestRunnerBase::RunTestSpec(const std::string& path, TestSpec* spec)
 
 void TestRunnerBase::BeforeTest(const std::string& path, Test* test)
 {
-  std::string fullTestName = path + "/" + test->TestName();
-  test->InitContext(context);
-  testContext = test->GetContext();
-  testContext->Put("hexl.outputPath", fullTestName);
-  testContext->Put("hexl.log.stream.debug", TestOut());
-  testContext->Put("hexl.log.stream.info", TestOut());
-  testContext->Put("hexl.log.stream.error", TestOut());
+  testContext = InitTestContext(path + "/" + test->TestName(), test, context, TestOut());
+}
+
+Context* TestRunnerBase::InitTestContext(const std::string& fullTestName, Test* test, Context* parent, std::ostream* out)
+{
+  test->InitContext(parent);
+  Context* testContext = test->GetContext();
+  testContext->Put(CK_OUTPUT_PATH, fullTestName);
+  testContext->Put(CK_LOG_DEBUG, out);
+  testContext->Put(CK_LOG_INFO, out);
+  testContext->Put(CK_LOG_ERROR, out);
+  testContext->Move(CK_TIMING, new TestTiming());
   testContext->Info() << "START:  " << fullTestName << std::endl;
   if (testContext->IsVerbose("description")) {
     testContext->Info() << "Test description:" << std::endl;
@@ -82,6 +101,7 @@ void TestRunnerBase::BeforeTest(const std::string& path, Test* test)
     }
   }
   testContext->Stats().Clear();
+  return testContext;
 }
 
 void TestRunnerBase::AfterTest(const std::string& path, Test* test, const TestResult& result)
@@ -114,6 +134,7 @@ public:
 
 bool TestRunnerBase::RunTests(TestSet& tests)
 {
+  if (lookahead > 0) { return RunTestsPipelined(tests); }
   Init();
   if (!BeforeTestSet(tests)) { return false; }
   TestRunnerExecute exec(this);
@@ -122,10 +143,121 @@ bool TestRunnerBase::RunTests(TestSet& tests)
   return true;
 }
 
+class PreparedTestQueue {
+public:
+  struct Item {
+    std::string path;
+    TestSpec* spec;
+    Test* test;
+    double createTime;
+  };
+
+private:
+  std::mutex mutex;
+  std::condition_variable notFull, notEmpty;
+  std::deque<Item> items;
+  size_t capacity;
+  bool finished;
+
+public:
+  explicit PreparedTestQueue(size_t capacity_)
+    : capacity(capacity_), finished(false) { }
+
+  void Push(const Item& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return items.size() < capacity; });
+    items.push_back(item);
+    notEmpty.notify_one();
+  }
+
+  void Finish()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    notEmpty.notify_one();
+  }
+
+  bool Pop(Item& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return !items.empty() || finished; });
+    if (items.empty()) { return false; }
+    item = items.front();
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+};
+
+class TestPreparer : public TestSpecIterator {
+private:
+  Context* context;
+  PreparedTestQueue& queue;
+
+public:
+  TestPreparer(Context* context_, PreparedTestQueue& queue_)
+    : context(context_), queue(queue_) { }
+
+  void operator()(const std::string& path, TestSpec* spec) override
+  {
+    spec->InitContext(context);
+    if (!spec->IsValid()) { delete spec; return; }
+    PreparedTestQueue::Item item;
+    item.path = path;
+    item.spec = spec;
+    TestClock::time_point begin = TestClock::now();
+    item.test = spec->Create();
+    item.createTime = ElapsedSeconds(begin);
+    queue.Push(item);
+  }
+};
+
+bool TestRunnerBase::RunTestsPipelined(TestSet& tests)
+{
+  Init();
+  if (!BeforeTestSet(tests)) { return false; }
+  // Test set is iterated and tests are created (emitted) in a separate
+  // thread, at most lookahead tests ahead of the one being executed.
+  PreparedTestQueue queue(lookahead);
+  std::thread producer([this, &tests, &queue]() {
+    TestPreparer preparer(context, queue);
+    tests.Iterate(preparer);
+    queue.Finish();
+  });
+  PreparedTestQueue::Item item;
+  while (queue.Pop(item)) {
+    createTime = item.createTime;
+    RunTest(item.path, item.test);
+    if (item.test) { delete item.test; }
+    delete item.spec;
+  }
+  producer.join();
+  if (!AfterTestSet(tests)) { return false; }
+  return true;
+}
+
 TestResult TestRunnerBase::ExecuteTest(Test* test)
 {
+  Context* testContext = test->GetContext();
+  uint64_t hash = 0;
+  if (resultCache && runtimeHash && test->ContentHash(hash)) {
+    hash = HashBytes(&runtimeHash, sizeof(runtimeHash), hash);
+    if (resultCache->IsPassed(testContext->GetOutputPath(), hash)) {
+      testContext->Info() << "Test and runtime did not change since the test passed, result is reused" << std::endl;
+      TestResult result(PASSED);
+      result.SetHash(hash);
+      result.SetReused();
+      return result;
+    }
+  }
   test->Run();
-  return test->Result();
+  TestResult result = test->Result();
+  result.SetHash(hash);
+  if (testContext->Has(CK_TIMING)) {
+    testContext->Get<TestTiming>(CK_TIMING)->CopyTo(result);
+  }
+  return result;
 }
 
 bool SimpleTestRunner::AfterTestSet(TestSet& testSet)
@@ -143,17 +275,31 @@ void SimpleTestRunner::AfterTest(const std::string& path, Test* test, const Test
 }
 
 HTestRunner::HTestRunner(Context* context_)
-  : TestRunnerBase(context_)
+  : TestRunnerBase(context_), reusedCount(0)
 {
   testLogLevel = context->Opts()->GetUnsigned("testloglevel", 4);
+  jobs = context->Opts()->GetUnsigned("jobs", 1);
+  if (jobs == 0) { jobs = 1; }
+  schedule = context->Opts()->GetString("schedule", "history") == "history";
+  if (context->Opts()->GetBoolean("incremental")) {
+    cacheName = context->Opts()->GetString("resultcache", "");
+    if (cacheName.empty()) { cacheName = context->RM()->GetOutputFileName("test_results.dat"); }
+    cache.Load(cacheName);
+    resultCache = &cache;
+  }
 }
 
 void HTestRunner::BeforeTest(const std::string& path, Test* test)
 {
   TestRunnerBase::BeforeTest(path, test);
   testOut.clear();
-  std::string fullName = path + "/" + test->TestName();
-  std::string cpath = ExtractTestPath(fullName, testLogLevel);
+  LogTestPath(path + "/" + test->TestName());
+  LogTestStart(path + "/" + test->TestName());
+}
+
+void HTestRunner::LogTestPath(const std::string& fullTestName)
+{
+  std::string cpath = ExtractTestPath(fullTestName, testLogLevel);
   if (cpath != pathPrev) {
     if (!pathPrev.empty()) {
       RunnerLog() << "  ";
@@ -174,26 +320,60 @@ bool HTestRunner::BeforeTestSet(TestSet& testSet)
 {
   time_t time_begin = time(0);
   tm* time_begin_UTC = gmtime(&time_begin);
+  // Resumed run appends to the logs of the run it continues.
+  std::string resumeName = context->Opts()->GetString("resume", "");
+  std::ofstream::openmode logMode = resumeName.empty() ? std::ofstream::out : std::ofstream::app;
   std::string testLogName = context->Opts()->GetString("testlog", "test.log");
-  testLog.open(testLogName.c_str(), std::ofstream::out);
+  testLog.open(testLogName.c_str(), logMode);
   if (!testLog.is_open()) {
     context->Error() << "Failed to open test log " << testLogName << std::endl;
     return false;
   }
   std::string testSummaryName = context->Opts()->GetString("testsummary", "test_summary.log");
-  testSummary.open(testSummaryName.c_str(), std::ofstream::out);
+  testSummary.open(testSummaryName.c_str(), logMode);
   if (!testSummary.is_open()) {
     context->Error() << "Failed to open test summary " << testSummaryName << std::endl;
     return false;
   }
+  std::string testTimingName = context->Opts()->GetString("testtiming", "test_timing.tsv");
+  testTiming.open(testTimingName.c_str(), logMode);
+  if (!testTiming.is_open()) {
+    context->Error() << "Failed to open test timing " << testTimingName << std::endl;
+    return false;
+  }
+  testTiming.seekp(0, std::ios::end);
+  if (testTiming.tellp() == 0) {
+    testTiming << "test\tstatus\ttime";
+    for (unsigned p = 0; p < PHASE_COUNT; ++p) { testTiming << "\t" << TestPhaseString((TestPhase) p); }
+    testTiming << std::endl;
+  }
   RunnerLog() << "UTC Start Date & Time: " << asctime(time_begin_UTC) << std::endl;
   SummaryLog() << "UTC Start Date & Time: " << asctime(time_begin_UTC) << std::endl;
   if (context->Opts()->GetBoolean("dsign")) {
      SummaryLog() << "Digital Signature: " << "NNNNNNNNNNNNN" << std::endl << std::endl;
      testLog << "Digital Signature: " << "NNNNNNNNNNNNN" << std::endl << std::endl;
   }
-  context->Runtime()->PrintInfo(SummaryLog());
-  SummaryLog() << std::endl << std::endl;
+  // Tests completed according to -resume journal are filtered out of the
+  // test set by the caller (see CompletedTestsFilter), here only their
+  // results are counted.
+  std::string journalName = context->Opts()->GetString("journal", resumeName);
+  if (!resumeName.empty() && journal.Load(resumeName)) {
+    journal.IncStats(stats);
+    RunnerLog() << "Resuming " << resumeName << ": " << journal.CompletedCount() << " tests completed" << std::endl << std::endl;
+    SummaryLog() << "Resuming " << resumeName << ": " << journal.CompletedCount() << " tests completed" << std::endl << std::endl;
+  }
+  if (!journalName.empty() && !journal.Open(journalName, journalName == resumeName)) {
+    context->Error() << "Failed to open journal " << journalName << std::endl;
+    return false;
+  }
+  durationsName = context->Opts()->GetString("durations", "");
+  if (durationsName.empty()) { durationsName = context->RM()->GetOutputFileName("test_durations.dat"); }
+  durations.Load(durationsName);
+  // Runtime may be not available in this process (see ShardTestRunner).
+  if (context->Contains(CK_RUNTIME)) {
+    context->Runtime()->PrintInfo(SummaryLog());
+    SummaryLog() << std::endl << std::endl;
+  }
   return true;
 }
 
@@ -214,6 +394,11 @@ bool HTestRunner::AfterTestSet(TestSet& testSet)
   SummaryLog() << std::endl << "Testrun" << std::endl << "  ";
   Stats().TestSet().PrintShort(RunnerLog()); RunnerLog() << std::endl;
   Stats().TestSet().PrintShort(SummaryLog()); SummaryLog() << std::endl;
+  if (resultCache) {
+    RunnerLog() << "Incremental: " << reusedCount << " passed results reused" << std::endl;
+    SummaryLog() << "Incremental: " << reusedCount << " passed results reused" << std::endl;
+  }
+  PrintRuntimeStats(SummaryLog());
   RunnerLog()  << std::endl << "UTC Finish Date & Time: " << asctime(time_end_UTC) << std::endl;
   SummaryLog() << std::endl << "UTC Finish Date & Time: " << asctime(time_end_UTC) << std::endl;
   if (context->Opts()->GetBoolean("dsign")) {
@@ -222,23 +407,186 @@ bool HTestRunner::AfterTestSet(TestSet& testSet)
   }
   testLog.close();
   testSummary.close();
+  testTiming.close();
+  journal.Close();
+  if (resultCache) {
+    if (!cache.Save(cacheName)) {
+      context->Error() << "Failed to save test results to " << cacheName << std::endl;
+    }
+  }
+  if (!durations.Save(durationsName)) {
+    context->Error() << "Failed to save test durations to " << durationsName << std::endl;
+  }
   return true;
 }
 
+void HTestRunner::PrintRuntimeStats(std::ostream& out)
+{
+  // Runtime may be not available in this process (see ShardTestRunner).
+  if (context->Contains(CK_RUNTIME)) {
+    context->Runtime()->PrintStats(out);
+  }
+}
+
 void HTestRunner::AfterTest(const std::string& path, Test* test, const TestResult& result)
+{
+  LogTestResult(path + "/" + test->TestName(), result, testOut.str());
+  TestRunnerBase::AfterTest(path, test, result);
+  testOut.str(std::string());
+}
+
+void HTestRunner::LogTestResult(const std::string& fullTestName, const TestResult& result, const std::string& output)
 {
   if (!result.IsPassed() || context->IsVerbose("testlog", false)) {
-    testLog << testOut.str();
+    testLog << output;
   }
-  std::string fullTestName = path + "/" + test->TestName();
   testLog <<
     result.StatusString() << ": " <<
     fullTestName << " " << std::setprecision(2) <<
-    result.ExecutionTime() << "s" << std::endl;
+    result.ExecutionTime() << "s";
+  std::ostringstream phases;
+  phases << std::setprecision(2);
+  result.PrintPhaseTimes(phases);
+  if (!phases.str().empty()) { testLog << " (" << phases.str() << ")"; }
+  testLog << std::endl;
   testLog << std::endl;
+  testTiming << fullTestName << "\t" << result.StatusString() << "\t" <<
+    std::fixed << std::setprecision(6) << result.ExecutionTime();
+  for (unsigned p = 0; p < PHASE_COUNT; ++p) { testTiming << "\t" << result.PhaseTime((TestPhase) p); }
+  testTiming << std::endl;
   result.IncStats(pathStats);
-  TestRunnerBase::AfterTest(path, test, result);
-  testOut.str(std::string());
+  journal.Complete(fullTestName, result.Status());
+  // Results without time (e.g. of a crashed shard worker) are not recorded.
+  if (result.ExecutionTime() > 0 && !result.IsReused()) { durations.Update(fullTestName, result.ExecutionTime()); }
+  if (resultCache && result.Hash()) { cache.Update(fullTestName, result.Hash(), result.Status()); }
+  if (result.IsReused()) { reusedCount++; }
+}
+
+bool HTestRunner::RunTests(TestSet& tests)
+{
+  if (jobs > 1) { return RunTestsParallel(tests); }
+  return TestRunnerBase::RunTests(tests);
+}
+
+class HTestRunner::ParallelJob {
+public:
+  ParallelJob(const std::string& path_, TestSpec* spec_)
+    : path(path_), spec(spec_), done(false) { }
+
+  std::string path;
+  TestSpec* spec;
+  std::string fullTestName;
+  TestResult result;
+  std::string output;
+  bool done;
+};
+
+class HTestRunner::ParallelJobCollector : public TestSpecIterator {
+private:
+  Context* context;
+  std::vector<std::unique_ptr<ParallelJob>>& jobs;
+
+public:
+  ParallelJobCollector(Context* context_, std::vector<std::unique_ptr<ParallelJob>>& jobs_)
+    : context(context_), jobs(jobs_) { }
+
+  void operator()(const std::string& path, TestSpec* spec) override
+  {
+    spec->InitContext(context);
+    if (spec->IsValid()) {
+      jobs.push_back(std::unique_ptr<ParallelJob>(new ParallelJob(path, spec)));
+    } else {
+      delete spec;
+    }
+  }
+};
+
+void HTestRunner::RunJob(Context* workerContext, ParallelJob* job)
+{
+  std::ostringstream out;
+  job->spec->InitContext(workerContext);
+  TestClock::time_point begin = TestClock::now();
+  Test* test = job->spec->Create();
+  assert(test);
+  double createTime = ElapsedSeconds(begin);
+  job->fullTestName = job->path + "/" + test->TestName();
+  LogTestStart(job->fullTestName);
+  InitTestContext(job->fullTestName, test, workerContext, &out);
+  TestResult result = ExecuteTest(test);
+  result.SetTime(ElapsedSeconds(begin));
+  result.SetPhaseTime(PHASE_CREATE, createTime);
+  job->result = result;
+  job->output = out.str();
+  delete test;
+  delete job->spec;
+  job->spec = 0;
+}
+
+bool HTestRunner::RunTestsParallel(TestSet& tests)
+{
+  Init();
+  if (!BeforeTestSet(tests)) { return false; }
+  std::vector<std::unique_ptr<ParallelJob>> queue;
+  ParallelJobCollector collector(context, queue);
+  tests.Iterate(collector);
+
+  // Jobs are started longest first according to durations of previous
+  // runs, so that a long test does not end up in the tail of the run.
+  std::vector<size_t> order;
+  if (schedule) {
+    std::vector<std::string> names;
+    for (const std::unique_ptr<ParallelJob>& job : queue) { names.push_back(job->path + "/" + job->spec->TestName()); }
+    order = durations.Schedule(names);
+  } else {
+    for (size_t i = 0; i < queue.size(); ++i) { order.push_back(i); }
+  }
+
+  std::mutex mutex;
+  std::condition_variable jobDone;
+  size_t next = 0;
+  std::vector<std::unique_ptr<Context>> workerContexts;
+  std::vector<std::thread> workers;
+  for (unsigned w = 0; w < jobs; ++w) {
+    // Every worker has its own context (and hence RuntimeState and queue,
+    // see "hexl.worker") so that tests never share mutable state.
+    Context* workerContext = new Context(context);
+    workerContext->Put(CK_WORKER, Value(MV_UINT32, w));
+    workerContext->Move(CK_STATS, new AllStats());
+    workerContexts.push_back(std::unique_ptr<Context>(workerContext));
+    workers.push_back(std::thread([this, workerContext, &queue, &order, &next, &mutex, &jobDone]() {
+      for (;;) {
+        ParallelJob* job;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (next == queue.size()) { return; }
+          job = queue[order[next++]].get();
+        }
+        RunJob(workerContext, job);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          job->done = true;
+        }
+        jobDone.notify_all();
+      }
+    }));
+  }
+
+  // Logs are written in test order, independent of completion order,
+  // so that results are the same as with serial runner.
+  for (size_t i = 0; i < queue.size(); ++i) {
+    ParallelJob* job = queue[i].get();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobDone.wait(lock, [job] { return job->done; });
+    }
+    LogTestPath(job->fullTestName);
+    LogTestResult(job->fullTestName, job->result, job->output);
+    job->result.IncStats(stats);
+    job->output.clear();
+  }
+  for (std::thread& worker : workers) { worker.join(); }
+  if (!AfterTestSet(tests)) { return false; }
+  return true;
 }
 
 }
@@ -18,6 +18,9 @@
 #define HEXL_TEST_RUNNER_HPP
 
 #include "HexlTest.hpp"
+#include "HexlTestJournal.hpp"
+#include "HexlTestDurations.hpp"
+#include "HexlResultCache.hpp"
 #include <sstream>
 #include <fstream>
 
@@ -41,11 +44,18 @@ public:
 
 class TestRunnerBase : public TestRunner {
 private:
-  clock_t t_begin, t_end;
+  double createTime;
+  unsigned lookahead;
+
+  bool RunTestsPipelined(TestSet& tests);
 
 protected:
   Context* testContext;
   AllStats stats;
+  /// Results of previous runs, tests which passed and did not change since
+  /// are not executed again (see -incremental). Not used if 0.
+  const TestResultCache* resultCache;
+  uint64_t runtimeHash;
 
   virtual void Init();
   virtual bool BeforeTestSet(TestSet& testSet) { return true; }
@@ -54,6 +64,7 @@ protected:
   virtual void AfterTest(const std::string& path, Test* test, const TestResult& result);
   virtual std::ostream* TestOut() { return &std::cout; }
   virtual TestResult ExecuteTest(Test* test);
+  Context* InitTestContext(const std::string& fullTestName, Test* test, Context* parent, std::ostream* out);
   const AllStats& Stats() const { return stats; }
   AllStats& Stats() { return stats; }
 
@@ -80,20 +91,42 @@ private:
   std::ostringstream testOut;
   std::ofstream testLog;
   std::ofstream testSummary;
+  std::ofstream testTiming;
   AllStats pathStats;
   unsigned testLogLevel;
+  unsigned jobs;
+  TestJournal journal;
+  std::string durationsName;
+  TestResultCache cache;
+  std::string cacheName;
+  uint64_t reusedCount;
+
+  class ParallelJob;
+  class ParallelJobCollector;
+  void RunJob(Context* workerContext, ParallelJob* job);
+  bool RunTestsParallel(TestSet& tests);
 
 protected:
   std::ostream& RunnerLog() { return std::cout; }
+  std::ofstream& TestLog() { return testLog; }
   std::ofstream& SummaryLog() { return testSummary; }
+  std::ofstream& TimingLog() { return testTiming; }
+  /// Durations of tests in previous runs, updated with every logged result.
+  TestDurations durations;
+  bool schedule;
   std::ostream* TestOut() { return &testOut; }
   virtual bool BeforeTestSet(TestSet& testSet);
   virtual bool AfterTestSet(TestSet& testSet);
   virtual void BeforeTest(const std::string& path, Test* test);
   virtual void AfterTest(const std::string& path, Test* test, const TestResult& result);
+  void LogTestPath(const std::string& fullTestName);
+  void LogTestStart(const std::string& fullTestName) { journal.Start(fullTestName); }
+  void LogTestResult(const std::string& fullTestName, const TestResult& result, const std::string& output);
+  virtual void PrintRuntimeStats(std::ostream& out);
 
 public:
   HTestRunner(Context* context_);
+  virtual bool RunTests(TestSet& tests);
 };
 
 }
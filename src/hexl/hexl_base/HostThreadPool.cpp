@@ -0,0 +1,98 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "HostThreadPool.hpp"
+
+namespace hexl {
+
+HostThreadPool::Worker::Worker()
+  : busy(false), stop(false)
+{
+  thread = std::thread(&Worker::Loop, this);
+}
+
+HostThreadPool::Worker::~Worker()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  cv.notify_all();
+  thread.join();
+}
+
+void HostThreadPool::Worker::Run(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  cv.notify_all();
+}
+
+void HostThreadPool::Worker::Wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [this]() { return tasks.empty() && !busy; });
+}
+
+void HostThreadPool::Worker::Loop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+    if (tasks.empty()) { return; }
+    std::function<void()> task(std::move(tasks.front()));
+    tasks.pop_front();
+    busy = true;
+    lock.unlock();
+    task();
+    lock.lock();
+    busy = false;
+    cv.notify_all();
+  }
+}
+
+HostThreadPool* HostThreadPool::Instance()
+{
+  static HostThreadPool pool;
+  return &pool;
+}
+
+HostThreadPool::~HostThreadPool()
+{
+  workers.clear();
+}
+
+HostThreadPool::Worker* HostThreadPool::Acquire()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (idle.empty()) {
+    workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    return workers.back().get();
+  }
+  Worker* worker = idle.back();
+  idle.pop_back();
+  return worker;
+}
+
+void HostThreadPool::Release(Worker* worker)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  idle.push_back(worker);
+}
+
+}
@@ -0,0 +1,74 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_HOST_THREAD_POOL_HPP
+#define HEXL_HOST_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hexl {
+
+/// Persistent host threads running scenario threads, so that tests do not
+/// create and join a thread for every host thread they use.
+class HostThreadPool {
+public:
+  /// Host thread with its own queue of tasks, executed in order.
+  class Worker {
+  public:
+    Worker();
+    ~Worker();
+
+    void Run(std::function<void()> task);
+    /// Waits until all queued tasks are executed.
+    void Wait();
+
+  private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    bool busy;
+    bool stop;
+    std::thread thread;
+
+    void Loop();
+  };
+
+  static HostThreadPool* Instance();
+
+  ~HostThreadPool();
+
+  /// Returns idle worker, starting a new one if all are in use. Worker is
+  /// used exclusively until Release: scenario threads wait for each other,
+  /// so they can not share a thread with other tests.
+  Worker* Acquire();
+  /// Worker must have no pending tasks.
+  void Release(Worker* worker);
+
+private:
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<Worker*> idle;
+};
+
+}
+
+#endif // HEXL_HOST_THREAD_POOL_HPP
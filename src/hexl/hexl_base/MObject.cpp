@@ -600,36 +600,186 @@ void Value::ReadFrom(const void *src, ValueType type)
 void Value::Serialize(std::ostream& out) const
 {
   WriteData(out, type);
-  WriteData(out, data.u64);
+  if (type == MV_UINT128) {
+    WriteData(out, data.u128.l);
+    WriteData(out, data.u128.h);
+  } else {
+    WriteData(out, data.u64);
+  }
 }
 
 void Value::Deserialize(std::istream& in)
 {
   ReadData(in, type);
-  ReadData(in, data.u64);
+  if (type == MV_UINT128) {
+    ReadData(in, data.u128.l);
+    ReadData(in, data.u128.h);
+  } else {
+    ReadData(in, data.u64);
+  }
+}
+
+Values::Values(size_t n, const Value& value)
+  : columnar(true), vtype(MV_LAST), count(0)
+{
+  resize(n, value);
+}
+
+bool Values::IsColumnType(ValueType type)
+{
+  switch (type) {
+  case MV_REF: case MV_POINTER: case MV_IMAGE: case MV_SAMPLER: case MV_IMAGEREF: case MV_SAMPLERREF:
+  case MV_EXPR: case MV_STRING: case MV_LAST:
+    return false;
+  default:
+    return true;
+  }
+}
+
+void Values::clear()
+{
+  columnar = true;
+  vtype = MV_LAST;
+  count = 0;
+  column.clear();
+  mixed.clear();
+}
+
+void Values::reserve(size_t n)
+{
+  if (!columnar) {
+    mixed.reserve(n);
+  } else if (vtype != MV_LAST) {
+    column.reserve(n * ValueTypeSize(vtype));
+  }
+}
+
+void Values::resize(size_t n, const Value& value)
+{
+  if (n <= count) {
+    if (columnar) { column.resize(n * ColumnElementSize()); } else { mixed.resize(n); }
+    count = n;
+    if (count == 0) { clear(); }
+    return;
+  }
+  reserve(n);
+  while (count < n) { push_back(value); }
+}
+
+void Values::push_back(const Value& value)
+{
+  if (columnar && count == 0 && IsColumnType(value.Type())) {
+    vtype = value.Type();
+  }
+  if (columnar && value.Type() != vtype) { ToMixed(); }
+  if (columnar) {
+    // Column element is the low bytes of ValueData, as written by ReadFrom.
+    size_t size = ValueTypeSize(vtype);
+    ValueData data = value.Data();
+    const char* bytes = reinterpret_cast<const char*>(&data);
+    column.insert(column.end(), bytes, bytes + size);
+  } else {
+    mixed.push_back(value);
+  }
+  ++count;
+}
+
+void Values::swap(Values& values)
+{
+  std::swap(columnar, values.columnar);
+  std::swap(vtype, values.vtype);
+  std::swap(count, values.count);
+  column.swap(values.column);
+  mixed.swap(values.mixed);
+}
+
+Value Values::operator[](size_t i) const
+{
+  assert(i < count);
+  if (!columnar) { return mixed[i]; }
+  size_t size = ValueTypeSize(vtype);
+  ValueData data;
+  data.u128.h = 0; data.u128.l = 0;
+  memcpy(&data, &column[i * size], size);
+  return Value(vtype, data);
+}
+
+void Values::Set(size_t i, const Value& value)
+{
+  assert(i < count);
+  if (columnar && value.Type() != vtype) { ToMixed(); }
+  if (columnar) {
+    size_t size = ValueTypeSize(vtype);
+    ValueData data = value.Data();
+    memcpy(&column[i * size], &data, size);
+  } else {
+    mixed[i] = value;
+  }
+}
+
+void Values::ToMixed()
+{
+  if (!columnar) { return; }
+  std::vector<Value> values;
+  values.reserve(count + 1);
+  for (size_t i = 0; i < count; ++i) { values.push_back((*this)[i]); }
+  mixed.swap(values);
+  std::vector<char>().swap(column);
+  columnar = false;
+  vtype = MV_LAST;
+}
+
+/// Column elements are laid out as Value::WriteTo writes them, except for
+/// types which WriteTo reorders or pads.
+static bool IsColumnWritable(ValueType type)
+{
+  switch (type) {
+  case MV_UINT128:
+#ifdef MBUFFER_PASS_PLAIN_F16_AS_U32
+  case MV_PLAIN_FLOAT16:
+#endif
+    return false;
+  default:
+    return true;
+  }
+}
+
+bool Values::HasMemoryLayout() const
+{
+  return columnar && IsColumnWritable(vtype);
 }
 
 void WriteTo(void *dest, const Values& values)
 {
+  if (values.HasMemoryLayout()) {
+    if (!values.empty()) { memcpy(dest, values.ColumnData(), values.size() * values.ColumnElementSize()); }
+    return;
+  }
   char *ptr = (char *) dest;
   for (size_t i = 0; i < values.size(); ++i) {
-    values[i].WriteTo(ptr);
-    ptr += values[i].Size();
+    Value value = values[i];
+    value.WriteTo(ptr);
+    ptr += value.Size();
   }
 }
 
 void ReadFrom(void *src, ValueType type, size_t count, Values& values)
 {
   char *ptr = (char *) src;
+  values.reserve(values.size() + count);
   for (size_t i = 0; i < count; ++i) {
-    values.push_back(Value());
-    values[i].ReadFrom(ptr, type);
-    ptr += values[i].Size();
+    Value value;
+    value.ReadFrom(ptr, type);
+    values.push_back(value);
+    ptr += value.Size();
   }
 }
 
 uint32_t SizeOf(const Values& values) 
 {
+  if (values.IsColumn()) {
+    return static_cast<uint32_t>(values.size() * values.ColumnElementSize());
+  }
   uint32_t size = 0;
   for (const auto value: values) {
     size += static_cast<uint32_t>(value.Size());
@@ -637,6 +787,15 @@ uint32_t SizeOf(const Values& values)
   return size;
 }
 
+bool IsPlainData(const Values& values)
+{
+  if (values.IsColumn()) { return true; }
+  for (const Value& value : values) {
+    if (value.Type() == MV_EXPR || value.Type() == MV_STRING) { return false; }
+  }
+  return true;
+}
+
 void MBuffer::Print(std::ostream& out) const
 {
   MObject::Print(out);
@@ -1425,12 +1584,18 @@ bool Comparison::CompareValues(const Value& v1 /*expected*/, const Value& v2 /*a
   }
 }
 
-bool Comparison::Compare(const Value& expected, const Value& actual)
+bool Comparison::Recompare(const Value& expected, const Value& actual)
 {
   this->expected = expected;
   this->actual = actual;
   //assert(evalue.Type() == rvalue.Type());
   result = CompareValues(expected, actual);
+  return result;
+}
+
+bool Comparison::Compare(const Value& expected, const Value& actual)
+{
+  Recompare(expected, actual);
   if (!result) {
     failed++;
     if (maxError < error) {
@@ -1442,6 +1607,118 @@ bool Comparison::Compare(const Value& expected, const Value& actual)
   return result;
 }
 
+static const size_t COMPARE_BLOCK_SIZE = 64;
+
+static bool IsExactType(ValueType type)
+{
+  switch (type) {
+  case MV_INT8: case MV_UINT8: case MV_INT16: case MV_UINT16:
+  case MV_INT32: case MV_UINT32: case MV_INT64: case MV_UINT64:
+  case MV_INT8X4: case MV_INT8X8: case MV_UINT8X4: case MV_UINT8X8:
+  case MV_INT16X2: case MV_INT16X4: case MV_UINT16X2: case MV_UINT16X4:
+  case MV_INT32X2: case MV_UINT32X2:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Quick checks below are branch-free so that compilers vectorize them. They
+// may reject elements that pass (these go through Compare), but never accept
+// elements that fail: non-finite values and zero expected values are always
+// rejected.
+
+template <typename F, typename U>
+static bool UlpsBlockPasses(const char* expected, const char* actual, size_t count,
+                            U expMask, U maxUlps, F minLimit, F maxLimit)
+{
+  const U* e = reinterpret_cast<const U*>(expected);
+  const U* a = reinterpret_cast<const U*>(actual);
+  const F* af = reinterpret_cast<const F*>(actual);
+  unsigned bad = 0;
+  for (size_t i = 0; i < count; ++i) {
+    U d = e[i] > a[i] ? e[i] - a[i] : a[i] - e[i];
+    bad |= ((e[i] & expMask) == expMask) | ((a[i] & expMask) == expMask) |
+           !(af[i] >= minLimit) | !(af[i] <= maxLimit) | (d > maxUlps);
+  }
+  return bad == 0;
+}
+
+template <typename F, typename U>
+static bool RelativeBlockPasses(const char* expected, const char* actual, size_t count,
+                                U expMask, double maxError, F minLimit, F maxLimit)
+{
+  const U* e = reinterpret_cast<const U*>(expected);
+  const U* a = reinterpret_cast<const U*>(actual);
+  const F* ef = reinterpret_cast<const F*>(expected);
+  const F* af = reinterpret_cast<const F*>(actual);
+  unsigned bad = 0;
+  for (size_t i = 0; i < count; ++i) {
+    double x = ef[i], y = af[i];
+    double error = std::fabs((x - y) / x);
+    bad |= ((e[i] & expMask) == expMask) | ((a[i] & expMask) == expMask) | (x == 0.0) |
+           !(af[i] >= minLimit) | !(af[i] <= maxLimit) | !(error <= maxError);
+  }
+  return bad == 0;
+}
+
+template <typename U>
+static U MaxUlps(double precision)
+{
+  return precision >= (double) std::numeric_limits<U>::max() ? std::numeric_limits<U>::max() : (U) std::floor(precision);
+}
+
+bool Comparison::BlockPasses(ValueType type, const char* expected, const char* actual, size_t count) const
+{
+  if (IsExactType(type)) {
+    return memcmp(expected, actual, count * ValueTypeSize(type)) == 0;
+  }
+  if (method == CM_ULPS && precision.D() >= 0) {
+    switch (type) {
+    case MV_FLOAT:
+      return UlpsBlockPasses<float, uint32_t>(expected, actual, count, 0x7f800000u, MaxUlps<uint32_t>(precision.D()), minLimit, maxLimit);
+    case MV_DOUBLE:
+      return UlpsBlockPasses<double, uint64_t>(expected, actual, count, 0x7ff0000000000000ull, MaxUlps<uint64_t>(precision.D()), minLimit, maxLimit);
+    default:
+      break;
+    }
+  }
+  if (method == CM_RELATIVE) {
+    switch (type) {
+    case MV_FLOAT:
+      return RelativeBlockPasses<float, uint32_t>(expected, actual, count, 0x7f800000u, precision.D(), minLimit, maxLimit);
+    case MV_DOUBLE:
+      return RelativeBlockPasses<double, uint64_t>(expected, actual, count, 0x7ff0000000000000ull, precision.D(), minLimit, maxLimit);
+    default:
+      break;
+    }
+  }
+  return false;
+}
+
+void Comparison::CompareArrays(ValueType type, const void* expected, const void* actual, size_t count,
+                               std::vector<size_t>& failures, size_t maxFailures)
+{
+  const char* eptr = (const char*) expected;
+  const char* aptr = (const char*) actual;
+  size_t size = ValueTypeSize(type);
+  // Compare uses checks as index of the compared pair.
+  unsigned base = checks;
+  Value e, a;
+  for (size_t begin = 0; begin < count; begin += COMPARE_BLOCK_SIZE) {
+    size_t blockSize = (std::min)(COMPARE_BLOCK_SIZE, count - begin);
+    if (BlockPasses(type, eptr + begin * size, aptr + begin * size, blockSize)) {
+      checks = base + (unsigned) (begin + blockSize);
+      continue;
+    }
+    for (size_t i = begin; i < begin + blockSize; ++i) {
+      e.ReadFrom(eptr + i * size, type);
+      a.ReadFrom(aptr + i * size, type);
+      if (!Compare(e, a) && failures.size() < maxFailures) { failures.push_back(i); }
+    }
+  }
+}
+
 std::string Comparison::GetMethodDescription() const
 {
   switch (method) {
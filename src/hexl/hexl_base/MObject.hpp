@@ -30,6 +30,7 @@
 #include <ostream>
 #include <iostream>
 #include <vector>
+#include <iterator>
 #include <cassert>
 #include <limits>
 #include <string>
@@ -814,7 +815,106 @@ private:
   static const unsigned PointerSize() { return sizeof(void *); }
 };
 
-typedef std::vector<Value> Values;
+/// Sequence of values with the interface of std::vector<Value>.
+///
+/// Values of a single plain data type (buffer contents, expected results)
+/// are stored as a column: the type and a contiguous array of elements of
+/// ValueTypeSize bytes each. Sequences that mix types or hold values that
+/// refer to other data (expressions, strings, pointers, references) are
+/// stored as a vector of Value. Elements are returned by value; non-const
+/// operator[] returns a Reference that writes assigned values back.
+class Values {
+public:
+  class Reference : public Value {
+  public:
+    Reference(Values& owner_, size_t index_) : Value(const_cast<const Values&>(owner_)[index_]), owner(owner_), index(index_) { }
+    Reference(const Reference& r) : Value(r), owner(r.owner), index(r.index) { }
+    Reference& operator=(const Value& v) { owner.Set(index, v); Value::operator=(v); return *this; }
+    Reference& operator=(const Reference& r) { return *this = static_cast<const Value&>(r); }
+
+  private:
+    Values& owner;
+    size_t index;
+  };
+
+  class const_iterator {
+  public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef Value value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Value* pointer;
+    typedef Value reference;
+
+    const_iterator() : values(0), index(0) { }
+    const_iterator(const Values* values_, size_t index_) : values(values_), index(index_) { }
+
+    Value operator*() const { return (*values)[index]; }
+    Value operator[](std::ptrdiff_t n) const { return (*values)[index + n]; }
+    const_iterator& operator++() { ++index; return *this; }
+    const_iterator operator++(int) { const_iterator i(*this); ++index; return i; }
+    const_iterator& operator--() { --index; return *this; }
+    const_iterator operator--(int) { const_iterator i(*this); --index; return i; }
+    const_iterator& operator+=(std::ptrdiff_t n) { index += n; return *this; }
+    const_iterator& operator-=(std::ptrdiff_t n) { index -= n; return *this; }
+    const_iterator operator+(std::ptrdiff_t n) const { return const_iterator(values, index + n); }
+    const_iterator operator-(std::ptrdiff_t n) const { return const_iterator(values, index - n); }
+    std::ptrdiff_t operator-(const const_iterator& i) const { return (std::ptrdiff_t) index - (std::ptrdiff_t) i.index; }
+    bool operator==(const const_iterator& i) const { return index == i.index; }
+    bool operator!=(const const_iterator& i) const { return index != i.index; }
+    bool operator<(const const_iterator& i) const { return index < i.index; }
+
+  private:
+    const Values* values;
+    size_t index;
+  };
+
+  typedef const_iterator iterator;
+  typedef Value value_type;
+  typedef size_t size_type;
+
+  Values() : columnar(true), vtype(MV_LAST), count(0) { }
+  Values(size_t n, const Value& value);
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  void clear();
+  void reserve(size_t n);
+  void resize(size_t n, const Value& value = Value());
+  void push_back(const Value& value);
+  void swap(Values& values);
+
+  Value operator[](size_t i) const;
+  Reference operator[](size_t i) { return Reference(*this, i); }
+  Value front() const { return (*this)[0]; }
+  Value back() const { return (*this)[count - 1]; }
+  void Set(size_t i, const Value& value);
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, count); }
+
+  /// True if values are stored as a column (of ColumnType()), in which
+  /// case none of them needs to be resolved in runtime context.
+  bool IsColumn() const { return columnar; }
+  /// Type of column elements, MV_LAST if the column is empty.
+  ValueType ColumnType() const { return vtype; }
+  /// Contiguous column elements (see IsColumn), 0 if there are none.
+  const char* ColumnData() const { return column.empty() ? 0 : &column[0]; }
+  size_t ColumnElementSize() const { return vtype == MV_LAST ? 0 : ValueTypeSize(vtype); }
+  /// True if values are a column laid out as in memory written by
+  /// Value::WriteTo and read by Value::ReadFrom.
+  bool HasMemoryLayout() const;
+
+  static bool IsColumnType(ValueType type);
+
+private:
+  bool columnar;
+  ValueType vtype;
+  size_t count;
+  std::vector<char> column;
+  std::vector<Value> mixed;
+
+  void ToMixed();
+};
 
 class ResourceManager;
 class TestFactory;
@@ -862,6 +962,9 @@ void ReadFrom(void *dest, ValueType type, size_t count, Values& values);
 void SerializeValues(std::ostream& out, const Values& values);
 void DeserializeValues(std::istream& in, Values& values);
 uint32_t SizeOf(const Values& values);
+/// True if values can be written as is, without resolving them in runtime
+/// context (see Context::GetRuntimeValue).
+bool IsPlainData(const Values& values);
 
 class MBuffer : public MObject {
 public:
@@ -961,6 +1064,16 @@ public:
   void PrintLong(std::ostream& out);
 
   bool Compare(const Value& expected, const Value& actual);
+  /// Compares a pair like Compare, but does not count it. Used to report
+  /// failures found by CompareArrays.
+  bool Recompare(const Value& expected, const Value& actual);
+  /// Compares count elements of given type laid out as in memory, with the
+  /// same counts and max error as Compare called for each pair. Blocks in
+  /// which every element passes a quick branch-free check are only counted,
+  /// other elements go through Compare. Indices of the first maxFailures
+  /// failed elements are appended to failures.
+  void CompareArrays(ValueType type, const void* expected, const void* actual, size_t count,
+                     std::vector<size_t>& failures, size_t maxFailures);
 
 private:
   ComparisonMethod method;
@@ -980,6 +1093,7 @@ private:
   bool CompareFloat(const Value& v1, const Value& v2);
   bool CompareDouble(const Value& v1, const Value& v2);
   float ConvertToStandard(float f) const;
+  bool BlockPasses(ValueType type, const char* expected, const char* actual, size_t count) const;
 };
 
 std::ostream& operator<<(std::ostream& out, const Comparison& comparison);
@@ -1142,6 +1256,22 @@ struct Serializer<MObject*> {
 MEMBER_SERIALIZER(MemorySetup);
 MEMBER_SERIALIZER(Value);
 
+template <>
+struct Serializer<Values> {
+  static void Write(std::ostream& out, const Values& values) {
+    uint64_t size = values.size();
+    WriteData(out, size);
+    for (size_t i = 0; i < values.size(); ++i) { WriteData(out, values[i]); }
+  }
+  static void Read(std::istream& in, Values& values) {
+    uint64_t size;
+    ReadData(in, size);
+    values.clear();
+    values.reserve((size_t) size);
+    for (uint64_t i = 0; i < size; ++i) { Value value; ReadData(in, value); values.push_back(value); }
+  }
+};
+
 }
 
 #endif // MOBJECT_HPP
@@ -19,7 +19,8 @@
 
 #include "MObject.hpp"
 #include <vector>
-#include <thread>
+#include <atomic>
+#include "HostThreadPool.hpp"
 #include "Brig.h"
 
 namespace hexl {
@@ -50,6 +51,8 @@ namespace hexl {
         width(width_), height(height_), depth(depth_), arraySize(arraySize_) { }
     ImageParams() { }
     void Print(std::ostream& out) const;
+    void Serialize(std::ostream& out) const;
+    void Deserialize(std::istream& in);
   };
 
   class SamplerParams {
@@ -80,6 +83,8 @@ namespace hexl {
 
     void Print(std::ostream& out) const;
     void Name(std::ostream& out) const;
+    void Serialize(std::ostream& out) const;
+    void Deserialize(std::istream& in);
   };
 
   inline std::ostream& operator<<(std::ostream& out, const SamplerParams& params) { params.Name(out); return out; }
@@ -97,6 +102,8 @@ namespace hexl {
                 uint32_t size_x_ = 1, uint32_t size_y_ = 1, uint32_t size_z_ = 1)
                 : x(x_), y(y_), z(z_), size_x(size_x_), size_y(size_y_), size_z(size_z_) {}
     void Print(std::ostream& out) const;
+    void Serialize(std::ostream& out) const;
+    void Deserialize(std::istream& in);
   };
 
 
@@ -111,6 +118,7 @@ namespace hexl {
       static Command* CreateFromString(const std::string& s);
 
       virtual void Print(std::ostream& out) const = 0;
+      virtual void Serialize(std::ostream& out) const = 0;
       virtual bool Execute(runtime::RuntimeState* runtime) = 0;
       virtual bool Finish(runtime::RuntimeState* runtime) { return true; }
     };
@@ -194,9 +202,14 @@ namespace hexl {
 
       virtual void Print(std::ostream& out) const { out << Description(); }
       virtual void PrintInfo(std::ostream& out) {}
+      /// Prints runtime statistics collected during test run.
+      virtual void PrintStats(std::ostream& out) {}
       virtual bool Init() = 0;
       virtual RuntimeState* NewState(Context* context) = 0;
       virtual std::string Description() const = 0;
+      /// Identifies runtime implementation and device, results of -incremental
+      /// run are reused only if it did not change.
+      virtual std::string Fingerprint() { return Description(); }
       virtual uint32_t Wavesize()= 0;
       virtual uint32_t WavesPerGroup() = 0;
       virtual bool IsLittleEndianness() { return true; };
@@ -204,18 +217,26 @@ namespace hexl {
       bool HasCustomProfile() const;
     };
 
+    /// Runs commands on threads taken from HostThreadPool.
     class HostThreads {
     private:
-      RuntimeState* rt;
-      std::vector<bool> results;
-      std::vector<std::thread> threads;
+      struct HostThread {
+        unsigned id;
+        HostThreadPool::Worker* worker;
+        /// Written by the worker, read after it is waited for.
+        std::atomic<bool> result;
+
+        HostThread(unsigned id_, HostThreadPool::Worker* worker_)
+          : id(id_), worker(worker_), result(false) { }
+      };
 
-      void RunThread(unsigned id, Command* command);
-      bool Result(unsigned id) const;
+      RuntimeState* rt;
+      std::vector<std::unique_ptr<HostThread>> threads;
 
     public:
       HostThreads(RuntimeState* rt_)
         : rt(rt_) { }
+      ~HostThreads() { WaitThreads(); }
       bool StartThread(unsigned id, Command* command);
       bool WaitThreads();
     };
@@ -45,6 +45,28 @@ namespace hexl {
 #endif
   }
 
+  unsigned TestTimeout(Context* context, unsigned defaultTimeout)
+  {
+    unsigned timeout = context->Opts()->GetUnsigned("timeout", defaultTimeout);
+    std::string timeouts = context->Opts()->GetString("timeouts");
+    if (timeouts.empty() || !context->Contains(CK_OUTPUT_PATH)) { return timeout; }
+    std::string name = context->GetString(CK_OUTPUT_PATH);
+    if (!name.empty() && name[0] == '/') { name.erase(0, 1); }
+    size_t matched = 0;
+    std::istringstream in(timeouts);
+    std::string entry;
+    while (std::getline(in, entry, ',')) {
+      size_t eq = entry.find('=');
+      if (eq == std::string::npos) { continue; }
+      std::string prefix = entry.substr(0, eq);
+      if (prefix.size() >= matched && name.compare(0, prefix.size(), prefix) == 0) {
+        timeout = (unsigned) strtoul(entry.c_str() + eq + 1, 0, 10);
+        matched = prefix.size();
+      }
+    }
+    return timeout;
+  }
+
   void ImageParams::Print(std::ostream& out) const
   {
     out <<
@@ -59,6 +81,32 @@ namespace hexl {
       ")";
   }
 
+  void ImageParams::Serialize(std::ostream& out) const
+  {
+    WriteData(out, (uint32_t) imageType);
+    WriteData(out, (uint32_t) geometry);
+    WriteData(out, (uint32_t) channelOrder);
+    WriteData(out, (uint32_t) channelType);
+    WriteData(out, (uint64_t) width);
+    WriteData(out, (uint64_t) height);
+    WriteData(out, (uint64_t) depth);
+    WriteData(out, (uint64_t) arraySize);
+  }
+
+  void ImageParams::Deserialize(std::istream& in)
+  {
+    uint32_t v;
+    uint64_t size;
+    ReadData(in, v); imageType = (BrigType) v;
+    ReadData(in, v); geometry = (BrigImageGeometry) v;
+    ReadData(in, v); channelOrder = (BrigImageChannelOrder) v;
+    ReadData(in, v); channelType = (BrigImageChannelType) v;
+    ReadData(in, size); width = (size_t) size;
+    ReadData(in, size); height = (size_t) size;
+    ReadData(in, size); depth = (size_t) size;
+    ReadData(in, size); arraySize = (size_t) size;
+  }
+
   bool SamplerParams::IsValid() const
   {
     switch (coord)
@@ -114,6 +162,21 @@ namespace hexl {
       HSAIL_ASM::samplerAddressing2str(addressing);
   }
 
+  void SamplerParams::Serialize(std::ostream& out) const
+  {
+    WriteData(out, (uint32_t) coord);
+    WriteData(out, (uint32_t) filter);
+    WriteData(out, (uint32_t) addressing);
+  }
+
+  void SamplerParams::Deserialize(std::istream& in)
+  {
+    uint32_t v;
+    ReadData(in, v); coord = (BrigSamplerCoordNormalization) v;
+    ReadData(in, v); filter = (BrigSamplerFilter) v;
+    ReadData(in, v); addressing = (BrigSamplerAddressing) v;
+  }
+
   void ImageRegion::Print(std::ostream& out) const
   {
     out << "image_region" <<
@@ -125,6 +188,26 @@ namespace hexl {
            "; size_z = " << size_z << ")";
   }
 
+  void ImageRegion::Serialize(std::ostream& out) const
+  {
+    WriteData(out, x);
+    WriteData(out, y);
+    WriteData(out, z);
+    WriteData(out, size_x);
+    WriteData(out, size_y);
+    WriteData(out, size_z);
+  }
+
+  void ImageRegion::Deserialize(std::istream& in)
+  {
+    ReadData(in, x);
+    ReadData(in, y);
+    ReadData(in, z);
+    ReadData(in, size_x);
+    ReadData(in, size_y);
+    ReadData(in, size_z);
+  }
+
 
   class NoneRuntimeState : public runtime::RuntimeState {
   private:
@@ -257,30 +340,24 @@ namespace hexl {
       return context->Opts()->IsSet("profile");
     }
 
-    void HostThreads::RunThread(unsigned id, Command* command)
-    {
-      results[id] = command->Execute(rt);
-    }
-
     bool HostThreads::StartThread(unsigned id, Command* command)
     {
-      results.push_back(false);
-      threads.push_back(std::thread(&HostThreads::RunThread, this, id, command));
+      HostThread* thread = new HostThread(id, HostThreadPool::Instance()->Acquire());
+      threads.push_back(std::unique_ptr<HostThread>(thread));
+      RuntimeState* state = rt;
+      thread->worker->Run([thread, command, state]() { thread->result.store(command->Execute(state)); });
       return true;
     }
 
-    bool HostThreads::Result(unsigned id) const
-    {
-      return results[id];
-    }
-
     bool HostThreads::WaitThreads()
     {
-      for (std::thread& t : threads) {
-        t.join();
-      }
       bool result = true;
-      for (bool r : results) { result &= r; }
+      for (std::unique_ptr<HostThread>& thread : threads) {
+        thread->worker->Wait();
+        HostThreadPool::Instance()->Release(thread->worker);
+        result &= thread->result.load();
+      }
+      threads.clear();
       return result;
     }
 
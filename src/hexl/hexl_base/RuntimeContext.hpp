@@ -27,6 +27,11 @@ namespace hexl {
 
   runtime::RuntimeContext* CreateNoneRuntime(Context* context);
 
+  /// Dispatch timeout in seconds for the test owning context: value of the
+  /// longest test name prefix in -timeouts (Prefix=Seconds,...) matching
+  /// the test, otherwise -timeout or defaultTimeout.
+  unsigned TestTimeout(Context* context, unsigned defaultTimeout);
+
   template <>
   inline void Print(const runtime::RuntimeState& state, std::ostream& out) { state.Print(out); }
 };
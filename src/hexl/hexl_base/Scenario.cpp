@@ -20,13 +20,16 @@
 #include "HexlResource.hpp"
 #include "HexlTestFactory.hpp"
 #include "Utils.hpp"
-#include <thread>
+#include "HostThreadPool.hpp"
+#include <atomic>
 #include <sstream>
 
 namespace hexl {
 
 using namespace runtime;
 
+ENUM_SERIALIZER(DispatchArgType);
+
 namespace scenario {
 
   void CommandSequence::Add(Command* command)
@@ -42,6 +45,14 @@ namespace scenario {
     }
   }
 
+  void CommandSequence::Serialize(std::ostream& out) const
+  {
+    WriteData(out, (uint32_t) commands.size());
+    for (const std::unique_ptr<Command>& c : commands) {
+      c->Serialize(out);
+    }
+  }
+
   bool CommandSequence::Execute(runtime::RuntimeState* rt)
   {
     for (const std::unique_ptr<Command>& c : commands) {
@@ -102,15 +113,46 @@ namespace scenario {
 
   bool Scenario::Execute(runtime::RuntimeState* rt)
   {
+    // Sequences of other threads use test context concurrently.
+    Context* context = rt->GetContext();
+    bool shared = commands.size() > 1;
+    if (shared) { context->SetShared(true); }
     bool result = true;
     result &= rt->StartThread(0, commands[0].get());
     result &= rt->WaitThreads();
     for (std::unique_ptr<CommandSequence>& c : commands) {
       result &= c->Finish(rt);
     }
+    if (shared) { context->SetShared(false); }
     return result;
   }
 
+  void Scenario::Serialize(std::ostream& out) const
+  {
+    WriteData(out, (uint32_t) commands.size());
+    for (const std::unique_ptr<CommandSequence>& c : commands) {
+      c->Serialize(out);
+    }
+  }
+
+  static bool DeserializeCommand(std::istream& in, CommandsBuilder* builder);
+
+  Scenario* Scenario::Deserialize(std::istream& in)
+  {
+    ScenarioBuilder sb(0);
+    uint32_t threads;
+    ReadData(in, threads);
+    for (uint32_t i = 0; i < threads; ++i) {
+      CommandsBuilder* builder = sb.Commands(i);
+      uint32_t count;
+      ReadData(in, count);
+      for (uint32_t j = 0; j < count; ++j) {
+        if (!DeserializeCommand(in, builder)) { break; }
+      }
+    }
+    return sb.ReleaseScenario();
+  }
+
   void Scenario::Print(std::ostream& out) const
   {
     unsigned i = 0;
@@ -129,13 +171,13 @@ namespace scenario {
   class StartThreadCommand : public Command {
   private:
     unsigned id;
-    std::thread thread;
+    HostThreadPool::Worker* worker;
     runtime::RuntimeState* runtime;
     Scenario* scenario;
-    volatile bool result;
+    std::atomic<bool> result;
 
     void RunThread() {
-      result = scenario->Commands(id)->Execute(runtime);
+      result.store(scenario->Commands(id)->Execute(runtime));
     }
 
     void Start(runtime::RuntimeState* runtime) {
@@ -146,16 +188,19 @@ namespace scenario {
       ss << "Starting thread: " << id << std::endl;
       context->Info() << ss.str();
       assert(scenario);
-      thread = std::thread(&hexl::scenario::StartThreadCommand::RunThread, this);
+      worker = HostThreadPool::Instance()->Acquire();
+      worker->Run([this]() { RunThread(); });
     }
 
     void Wait(runtime::RuntimeState* runtime) {
       Context* context = runtime->GetContext();
-      if (thread.joinable()) {
+      if (worker) {
         std::stringstream ss;
         ss << "Joining thread: " << id << std::endl;
         context->Info() << ss.str();
-        thread.join();
+        worker->Wait();
+        HostThreadPool::Instance()->Release(worker);
+        worker = 0;
       }
       std::stringstream ss;
       ss << "Thread [" << id << "] result: " << (result ? "PASSED" : "FAILED") << std::endl;
@@ -163,7 +208,14 @@ namespace scenario {
     }
 
   public:
-    StartThreadCommand(unsigned id_): id(id_) { }
+    StartThreadCommand(unsigned id_): id(id_), worker(0), result(false) { }
+    ~StartThreadCommand()
+    {
+      if (worker) {
+        worker->Wait();
+        HostThreadPool::Instance()->Release(worker);
+      }
+    }
 
     bool Finish(runtime::RuntimeState* runtime) {
       Scenario* scenario = Scenario::Get(runtime->GetContext());
@@ -180,6 +232,11 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "start_thread " << id;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("start_thread"));
+      WriteData(out, (uint32_t) id);
+    }
   };
 
   bool CommandsBuilder::StartThread(unsigned id, Command* commandToRun)
@@ -204,12 +261,19 @@ namespace scenario {
       : moduleId(moduleId_), brigId(brigId_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_MODULE);
       return rt->ModuleCreateFromBrig(moduleId, brigId);
     }
 
     void Print(std::ostream& out) const {
       out << "module_create_from_brig " << moduleId << " " << brigId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("module_create_from_brig"));
+      WriteData(out, moduleId);
+      WriteData(out, brigId);
+    }
   };
 
   bool CommandsBuilder::ModuleCreateFromBrig(const std::string& moduleId, const std::string& brigId)
@@ -233,6 +297,11 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "program_create " << programId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("program_create"));
+      WriteData(out, programId);
+    }
   };
 
   bool CommandsBuilder::ProgramCreate(const std::string& programId)
@@ -257,6 +326,12 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "program_add_module " << programId << " " << moduleId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("program_add_module"));
+      WriteData(out, programId);
+      WriteData(out, moduleId);
+    }
   };
 
   bool CommandsBuilder::ProgramAddModule(const std::string& programId, const std::string& moduleId)
@@ -275,12 +350,19 @@ namespace scenario {
       : codeId(codeId_), programId(programId_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_FINALIZE);
       return rt->ProgramFinalize(codeId, programId);
     }
 
     void Print(std::ostream& out) const {
       out << "program_finalize " << codeId << " " << programId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("program_finalize"));
+      WriteData(out, codeId);
+      WriteData(out, programId);
+    }
   };
 
   bool CommandsBuilder::ProgramFinalize(const std::string& codeId, const std::string& programId)
@@ -304,6 +386,11 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "executable_create " << executableId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("executable_create"));
+      WriteData(out, executableId);
+    }
   };
 
   bool CommandsBuilder::ExecutableCreate(const std::string& executableId)
@@ -322,12 +409,19 @@ namespace scenario {
       : executableId(executableId_), codeId(codeId_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_LOAD);
       return rt->ExecutableLoadCode(executableId, codeId);
     }
 
     void Print(std::ostream& out) const {
       out << "executable_load_code " << executableId << " " << codeId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("executable_load_code"));
+      WriteData(out, executableId);
+      WriteData(out, codeId);
+    }
   };
 
   bool CommandsBuilder::ExecutableLoadCode(const std::string& executableId, const std::string& codeId)
@@ -345,12 +439,18 @@ namespace scenario {
       : executableId(executableId_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_LOAD);
       return rt->ExecutableFreeze(executableId);
     }
 
     void Print(std::ostream& out) const {
       out << "executable_freeze " << executableId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("executable_freeze"));
+      WriteData(out, executableId);
+    }
   };
 
   bool CommandsBuilder::ExecutableFreeze(const std::string& executableId)
@@ -376,6 +476,13 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "buffer_create " << bufferId << " " << size << " "<< initValuesId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("buffer_create"));
+      WriteData(out, bufferId);
+      WriteData(out, (uint64_t) size);
+      WriteData(out, initValuesId);
+    }
   };
 
   bool CommandsBuilder::BufferCreate(const std::string& bufferId, size_t size, const std::string& initValuesId)
@@ -396,12 +503,21 @@ namespace scenario {
       : bufferId(bufferId_), expectedDataId(expectedDataId_), memoryType(memoryType_), method(method_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_VALIDATE);
       return rt->BufferValidate(bufferId, expectedDataId, memoryType, method);
     }
 
     void Print(std::ostream& out) const {
       out << "buffer_validate " << bufferId << " " << expectedDataId << " " << method << " " << ValueType2Str(memoryType);
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("buffer_validate"));
+      WriteData(out, bufferId);
+      WriteData(out, expectedDataId);
+      WriteData(out, memoryType);
+      WriteData(out, method);
+    }
   };
 
   bool CommandsBuilder::BufferValidate(const std::string& bufferId, const std::string& expectedDataId, ValueType memoryType, const std::string& method)
@@ -427,6 +543,13 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "image_create " << imageId << " " << imageParamsId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("image_create"));
+      WriteData(out, imageId);
+      WriteData(out, imageParamsId);
+      WriteData(out, (uint32_t) optionalFormat);
+    }
   };
 
   bool CommandsBuilder::ImageCreate(const std::string& imageId, const std::string& imageParamsId, bool optionalFormat)
@@ -452,6 +575,13 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "image_initialize " << imageId << " " << imageParamsId << " " << initValueId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("image_initialize"));
+      WriteData(out, imageId);
+      WriteData(out, imageParamsId);
+      WriteData(out, initValueId);
+    }
   };
 
   bool CommandsBuilder::ImageInitialize(const std::string& imageId, const std::string& imageParamsId, const std::string& initValueId)
@@ -478,6 +608,13 @@ namespace scenario {
       out << "image_write " << imageId << " " << writeValuesId << " ";
       region.Print(out);
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("image_write"));
+      WriteData(out, imageId);
+      WriteData(out, writeValuesId);
+      region.Serialize(out);
+    }
   };
 
   bool CommandsBuilder::ImageWrite(const std::string& imageId, const std::string& writeValuesId, const ImageRegion& region)
@@ -498,12 +635,21 @@ namespace scenario {
       : imageId(imageId_), expectedDataId(expectedDataId_), memoryType(memoryType_), method(method_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_VALIDATE);
       return rt->ImageValidate(imageId, expectedDataId, memoryType, method);
     }
 
     void Print(std::ostream& out) const {
       out << "image_validate " << imageId << " " << expectedDataId << " " << method << "" << ValueType2Str(memoryType);
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("image_validate"));
+      WriteData(out, imageId);
+      WriteData(out, expectedDataId);
+      WriteData(out, memoryType);
+      WriteData(out, method);
+    }
   };
 
   bool CommandsBuilder::ImageValidate(const std::string& imageId, const std::string& expectedDataId, ValueType memoryType, const std::string& method)
@@ -528,6 +674,12 @@ namespace scenario {
     void Print(std::ostream& out) const {
       out << "sampler_create " << samplerId << " " << samplerParamsId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("sampler_create"));
+      WriteData(out, samplerId);
+      WriteData(out, samplerParamsId);
+    }
   };
 
   bool CommandsBuilder::SamplerCreate(const std::string& samplerId, const std::string& samplerParamsId)
@@ -553,6 +705,13 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "dispatch_create " << dispatchId << " " << executableId << " " << kernelName;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("dispatch_create"));
+      WriteData(out, dispatchId);
+      WriteData(out, executableId);
+      WriteData(out, kernelName);
+    }
   };
 
   bool CommandsBuilder::DispatchCreate(const std::string& dispatchId, const std::string& executableId, const std::string& kernelName)
@@ -578,6 +737,13 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "dispatch_arg " << dispatchId << " " << argType << " " << argKey;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("dispatch_arg"));
+      WriteData(out, dispatchId);
+      WriteData(out, argType);
+      WriteData(out, argKey);
+    }
   };
 
   bool CommandsBuilder::DispatchArg(const std::string& dispatchId, DispatchArgType argType, const std::string& argKey)
@@ -595,12 +761,18 @@ class DispatchCreateCommand : public Command {
       : dispatchId(dispatchId_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_DISPATCH);
       return rt->DispatchExecute(dispatchId);
     }
 
     void Print(std::ostream& out) const {
       out << "dispatch_execute " << dispatchId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("dispatch_execute"));
+      WriteData(out, dispatchId);
+    }
   };
 
   bool CommandsBuilder::DispatchExecute(const std::string& dispatchId)
@@ -618,12 +790,18 @@ class DispatchCreateCommand : public Command {
       : dispatchId(dispatchId_) { }
 
     virtual bool Execute(runtime::RuntimeState* rt) {
+      PhaseTimer timer(rt->GetContext(), PHASE_DISPATCH);
       return !rt->DispatchExecute(dispatchId) && rt->IsQueueError();
     }
 
     void Print(std::ostream& out) const {
       out << "dispatch_execute_error " << dispatchId;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("dispatch_execute_error"));
+      WriteData(out, dispatchId);
+    }
   };
 
   bool CommandsBuilder::DispatchExecuteError(const std::string& dispatchId)
@@ -648,6 +826,12 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "signal_create " << signalId << " " << initialValue;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("signal_create"));
+      WriteData(out, signalId);
+      WriteData(out, initialValue);
+    }
   };
 
   bool CommandsBuilder::SignalCreate(const std::string& signalId, uint64_t signalInitialValue)
@@ -672,6 +856,12 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "signal_send " << signalId << " " << value;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("signal_send"));
+      WriteData(out, signalId);
+      WriteData(out, value);
+    }
   };
 
   bool CommandsBuilder::SignalSend(const std::string& signalId, uint64_t signalSendValue)
@@ -696,6 +886,12 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "signal_wait " << signalId << " " << value;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("signal_wait"));
+      WriteData(out, signalId);
+      WriteData(out, value);
+    }
   };
 
   bool CommandsBuilder::SignalWait(const std::string& signalId, uint64_t signalExpectedValue)
@@ -721,6 +917,12 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "queue_create " << queueId << " " << size;
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("queue_create"));
+      WriteData(out, queueId);
+      WriteData(out, size);
+    }
   };
 
 
@@ -742,6 +944,10 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "is_detect_supported";
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("is_detect_supported"));
+    }
   };
 
   bool CommandsBuilder::IsDetectSupported() {
@@ -761,6 +967,10 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "is_break_supported";
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("is_break_supported"));
+    }
   };
 
   bool CommandsBuilder::IsBreakSupported() {
@@ -779,12 +989,108 @@ class DispatchCreateCommand : public Command {
     void Print(std::ostream& out) const {
       out << "is_queue_error";
     }
+
+    void Serialize(std::ostream& out) const {
+      WriteData(out, std::string("is_queue_error"));
+    }
   };
 
   bool CommandsBuilder::IsQueueError() {
     commands->Add(new IsQueueErrorCommand());
     return true;
   }
+
+  // Replays serialized command on builder.
+  static bool DeserializeCommand(std::istream& in, CommandsBuilder* builder)
+  {
+    std::string name, s1, s2, s3;
+    uint32_t u32;
+    uint64_t u64;
+    ValueType vtype;
+    ReadData(in, name);
+    if (!in.good()) { return false; }
+    if (name == "start_thread") {
+      ReadData(in, u32);
+      return builder->StartThread(u32);
+    } else if (name == "module_create_from_brig") {
+      ReadData(in, s1); ReadData(in, s2);
+      return builder->ModuleCreateFromBrig(s1, s2);
+    } else if (name == "program_create") {
+      ReadData(in, s1);
+      return builder->ProgramCreate(s1);
+    } else if (name == "program_add_module") {
+      ReadData(in, s1); ReadData(in, s2);
+      return builder->ProgramAddModule(s1, s2);
+    } else if (name == "program_finalize") {
+      ReadData(in, s1); ReadData(in, s2);
+      return builder->ProgramFinalize(s1, s2);
+    } else if (name == "executable_create") {
+      ReadData(in, s1);
+      return builder->ExecutableCreate(s1);
+    } else if (name == "executable_load_code") {
+      ReadData(in, s1); ReadData(in, s2);
+      return builder->ExecutableLoadCode(s1, s2);
+    } else if (name == "executable_freeze") {
+      ReadData(in, s1);
+      return builder->ExecutableFreeze(s1);
+    } else if (name == "buffer_create") {
+      ReadData(in, s1); ReadData(in, u64); ReadData(in, s2);
+      return builder->BufferCreate(s1, (size_t) u64, s2);
+    } else if (name == "buffer_validate") {
+      ReadData(in, s1); ReadData(in, s2); ReadData(in, vtype); ReadData(in, s3);
+      return builder->BufferValidate(s1, s2, vtype, s3);
+    } else if (name == "image_create") {
+      ReadData(in, s1); ReadData(in, s2); ReadData(in, u32);
+      return builder->ImageCreate(s1, s2, u32 != 0);
+    } else if (name == "image_initialize") {
+      ReadData(in, s1); ReadData(in, s2); ReadData(in, s3);
+      return builder->ImageInitialize(s1, s2, s3);
+    } else if (name == "image_write") {
+      ImageRegion region;
+      ReadData(in, s1); ReadData(in, s2); region.Deserialize(in);
+      return builder->ImageWrite(s1, s2, region);
+    } else if (name == "image_validate") {
+      ReadData(in, s1); ReadData(in, s2); ReadData(in, vtype); ReadData(in, s3);
+      return builder->ImageValidate(s1, s2, vtype, s3);
+    } else if (name == "sampler_create") {
+      ReadData(in, s1); ReadData(in, s2);
+      return builder->SamplerCreate(s1, s2);
+    } else if (name == "dispatch_create") {
+      ReadData(in, s1); ReadData(in, s2); ReadData(in, s3);
+      return builder->DispatchCreate(s1, s2, s3);
+    } else if (name == "dispatch_arg") {
+      DispatchArgType argType;
+      ReadData(in, s1); ReadData(in, argType); ReadData(in, s2);
+      return builder->DispatchArg(s1, argType, s2);
+    } else if (name == "dispatch_execute") {
+      ReadData(in, s1);
+      return builder->DispatchExecute(s1);
+    } else if (name == "dispatch_execute_error") {
+      ReadData(in, s1);
+      return builder->DispatchExecuteError(s1);
+    } else if (name == "signal_create") {
+      ReadData(in, s1); ReadData(in, u64);
+      return builder->SignalCreate(s1, u64);
+    } else if (name == "signal_send") {
+      ReadData(in, s1); ReadData(in, u64);
+      return builder->SignalSend(s1, u64);
+    } else if (name == "signal_wait") {
+      ReadData(in, s1); ReadData(in, u64);
+      return builder->SignalWait(s1, u64);
+    } else if (name == "queue_create") {
+      ReadData(in, s1); ReadData(in, u32);
+      return builder->QueueCreate(s1, u32);
+    } else if (name == "is_detect_supported") {
+      return builder->IsDetectSupported();
+    } else if (name == "is_break_supported") {
+      return builder->IsBreakSupported();
+    } else if (name == "is_queue_error") {
+      return builder->IsQueueError();
+    } else {
+      assert(!"Unknown serialized command");
+      return false;
+    }
+  }
 }
 
 using namespace scenario;
@@ -794,6 +1100,28 @@ ScenarioTest::ScenarioTest(const std::string& name_, Context* initialContext)
 {
 }
 
+ScenarioTest::ScenarioTest(std::istream& in)
+{
+  ReadData(in, name);
+  context->Deserialize(in);
+}
+
+void ScenarioTest::SerializeData(std::ostream& out) const
+{
+  WriteData(out, name);
+  context->Serialize(out);
+}
+
+
+bool ScenarioTest::ContentHash(uint64_t& hash) const
+{
+  // Serialized test includes BRIG, scenario and expected data.
+  std::ostringstream out;
+  Serialize(out);
+  std::string data = out.str();
+  hash = HashBytes(data.data(), data.size());
+  return true;
+}
 
 void ScenarioTest::Run()
 {
@@ -34,6 +34,7 @@ namespace scenario {
   public:
     void Add(Command* command);
     virtual void Print(std::ostream& out) const override;
+    void Serialize(std::ostream& out) const override;
     bool Execute(runtime::RuntimeState* runtime) override;
     bool Finish(runtime::RuntimeState* runtime) override;
   };
@@ -48,6 +49,8 @@ namespace scenario {
     bool Execute(runtime::RuntimeState* runtime);
     bool Finish(runtime::RuntimeState* runtime);
     void Print(std::ostream& out) const;
+    void Serialize(std::ostream& out) const;
+    static Scenario* Deserialize(std::istream& in);
 
     static Scenario* Get(Context* context) { return context->Get<Scenario>("scenario"); }
   };
@@ -124,15 +127,23 @@ private:
 
 public:
   ScenarioTest(const std::string& name_, Context* initialContext);
+  ScenarioTest(std::istream& in);
   std::string Type() const { return "scenario_test"; }
   void Name(std::ostream& out) const { out << name; }
   void Description(std::ostream& out) const { }
   void Run();
+  bool ContentHash(uint64_t& hash) const override;
+
+protected:
+  void SerializeData(std::ostream& out) const;
 };
 
   template <>
   inline void Print(const scenario::Scenario& o, std::ostream& out) { o.Print(out); }
 
+  template <>
+  inline bool Serialize(const scenario::Scenario& o, std::ostream& out) { WriteData(out, CO_SCENARIO); o.Serialize(out); return true; }
+
 }
 
 #endif // HEXL_SCENARIO_HPP
@@ -92,6 +92,16 @@ std::string ExtractTestPath(const std::string& name, unsigned level)
   return name.substr(0, pos);
 }
 
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
 hexl::ValueType Brig2ValueType(BrigType type)
 {
   switch (type) {
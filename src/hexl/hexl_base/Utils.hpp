@@ -37,6 +37,8 @@ BrigCodeOffset32_t GetBrigUniqueKernelOffset(HSAIL_ASM::BrigContainer* brig);
 std::string GetBrigKernelName(HSAIL_ASM::BrigContainer* brig, BrigCodeOffset32_t kernelOffset);
 unsigned GetBrigKernelInArgCount(HSAIL_ASM::BrigContainer* brig, BrigCodeOffset32_t kernelOffset);
 std::string ExtractTestPath(const std::string& name, unsigned level);
+/// 64-bit FNV-1a hash of data, may be continued from another hash.
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL);
 hexl::ValueType Brig2ValueType(BrigType type);
 std::string ValueType2Str(hexl::ValueType vtype);
 BrigType Value2BrigType(hexl::ValueType type);
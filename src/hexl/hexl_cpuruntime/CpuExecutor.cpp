@@ -0,0 +1,1171 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "CpuExecutor.hpp"
+#include "HexlTest.hpp"
+#include "RuntimeContext.hpp"
+#include "HSAILUtilities.h"
+#include "HSAILTestGenEmulator.h"
+#include "HSAILTestGenInstSetManager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace HSAIL_ASM;
+using TESTGEN::Val;
+
+namespace hexl {
+
+namespace cpu_runtime {
+
+CpuQueue::CpuQueue(uint32_t size, uint64_t id)
+  : readIndex(0), writeIndex(0), doorbell(0)
+{
+  memset(&queue, 0, sizeof(queue));
+  queue.type = HSA_QUEUE_TYPE_MULTI;
+  queue.features = HSA_QUEUE_FEATURE_KERNEL_DISPATCH;
+  hsa_kernel_dispatch_packet_t* packets =
+    (hsa_kernel_dispatch_packet_t*) alignedMalloc(size * sizeof(hsa_kernel_dispatch_packet_t), 64);
+  memset(packets, 0, size * sizeof(hsa_kernel_dispatch_packet_t));
+  for (uint32_t i = 0; i < size; ++i) {
+    packets[i].header = HSA_PACKET_TYPE_INVALID << HSA_PACKET_HEADER_TYPE;
+  }
+  queue.base_address = packets;
+  queue.doorbell_signal.handle = doorbell.Handle();
+  queue.size = size;
+  queue.id = id;
+}
+
+CpuQueue::~CpuQueue()
+{
+  alignedFree(queue.base_address);
+}
+
+static uint64_t AlignUp(uint64_t value, uint64_t align)
+{
+  return (value + align - 1) / align * align;
+}
+
+static uint64_t VariableSize(DirectiveVariable var)
+{
+  uint64_t size = getBrigTypeNumBytes(var.elementType());
+  if (var.isArray()) { size *= var.dim(); }
+  return size;
+}
+
+static uint64_t VariableAlign(DirectiveVariable var)
+{
+  if (var.align() == BRIG_ALIGNMENT_NONE) { return align2num(getNaturalAlignment(var.elementType())); }
+  return align2num(var.align());
+}
+
+static void CopyBytes(OperandConstantBytes bytes, char* ptr, uint64_t size)
+{
+  SRef data = bytes.bytes();
+  uint64_t count = (std::min)((uint64_t) bytes.byteCount(), size);
+  for (uint64_t i = 0; i < count; ++i) { ptr[i] = data[i]; }
+}
+
+CpuExecutable::~CpuExecutable()
+{
+  for (void* ptr : storage) { alignedFree(ptr); }
+}
+
+bool CpuExecutable::Load(const std::vector<BrigModule_t>& modules)
+{
+  for (BrigModule_t module : modules) {
+    brigs.push_back(std::unique_ptr<BrigContainer>(new BrigContainer(module)));
+  }
+  // Names are collected first, so that declarations are resolved
+  // regardless of module order.
+  for (const std::unique_ptr<BrigContainer>& brig : brigs) {
+    for (Code c = brig->code().begin(), e = brig->code().end(); c != e; c = c.next()) {
+      if (DirectiveModule m = c) {
+        moduleNames[m.name().str()] = brig.get();
+      } else if (DirectiveExecutable f = c) {
+        if (!f.modifier().isDefinition()) { continue; }
+        std::string name = f.name().str();
+        moduleExecutables[std::make_pair((const BrigContainer*) brig.get(), name)] = f;
+        if (f.linkage() == BRIG_LINKAGE_PROGRAM) { programExecutables[name] = f; }
+      } else if (DirectiveVariable var = c) {
+        if (!var.modifier().isDefinition()) { continue; }
+        if (var.linkage() != BRIG_LINKAGE_PROGRAM && var.linkage() != BRIG_LINKAGE_MODULE) { continue; }
+        std::string name = var.name().str();
+        moduleVariables[std::make_pair((const BrigContainer*) brig.get(), name)] = var;
+        if (var.linkage() == BRIG_LINKAGE_PROGRAM) { programVariables[name] = var; }
+      }
+    }
+  }
+  for (const std::unique_ptr<BrigContainer>& brig : brigs) {
+    ItemKey kernel((const BrigContainer*) 0, 0);
+    uint64_t kernargOffset = 0;
+    for (Code c = brig->code().begin(), e = brig->code().end(); c != e; c = c.next()) {
+      if (DirectiveExecutable f = c) {
+        kernel = Key(f);
+        kernargOffset = 0;
+      } else if (DirectiveVariable var = c) {
+        Allocate(var, kernel, kernargOffset);
+      }
+    }
+  }
+  return true;
+}
+
+void CpuExecutable::Allocate(DirectiveVariable var, ItemKey kernel, uint64_t& kernargOffset)
+{
+  unsigned elementType = var.elementType();
+  if (isOpaqueType(elementType) && elementType != BRIG_TYPE_SIG32 && elementType != BRIG_TYPE_SIG64) {
+    unsupported = "image and sampler variables";
+    return;
+  }
+  bool definition = var.modifier().isDefinition();
+  Variable v;
+  v.segment = (BrigSegment) (unsigned) var.segment();
+  v.size = VariableSize(var);
+  uint64_t align = VariableAlign(var);
+  switch (v.segment) {
+  case BRIG_SEGMENT_GLOBAL:
+  case BRIG_SEGMENT_READONLY:
+  {
+    if (!definition) { return; }
+    char* ptr = (char*) alignedMalloc((size_t) (std::max)(v.size, (uint64_t) 1), (size_t) (std::max)(align, (uint64_t) 16));
+    storage.push_back(ptr);
+    memset(ptr, 0, (size_t) v.size);
+    Initialize(var, ptr, v.size);
+    v.address = (uint64_t) (uintptr_t) ptr;
+    break;
+  }
+  case BRIG_SEGMENT_GROUP:
+    if (!definition) { return; }
+    groupSize = AlignUp(groupSize, align);
+    v.address = groupSize;
+    groupSize += v.size;
+    break;
+  case BRIG_SEGMENT_PRIVATE:
+  case BRIG_SEGMENT_SPILL:
+    if (!definition) { return; }
+    privateSize = AlignUp(privateSize, align);
+    v.address = privateSize;
+    privateSize += v.size;
+    break;
+  case BRIG_SEGMENT_ARG:
+    // Calls are not recursive, so every argument has its own place.
+    argSize = AlignUp(argSize, align);
+    v.address = argSize;
+    argSize += v.size;
+    break;
+  case BRIG_SEGMENT_KERNARG:
+    kernargOffset = AlignUp(kernargOffset, align);
+    v.address = kernargOffset;
+    kernargOffset += v.size;
+    kernargSizes[kernel] = kernargOffset;
+    break;
+  default:
+    return;
+  }
+  variables[Key(var)] = v;
+}
+
+void CpuExecutable::Initialize(DirectiveVariable var, char* ptr, uint64_t size)
+{
+  Operand init = var.init();
+  if (!init) { return; }
+  if (OperandConstantBytes bytes = init) {
+    CopyBytes(bytes, ptr, size);
+    return;
+  }
+  if (OperandConstantOperandList list = init) {
+    uint64_t elementSize = getBrigTypeNumBytes(var.elementType());
+    for (unsigned i = 0; i < list.elementCount(); ++i) {
+      OperandConstantBytes element = list.elements(i);
+      if (!element || (i + 1) * elementSize > size) { unsupported = "variable initializer"; return; }
+      CopyBytes(element, ptr + i * elementSize, elementSize);
+    }
+    return;
+  }
+  unsupported = "variable initializer";
+}
+
+DirectiveKernel CpuExecutable::FindKernel(const std::string& moduleName, const std::string& kernelName) const
+{
+  if (!moduleName.empty()) {
+    auto m = moduleNames.find(moduleName);
+    if (m == moduleNames.end()) { return DirectiveKernel(); }
+    auto k = moduleExecutables.find(std::make_pair(m->second, kernelName));
+    return k != moduleExecutables.end() ? DirectiveKernel(k->second) : DirectiveKernel();
+  }
+  auto k = programExecutables.find(kernelName);
+  if (k != programExecutables.end()) { return k->second; }
+  for (auto e = moduleExecutables.begin(); e != moduleExecutables.end(); ++e) {
+    if (e->first.second == kernelName && DirectiveKernel(e->second)) { return e->second; }
+  }
+  return DirectiveKernel();
+}
+
+DirectiveExecutable CpuExecutable::Definition(DirectiveExecutable e) const
+{
+  if (e.modifier().isDefinition()) { return e; }
+  std::string name = e.name().str();
+  auto m = moduleExecutables.find(std::make_pair((const BrigContainer*) e.container(), name));
+  if (m != moduleExecutables.end()) { return m->second; }
+  auto p = programExecutables.find(name);
+  if (p != programExecutables.end()) { return p->second; }
+  return DirectiveExecutable();
+}
+
+const CpuExecutable::Variable* CpuExecutable::FindVariable(DirectiveVariable var) const
+{
+  auto v = variables.find(Key(var));
+  if (v != variables.end()) { return &v->second; }
+  if (var.modifier().isDefinition()) { return 0; }
+  std::string name = var.name().str();
+  DirectiveVariable def;
+  auto m = moduleVariables.find(std::make_pair((const BrigContainer*) var.container(), name));
+  if (m != moduleVariables.end()) {
+    def = m->second;
+  } else {
+    auto p = programVariables.find(name);
+    if (p == programVariables.end()) { return 0; }
+    def = p->second;
+  }
+  v = variables.find(Key(def));
+  return v != variables.end() ? &v->second : 0;
+}
+
+uint32_t CpuExecutable::KernargSegmentSize(DirectiveKernel kernel) const
+{
+  auto k = kernargSizes.find(Key(kernel));
+  return k != kernargSizes.end() ? (uint32_t) k->second : 0;
+}
+
+namespace {
+
+/// Register value, quad registers use both halves.
+struct Reg {
+  uint64_t lo;
+  uint64_t hi;
+
+  Reg(uint64_t lo_ = 0, uint64_t hi_ = 0)
+    : lo(lo_), hi(hi_) { }
+};
+
+struct Frame {
+  DirectiveExecutable function;
+  Code pc;
+  unsigned end;
+  /// Call instruction in the caller, empty for kernel.
+  InstBr call;
+  std::vector<Reg> regs[4];
+};
+
+enum WorkItemState { WI_RUNNING, WI_BARRIER, WI_DONE };
+
+struct WorkItem {
+  uint32_t id[3];
+  WorkItemState state;
+  std::vector<Frame> frames;
+  std::vector<char> privateSegment;
+  std::vector<char> argSegment;
+  bool waiting;
+  TestClock::time_point waitStart;
+};
+
+enum StepResult { STEP_OK, STEP_BLOCKED, STEP_ERROR };
+
+/// Segment address null value for segments addressed by 32-bit offsets.
+const uint64_t SEGMENT_NULL = 0xFFFFFFFF;
+/// Work-items are switched after this number of instructions, so that
+/// a work-item spinning on memory does not stop others.
+const unsigned QUANTUM = 1024;
+const size_t MAX_CALL_DEPTH = 64;
+
+std::mutex atomicMutex;
+
+bool IsSegmentOffset(unsigned segment)
+{
+  switch (segment) {
+  case BRIG_SEGMENT_GROUP:
+  case BRIG_SEGMENT_PRIVATE:
+  case BRIG_SEGMENT_SPILL:
+  case BRIG_SEGMENT_ARG:
+    return true;
+  default:
+    return false;
+  }
+}
+
+unsigned EntryEnd(DirectiveExecutable f)
+{
+  Code next = f.nextModuleEntry();
+  if (next) { return next.brigOffset(); }
+  return f.container()->code().end().brigOffset();
+}
+
+std::vector<DirectiveVariable> FormalArgs(DirectiveExecutable f)
+{
+  // Formal arguments follow the function, output arguments first.
+  std::vector<DirectiveVariable> args;
+  unsigned count = f.outArgCount() + f.inArgCount();
+  Code c = f.next();
+  for (unsigned i = 0; i < count && c; ++i, c = c.next()) {
+    DirectiveVariable var = c;
+    if (!var) { break; }
+    args.push_back(var);
+  }
+  return args;
+}
+
+Val ToVal(unsigned type, Reg v)
+{
+  if (getBrigTypeNumBits(type) == 128) {
+    TESTGEN::b128_t b;
+    b.set<uint64_t>(v.lo, 0);
+    b.set<uint64_t>(v.hi, 1);
+    return Val(type, b);
+  }
+  return Val(type, v.lo);
+}
+
+Reg FromVal(const Val& v)
+{
+  if (v.getSize() == 128) { return Reg(v.getAsB64(0), v.getAsB64(1)); }
+  if (v.isSignedInt()) { return Reg((uint64_t) v.getAsS64()); }
+  return Reg(v.getAsB64(0));
+}
+
+Reg LoadValue(const char* ptr, unsigned type)
+{
+  unsigned size = getBrigTypeNumBytes(type);
+  Reg v;
+  memcpy(&v.lo, ptr, (std::min)(size, 8u));
+  if (size > 8) { memcpy(&v.hi, ptr + 8, size - 8); }
+  if (isSignedType(type) && size < 8) {
+    unsigned shift = 64 - size * 8;
+    v.lo = (uint64_t) (((int64_t) (v.lo << shift)) >> shift);
+  }
+  return v;
+}
+
+void StoreValue(char* ptr, unsigned type, Reg v)
+{
+  unsigned size = getBrigTypeNumBytes(type);
+  memcpy(ptr, &v.lo, (std::min)(size, 8u));
+  if (size > 8) { memcpy(ptr + 8, &v.hi, size - 8); }
+}
+
+class KernelExecutor {
+public:
+  KernelExecutor(Context* context_, const CpuExecutable* exe_, const CpuDispatchParams& params_)
+    : context(context_), exe(exe_), params(params_), wi(0) { }
+
+  bool Run();
+  const std::string& Unsupported() const { return unsupported; }
+
+private:
+  Context* context;
+  const CpuExecutable* exe;
+  const CpuDispatchParams& params;
+  uint32_t workgroupSize[3];
+  uint32_t groupId[3];
+  uint32_t currentSize[3];
+  std::vector<char> groupSegment;
+  WorkItem* wi;
+  TestClock::time_point start;
+  std::string unsupported;
+
+  bool RunWorkGroup();
+  StepResult Step();
+  StepResult Execute(Inst inst);
+  StepResult Unsupported(Inst inst);
+
+  Reg ReadRegister(OperandRegister reg);
+  void WriteRegister(OperandRegister reg, Reg v);
+  bool ReadScalar(Operand o, Reg& v);
+  bool ReadVal(Operand o, unsigned type, Val& val);
+  bool WriteVal(Operand o, const Val& val);
+  StepResult WriteDst(Inst inst, uint64_t value);
+  bool Dim(Inst inst, unsigned& dim);
+
+  bool Address(OperandAddress addr, unsigned segment, uint64_t& address);
+  char* Memory(unsigned segment, uint64_t address, uint64_t size);
+  char* SegmentBase(unsigned segment, uint64_t& size);
+  bool CopyArg(DirectiveVariable from, DirectiveVariable to);
+
+  StepResult Emulate(Inst inst);
+  StepResult Load(InstMem inst);
+  StepResult Store(InstMem inst);
+  StepResult Lda(InstAddr inst);
+  StepResult Atomic(InstAtomic inst);
+  StepResult Signal(InstSignal inst);
+  StepResult QueueIndex(InstQueue inst);
+  StepResult SegmentConvert(InstSegCvt inst);
+  StepResult Jump(Code target);
+  StepResult Call(InstBr inst);
+  StepResult Return();
+  StepResult SpecialRegister(Inst inst);
+};
+
+bool KernelExecutor::Run()
+{
+  start = TestClock::now();
+  uint32_t groups[3];
+  for (unsigned d = 0; d < 3; ++d) {
+    workgroupSize[d] = params.workgroupSize[d] > 0 ? params.workgroupSize[d] : 1;
+    groups[d] = (params.gridSize[d] + workgroupSize[d] - 1) / workgroupSize[d];
+  }
+  // Work-groups are executed one after another: HSAIL does not guarantee
+  // forward progress of a work-group waiting for another one.
+  for (groupId[2] = 0; groupId[2] < groups[2]; ++groupId[2]) {
+    for (groupId[1] = 0; groupId[1] < groups[1]; ++groupId[1]) {
+      for (groupId[0] = 0; groupId[0] < groups[0]; ++groupId[0]) {
+        if (!RunWorkGroup()) { return false; }
+      }
+    }
+  }
+  return true;
+}
+
+bool KernelExecutor::RunWorkGroup()
+{
+  for (unsigned d = 0; d < 3; ++d) {
+    currentSize[d] = (std::min)(workgroupSize[d], params.gridSize[d] - groupId[d] * workgroupSize[d]);
+  }
+  groupSegment.assign((std::max)(params.groupSegmentSize, (uint32_t) 1), 0);
+  std::vector<WorkItem> items(currentSize[0] * currentSize[1] * currentSize[2]);
+  size_t i = 0;
+  for (uint32_t z = 0; z < currentSize[2]; ++z) {
+    for (uint32_t y = 0; y < currentSize[1]; ++y) {
+      for (uint32_t x = 0; x < currentSize[0]; ++x, ++i) {
+        WorkItem& w = items[i];
+        w.id[0] = x; w.id[1] = y; w.id[2] = z;
+        w.state = WI_RUNNING;
+        w.waiting = false;
+        w.privateSegment.assign((std::max)(exe->PrivateSegmentSize(), (uint32_t) 1), 0);
+        w.argSegment.assign((std::max)(exe->ArgSegmentSize(), (uint32_t) 1), 0);
+        Frame frame;
+        frame.function = params.kernel;
+        frame.pc = params.kernel.next();
+        frame.end = EntryEnd(params.kernel);
+        w.frames.push_back(frame);
+      }
+    }
+  }
+  for (;;) {
+    bool progress = false;
+    size_t atBarrier = 0, done = 0;
+    for (WorkItem& w : items) {
+      wi = &w;
+      for (unsigned n = 0; n < QUANTUM && w.state == WI_RUNNING; ++n) {
+        StepResult result = Step();
+        if (result == STEP_ERROR) { return false; }
+        if (result == STEP_BLOCKED) { break; }
+        progress = true;
+      }
+      if (w.state == WI_BARRIER) { atBarrier++; }
+      if (w.state == WI_DONE) { done++; }
+    }
+    if (done == items.size()) { return true; }
+    if (atBarrier + done == items.size()) {
+      if (done > 0) {
+        context->Error() << "Barrier is not reached by all work-items of work-group" << std::endl;
+        return false;
+      }
+      for (WorkItem& w : items) { w.state = WI_RUNNING; }
+      continue;
+    }
+    double elapsed = ElapsedSeconds(start);
+    if (elapsed > params.timeout) {
+      context->Error() << "Kernel execution timed out, elapsed time: " << elapsed << "s" << std::endl;
+      return false;
+    }
+    if (!progress) { std::this_thread::yield(); }
+  }
+}
+
+StepResult KernelExecutor::Step()
+{
+  Frame& f = wi->frames.back();
+  if (f.pc.brigOffset() >= f.end) { return Return(); }
+  Code c = f.pc;
+  f.pc = c.next();
+  Inst inst = c;
+  // Labels, argument scopes and variables need no execution.
+  if (!inst) { return STEP_OK; }
+  StepResult result = Execute(inst);
+  if (result == STEP_BLOCKED) { wi->frames.back().pc = c; }
+  return result;
+}
+
+StepResult KernelExecutor::Unsupported(Inst inst)
+{
+  std::ostringstream ss;
+  ss << "instruction with opcode " << inst.opcode();
+  unsupported = ss.str();
+  return STEP_ERROR;
+}
+
+StepResult KernelExecutor::Execute(Inst inst)
+{
+  switch (inst.opcode()) {
+  case BRIG_OPCODE_NOP:
+  case BRIG_OPCODE_WAVEBARRIER:
+    return STEP_OK;
+  case BRIG_OPCODE_MEMFENCE:
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return STEP_OK;
+  case BRIG_OPCODE_BARRIER:
+    wi->state = WI_BARRIER;
+    return STEP_OK;
+  case BRIG_OPCODE_LD:
+    return Load(inst);
+  case BRIG_OPCODE_ST:
+    return Store(inst);
+  case BRIG_OPCODE_LDA:
+    return Lda(inst);
+  case BRIG_OPCODE_ATOMIC:
+  case BRIG_OPCODE_ATOMICNORET:
+    return Atomic(inst);
+  case BRIG_OPCODE_SIGNAL:
+  case BRIG_OPCODE_SIGNALNORET:
+    return Signal(inst);
+  case BRIG_OPCODE_LDQUEUEREADINDEX:
+  case BRIG_OPCODE_LDQUEUEWRITEINDEX:
+  case BRIG_OPCODE_ADDQUEUEWRITEINDEX:
+  case BRIG_OPCODE_CASQUEUEWRITEINDEX:
+  case BRIG_OPCODE_STQUEUEREADINDEX:
+  case BRIG_OPCODE_STQUEUEWRITEINDEX:
+    return QueueIndex(inst);
+  case BRIG_OPCODE_STOF:
+  case BRIG_OPCODE_FTOS:
+  case BRIG_OPCODE_SEGMENTP:
+    return SegmentConvert(inst);
+  case BRIG_OPCODE_NULLPTR:
+  {
+    InstSeg seg = inst;
+    return WriteDst(inst, IsSegmentOffset(seg.segment()) ? SEGMENT_NULL : 0);
+  }
+  case BRIG_OPCODE_BR:
+  {
+    OperandCodeRef target = inst.operand(0);
+    if (!target) { return Unsupported(inst); }
+    return Jump(target.ref());
+  }
+  case BRIG_OPCODE_CBR:
+  {
+    Reg cond;
+    OperandCodeRef target = inst.operand(1);
+    if (!ReadScalar(inst.operand(0), cond) || !target) { return Unsupported(inst); }
+    return (cond.lo & 1) ? Jump(target.ref()) : STEP_OK;
+  }
+  case BRIG_OPCODE_SBR:
+  {
+    Reg index;
+    OperandCodeList labels = inst.operand(1);
+    if (!ReadScalar(inst.operand(0), index) || !labels) { return Unsupported(inst); }
+    if (index.lo >= labels.elementCount()) {
+      context->Error() << "sbr index " << index.lo << " is out of range" << std::endl;
+      return STEP_ERROR;
+    }
+    return Jump(labels.elements((unsigned) index.lo));
+  }
+  case BRIG_OPCODE_CALL:
+    return Call(inst);
+  case BRIG_OPCODE_RET:
+    return Return();
+  case BRIG_OPCODE_WORKITEMABSID:
+  case BRIG_OPCODE_WORKITEMID:
+  case BRIG_OPCODE_WORKGROUPID:
+  case BRIG_OPCODE_WORKGROUPSIZE:
+  case BRIG_OPCODE_CURRENTWORKGROUPSIZE:
+  case BRIG_OPCODE_GRIDSIZE:
+  case BRIG_OPCODE_GRIDGROUPS:
+  case BRIG_OPCODE_DIM:
+  case BRIG_OPCODE_WORKITEMFLATID:
+  case BRIG_OPCODE_CURRENTWORKITEMFLATID:
+  case BRIG_OPCODE_WORKITEMFLATABSID:
+  case BRIG_OPCODE_WAVEID:
+  case BRIG_OPCODE_MAXWAVEID:
+  case BRIG_OPCODE_LANEID:
+  case BRIG_OPCODE_CUID:
+  case BRIG_OPCODE_MAXCUID:
+  case BRIG_OPCODE_CLOCK:
+  case BRIG_OPCODE_PACKETID:
+  case BRIG_OPCODE_PACKETCOMPLETIONSIG:
+  case BRIG_OPCODE_KERNARGBASEPTR:
+  case BRIG_OPCODE_GROUPBASEPTR:
+  case BRIG_OPCODE_ACTIVELANEID:
+  case BRIG_OPCODE_ACTIVELANECOUNT:
+  case BRIG_OPCODE_ACTIVELANEMASK:
+    return SpecialRegister(inst);
+  default:
+    return Emulate(inst);
+  }
+}
+
+Reg KernelExecutor::ReadRegister(OperandRegister reg)
+{
+  std::vector<Reg>& regs = wi->frames.back().regs[reg.regKind() & 3];
+  unsigned n = reg.regNum();
+  return n < regs.size() ? regs[n] : Reg();
+}
+
+void KernelExecutor::WriteRegister(OperandRegister reg, Reg v)
+{
+  unsigned kind = reg.regKind();
+  switch (kind) {
+  case BRIG_REGISTER_KIND_CONTROL: v.lo &= 1; v.hi = 0; break;
+  case BRIG_REGISTER_KIND_SINGLE: v.lo &= 0xFFFFFFFF; v.hi = 0; break;
+  case BRIG_REGISTER_KIND_DOUBLE: v.hi = 0; break;
+  default: break;
+  }
+  std::vector<Reg>& regs = wi->frames.back().regs[kind & 3];
+  unsigned n = reg.regNum();
+  if (n >= regs.size()) { regs.resize(n + 1); }
+  regs[n] = v;
+}
+
+bool KernelExecutor::ReadScalar(Operand o, Reg& v)
+{
+  if (OperandRegister reg = o) {
+    v = ReadRegister(reg);
+    return true;
+  }
+  if (OperandConstantBytes bytes = o) {
+    char data[16];
+    memset(data, 0, sizeof(data));
+    CopyBytes(bytes, data, sizeof(data));
+    memcpy(&v.lo, data, 8);
+    memcpy(&v.hi, data + 8, 8);
+    return true;
+  }
+  if (OperandWavesize(o)) {
+    v = Reg(CPU_WAVESIZE);
+    return true;
+  }
+  return false;
+}
+
+bool KernelExecutor::ReadVal(Operand o, unsigned type, Val& val)
+{
+  if (OperandOperandList list = o) {
+    Val e[4];
+    unsigned count = list.elementCount();
+    if (count > 4) { return false; }
+    for (unsigned i = 0; i < count; ++i) {
+      Reg v;
+      if (!ReadScalar(list.elements(i), v)) { return false; }
+      e[i] = ToVal(type, v);
+    }
+    val = Val(count, e[0], e[1], e[2], e[3]);
+    return true;
+  }
+  Reg v;
+  if (!ReadScalar(o, v)) { return false; }
+  val = ToVal(type, v);
+  return true;
+}
+
+bool KernelExecutor::WriteVal(Operand o, const Val& val)
+{
+  if (OperandRegister reg = o) {
+    WriteRegister(reg, FromVal(val));
+    return true;
+  }
+  if (OperandOperandList list = o) {
+    if (!val.isVector() || val.getDim() != list.elementCount()) { return false; }
+    for (unsigned i = 0; i < list.elementCount(); ++i) {
+      OperandRegister reg = list.elements(i);
+      if (!reg) { return false; }
+      WriteRegister(reg, FromVal(val[i]));
+    }
+    return true;
+  }
+  return false;
+}
+
+StepResult KernelExecutor::WriteDst(Inst inst, uint64_t value)
+{
+  OperandRegister dst = inst.operand(0);
+  if (!dst) { return Unsupported(inst); }
+  WriteRegister(dst, Reg(value));
+  return STEP_OK;
+}
+
+bool KernelExecutor::Dim(Inst inst, unsigned& dim)
+{
+  Reg v;
+  if (inst.operands().size() < 2 || !ReadScalar(inst.operand(1), v)) { return false; }
+  dim = (unsigned) v.lo;
+  if (dim > 2) {
+    context->Error() << "Invalid dimension " << dim << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool KernelExecutor::Address(OperandAddress addr, unsigned segment, uint64_t& address)
+{
+  address = 0;
+  if (DirectiveVariable var = addr.symbol()) {
+    const CpuExecutable::Variable* v = exe->FindVariable(var);
+    if (!v) {
+      context->Error() << "Variable " << var.name().str() << " is not defined" << std::endl;
+      return false;
+    }
+    address = v->address;
+    if (v->segment == BRIG_SEGMENT_KERNARG) { address += (uint64_t) (uintptr_t) params.kernarg; }
+  }
+  if (OperandRegister reg = addr.reg()) { address += ReadRegister(reg).lo; }
+  address += (uint64_t) addr.offset();
+  if (IsSegmentOffset(segment)) { address &= 0xFFFFFFFF; }
+  return true;
+}
+
+char* KernelExecutor::SegmentBase(unsigned segment, uint64_t& size)
+{
+  std::vector<char>* block;
+  switch (segment) {
+  case BRIG_SEGMENT_GROUP: block = &groupSegment; break;
+  case BRIG_SEGMENT_PRIVATE:
+  case BRIG_SEGMENT_SPILL: block = &wi->privateSegment; break;
+  case BRIG_SEGMENT_ARG: block = &wi->argSegment; break;
+  default: size = 0; return 0;
+  }
+  size = block->size();
+  return block->data();
+}
+
+char* KernelExecutor::Memory(unsigned segment, uint64_t address, uint64_t size)
+{
+  if (!IsSegmentOffset(segment)) {
+    // Global, readonly, kernarg and flat addresses are host addresses.
+    if (address == 0) {
+      context->Error() << "Access to null address in " << segment2str(segment) << " segment" << std::endl;
+      return 0;
+    }
+    return (char*) (uintptr_t) address;
+  }
+  uint64_t segmentSize;
+  char* base = SegmentBase(segment, segmentSize);
+  if (address + size > segmentSize) {
+    context->Error() << "Access to " << segment2str(segment) << " segment address " << address << " is out of bounds" << std::endl;
+    return 0;
+  }
+  return base + address;
+}
+
+bool KernelExecutor::CopyArg(DirectiveVariable from, DirectiveVariable to)
+{
+  const CpuExecutable::Variable* src = from ? exe->FindVariable(from) : 0;
+  const CpuExecutable::Variable* dst = to ? exe->FindVariable(to) : 0;
+  if (!src || !dst) {
+    context->Error() << "Invalid call argument" << std::endl;
+    return false;
+  }
+  uint64_t size = (std::min)(src->size, dst->size);
+  char* s = Memory(BRIG_SEGMENT_ARG, src->address, size);
+  char* d = Memory(BRIG_SEGMENT_ARG, dst->address, size);
+  if (!s || !d) { return false; }
+  memmove(d, s, (size_t) size);
+  return true;
+}
+
+StepResult KernelExecutor::Emulate(Inst inst)
+{
+  unsigned count = inst.operands().size();
+  if (count == 0 || count > 5) { return Unsupported(inst); }
+  const auto& extMgr = TESTGEN::InstSetManager::getExtMgr();
+  // Operand 0 is destination.
+  Val args[5];
+  for (unsigned i = 1; i < count; ++i) {
+    unsigned type = extMgr.getOperandType(inst, i, params.model, params.profile);
+    if (type == BRIG_TYPE_NONE || !ReadVal(inst.operand(i), type, args[i])) { return Unsupported(inst); }
+  }
+  Val dst = TESTGEN::emulateDstVal(inst, args[0], args[1], args[2], args[3], args[4]);
+  if (dst.empty()) { return Unsupported(inst); }
+  unsigned packing = getPacking(inst);
+  if (packing != BRIG_PACK_NONE && getPackedDstDim(inst.type(), packing) == 1) {
+    // Only the lowest element is written, emulator fills the rest with
+    // a fixed value.
+    OperandRegister reg = inst.operand(0);
+    if (!reg) { return Unsupported(inst); }
+    Reg old = ReadRegister(reg), v = FromVal(dst);
+    unsigned bits = getBrigTypeNumBits(packedType2elementType(inst.type()));
+    uint64_t mask = bits < 64 ? (1ULL << bits) - 1 : ~0ULL;
+    WriteRegister(reg, Reg((old.lo & ~mask) | (v.lo & mask), old.hi));
+    return STEP_OK;
+  }
+  if (!WriteVal(inst.operand(0), dst)) { return Unsupported(inst); }
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::Load(InstMem inst)
+{
+  unsigned type = inst.type();
+  unsigned size = getBrigTypeNumBytes(type);
+  OperandAddress addr = inst.operand(1);
+  uint64_t address;
+  if (!addr) { return Unsupported(inst); }
+  if (!Address(addr, inst.segment(), address)) { return STEP_ERROR; }
+  Operand dst = inst.operand(0);
+  OperandOperandList list = dst;
+  unsigned count = list ? list.elementCount() : 1;
+  char* ptr = Memory(inst.segment(), address, (uint64_t) size * count);
+  if (!ptr) { return STEP_ERROR; }
+  for (unsigned i = 0; i < count; ++i) {
+    OperandRegister reg = list ? list.elements(i) : dst;
+    if (!reg) { return Unsupported(inst); }
+    WriteRegister(reg, LoadValue(ptr + i * size, type));
+  }
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::Store(InstMem inst)
+{
+  unsigned type = inst.type();
+  unsigned size = getBrigTypeNumBytes(type);
+  OperandAddress addr = inst.operand(1);
+  uint64_t address;
+  if (!addr) { return Unsupported(inst); }
+  if (!Address(addr, inst.segment(), address)) { return STEP_ERROR; }
+  Operand src = inst.operand(0);
+  OperandOperandList list = src;
+  unsigned count = list ? list.elementCount() : 1;
+  char* ptr = Memory(inst.segment(), address, (uint64_t) size * count);
+  if (!ptr) { return STEP_ERROR; }
+  for (unsigned i = 0; i < count; ++i) {
+    Reg v;
+    if (!ReadScalar(list ? list.elements(i) : src, v)) { return Unsupported(inst); }
+    StoreValue(ptr + i * size, type, v);
+  }
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::Lda(InstAddr inst)
+{
+  OperandAddress addr = inst.operand(1);
+  uint64_t address;
+  if (!addr) { return Unsupported(inst); }
+  if (!Address(addr, inst.segment(), address)) { return STEP_ERROR; }
+  return WriteDst(inst, address);
+}
+
+StepResult KernelExecutor::Atomic(InstAtomic inst)
+{
+  unsigned type = inst.type();
+  bool ret = inst.opcode() == BRIG_OPCODE_ATOMIC;
+  unsigned a = ret ? 1 : 0;
+  OperandAddress addr = inst.operand(a);
+  uint64_t address;
+  if (!addr) { return Unsupported(inst); }
+  if (!Address(addr, inst.segment(), address)) { return STEP_ERROR; }
+  char* ptr = Memory(inst.segment(), address, getBrigTypeNumBytes(type));
+  if (!ptr) { return STEP_ERROR; }
+  Val src[2];
+  for (unsigned i = 0; i < 2 && a + 1 + i < inst.operands().size(); ++i) {
+    Operand o = inst.operand(a + 1 + i);
+    if (!o) { break; }
+    if (!ReadVal(o, type, src[i])) { return Unsupported(inst); }
+  }
+  Val old;
+  {
+    std::lock_guard<std::mutex> lock(atomicMutex);
+    old = ToVal(type, LoadValue(ptr, type));
+    Val result = ret ?
+      TESTGEN::emulateMemVal(inst, Val(), old, src[0], src[1], Val()) :
+      TESTGEN::emulateMemVal(inst, old, src[0], src[1], Val(), Val());
+    if (result.empty()) { return Unsupported(inst); }
+    if (inst.atomicOperation() != BRIG_ATOMIC_LD) { StoreValue(ptr, type, FromVal(result)); }
+  }
+  if (ret && !WriteVal(inst.operand(0), old)) { return Unsupported(inst); }
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::Signal(InstSignal inst)
+{
+  unsigned type = inst.type();
+  bool ret = inst.opcode() == BRIG_OPCODE_SIGNAL;
+  unsigned s = ret ? 1 : 0;
+  Reg handle;
+  if (!ReadScalar(inst.operand(s), handle)) { return Unsupported(inst); }
+  CpuSignal* signal = CpuSignal::FromHandle(handle.lo);
+  if (!signal) {
+    context->Error() << "Signal operation on null signal" << std::endl;
+    return STEP_ERROR;
+  }
+  int64_t src[2] = { 0, 0 };
+  for (unsigned i = 0; i < 2 && s + 1 + i < inst.operands().size(); ++i) {
+    Reg v;
+    Operand o = inst.operand(s + 1 + i);
+    if (!o) { break; }
+    if (!ReadScalar(o, v)) { return Unsupported(inst); }
+    src[i] = (int64_t) FromVal(ToVal(type, v)).lo;
+  }
+  int64_t old = 0;
+  unsigned op = inst.signalOperation();
+  switch (op) {
+  case BRIG_ATOMIC_LD: old = signal->value.load(); break;
+  case BRIG_ATOMIC_ST: signal->value.store(src[0]); break;
+  case BRIG_ATOMIC_ADD: old = signal->value.fetch_add(src[0]); break;
+  case BRIG_ATOMIC_SUB: old = signal->value.fetch_sub(src[0]); break;
+  case BRIG_ATOMIC_AND: old = signal->value.fetch_and(src[0]); break;
+  case BRIG_ATOMIC_OR: old = signal->value.fetch_or(src[0]); break;
+  case BRIG_ATOMIC_XOR: old = signal->value.fetch_xor(src[0]); break;
+  case BRIG_ATOMIC_EXCH: old = signal->value.exchange(src[0]); break;
+  case BRIG_ATOMIC_CAS:
+    old = src[0];
+    signal->value.compare_exchange_strong(old, src[1]);
+    break;
+  case BRIG_ATOMIC_WAIT_EQ:
+  case BRIG_ATOMIC_WAIT_NE:
+  case BRIG_ATOMIC_WAIT_LT:
+  case BRIG_ATOMIC_WAIT_GTE:
+  case BRIG_ATOMIC_WAITTIMEOUT_EQ:
+  case BRIG_ATOMIC_WAITTIMEOUT_NE:
+  case BRIG_ATOMIC_WAITTIMEOUT_LT:
+  case BRIG_ATOMIC_WAITTIMEOUT_GTE:
+  {
+    old = signal->value.load();
+    bool satisfied;
+    switch (op) {
+    case BRIG_ATOMIC_WAIT_EQ: case BRIG_ATOMIC_WAITTIMEOUT_EQ: satisfied = old == src[0]; break;
+    case BRIG_ATOMIC_WAIT_NE: case BRIG_ATOMIC_WAITTIMEOUT_NE: satisfied = old != src[0]; break;
+    case BRIG_ATOMIC_WAIT_LT: case BRIG_ATOMIC_WAITTIMEOUT_LT: satisfied = old < src[0]; break;
+    default: satisfied = old >= src[0]; break;
+    }
+    if (!satisfied) {
+      if (!wi->waiting) { wi->waiting = true; wi->waitStart = TestClock::now(); }
+      // Timeout is measured in nanoseconds, same as clock.
+      bool timeout = op == BRIG_ATOMIC_WAITTIMEOUT_EQ || op == BRIG_ATOMIC_WAITTIMEOUT_NE ||
+                     op == BRIG_ATOMIC_WAITTIMEOUT_LT || op == BRIG_ATOMIC_WAITTIMEOUT_GTE;
+      if (!timeout || ElapsedSeconds(wi->waitStart) * 1e9 < (double) (uint64_t) src[1]) { return STEP_BLOCKED; }
+    }
+    wi->waiting = false;
+    break;
+  }
+  default:
+    return Unsupported(inst);
+  }
+  if (ret && !WriteVal(inst.operand(0), ToVal(type, Reg((uint64_t) old)))) { return Unsupported(inst); }
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::QueueIndex(InstQueue inst)
+{
+  unsigned opcode = inst.opcode();
+  bool store = opcode == BRIG_OPCODE_STQUEUEREADINDEX || opcode == BRIG_OPCODE_STQUEUEWRITEINDEX;
+  unsigned a = store ? 0 : 1;
+  OperandAddress addr = inst.operand(a);
+  uint64_t address;
+  if (!addr) { return Unsupported(inst); }
+  if (!Address(addr, inst.segment(), address)) { return STEP_ERROR; }
+  if (address == 0) {
+    context->Error() << "Queue operation on null queue" << std::endl;
+    return STEP_ERROR;
+  }
+  CpuQueue* queue = CpuQueue::FromAddress(address);
+  Reg src[2];
+  for (unsigned i = 0; i < 2 && a + 1 + i < inst.operands().size(); ++i) {
+    if (!ReadScalar(inst.operand(a + 1 + i), src[i])) { return Unsupported(inst); }
+  }
+  uint64_t result = 0;
+  switch (opcode) {
+  case BRIG_OPCODE_LDQUEUEREADINDEX: result = queue->readIndex.load(); break;
+  case BRIG_OPCODE_LDQUEUEWRITEINDEX: result = queue->writeIndex.load(); break;
+  case BRIG_OPCODE_ADDQUEUEWRITEINDEX: result = queue->writeIndex.fetch_add(src[0].lo); break;
+  case BRIG_OPCODE_CASQUEUEWRITEINDEX:
+    result = src[0].lo;
+    queue->writeIndex.compare_exchange_strong(result, src[1].lo);
+    break;
+  case BRIG_OPCODE_STQUEUEREADINDEX: queue->readIndex.store(src[0].lo); break;
+  case BRIG_OPCODE_STQUEUEWRITEINDEX: queue->writeIndex.store(src[0].lo); break;
+  default: return Unsupported(inst);
+  }
+  return store ? STEP_OK : WriteDst(inst, result);
+}
+
+StepResult KernelExecutor::SegmentConvert(InstSegCvt inst)
+{
+  Reg src;
+  if (!ReadScalar(inst.operand(1), src)) { return Unsupported(inst); }
+  unsigned segment = inst.segment();
+  bool noNull = inst.modifier().isNoNull();
+  uint64_t size;
+  uint64_t base = (uint64_t) (uintptr_t) SegmentBase(segment, size);
+  switch (inst.opcode()) {
+  case BRIG_OPCODE_STOF:
+    if (!IsSegmentOffset(segment)) { return WriteDst(inst, src.lo); }
+    src.lo &= 0xFFFFFFFF;
+    return WriteDst(inst, (!noNull && src.lo == SEGMENT_NULL) ? 0 : base + src.lo);
+  case BRIG_OPCODE_FTOS:
+    if (!IsSegmentOffset(segment)) { return WriteDst(inst, src.lo); }
+    return WriteDst(inst, (!noNull && src.lo == 0) ? SEGMENT_NULL : src.lo - base);
+  case BRIG_OPCODE_SEGMENTP:
+  {
+    if (!noNull && src.lo == 0) { return WriteDst(inst, 1); }
+    if (IsSegmentOffset(segment)) { return WriteDst(inst, src.lo >= base && src.lo < base + size); }
+    // Global segment is everything which is not group or private.
+    uint64_t groupSize, privateSize;
+    uint64_t group = (uint64_t) (uintptr_t) SegmentBase(BRIG_SEGMENT_GROUP, groupSize);
+    uint64_t priv = (uint64_t) (uintptr_t) SegmentBase(BRIG_SEGMENT_PRIVATE, privateSize);
+    bool inGroup = src.lo >= group && src.lo < group + groupSize;
+    bool inPrivate = src.lo >= priv && src.lo < priv + privateSize;
+    return WriteDst(inst, !inGroup && !inPrivate);
+  }
+  default:
+    return Unsupported(inst);
+  }
+}
+
+StepResult KernelExecutor::Jump(Code target)
+{
+  if (!target) {
+    context->Error() << "Invalid branch target" << std::endl;
+    return STEP_ERROR;
+  }
+  wi->frames.back().pc = target;
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::Call(InstBr inst)
+{
+  OperandCodeList outArgs = inst.operand(0);
+  OperandCodeRef target = inst.operand(1);
+  OperandCodeList inArgs = inst.operand(2);
+  if (!outArgs || !target || !inArgs) { return Unsupported(inst); }
+  DirectiveExecutable callee = exe->Definition(DirectiveExecutable(target.ref()));
+  if (!callee) {
+    context->Error() << "Called function is not defined" << std::endl;
+    return STEP_ERROR;
+  }
+  if (wi->frames.size() >= MAX_CALL_DEPTH) {
+    context->Error() << "Call depth exceeds " << MAX_CALL_DEPTH << std::endl;
+    return STEP_ERROR;
+  }
+  std::vector<DirectiveVariable> formals = FormalArgs(callee);
+  if (formals.size() != outArgs.elementCount() + inArgs.elementCount()) { return Unsupported(inst); }
+  for (unsigned i = 0; i < inArgs.elementCount(); ++i) {
+    if (!CopyArg(inArgs.elements(i), formals[outArgs.elementCount() + i])) { return STEP_ERROR; }
+  }
+  Frame frame;
+  frame.function = callee;
+  frame.pc = callee.next();
+  frame.end = EntryEnd(callee);
+  frame.call = inst;
+  wi->frames.push_back(frame);
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::Return()
+{
+  InstBr call = wi->frames.back().call;
+  if (!call) {
+    wi->frames.pop_back();
+    wi->state = WI_DONE;
+    return STEP_OK;
+  }
+  std::vector<DirectiveVariable> formals = FormalArgs(wi->frames.back().function);
+  OperandCodeList outArgs = call.operand(0);
+  for (unsigned i = 0; i < outArgs.elementCount(); ++i) {
+    if (i >= formals.size() || !CopyArg(formals[i], outArgs.elements(i))) { return STEP_ERROR; }
+  }
+  wi->frames.pop_back();
+  return STEP_OK;
+}
+
+StepResult KernelExecutor::SpecialRegister(Inst inst)
+{
+  const uint32_t* id = wi->id;
+  uint64_t absId[3];
+  for (unsigned d = 0; d < 3; ++d) { absId[d] = (uint64_t) groupId[d] * workgroupSize[d] + id[d]; }
+  uint64_t flatId = id[0] + id[1] * workgroupSize[0] + id[2] * workgroupSize[0] * workgroupSize[1];
+  unsigned dim = 0;
+  switch (inst.opcode()) {
+  case BRIG_OPCODE_WORKITEMABSID:
+  case BRIG_OPCODE_WORKITEMID:
+  case BRIG_OPCODE_WORKGROUPID:
+  case BRIG_OPCODE_WORKGROUPSIZE:
+  case BRIG_OPCODE_CURRENTWORKGROUPSIZE:
+  case BRIG_OPCODE_GRIDSIZE:
+  case BRIG_OPCODE_GRIDGROUPS:
+    if (!Dim(inst, dim)) { return Unsupported(inst); }
+    break;
+  default:
+    break;
+  }
+  switch (inst.opcode()) {
+  case BRIG_OPCODE_WORKITEMABSID: return WriteDst(inst, absId[dim]);
+  case BRIG_OPCODE_WORKITEMID: return WriteDst(inst, id[dim]);
+  case BRIG_OPCODE_WORKGROUPID: return WriteDst(inst, groupId[dim]);
+  case BRIG_OPCODE_WORKGROUPSIZE: return WriteDst(inst, workgroupSize[dim]);
+  case BRIG_OPCODE_CURRENTWORKGROUPSIZE: return WriteDst(inst, currentSize[dim]);
+  case BRIG_OPCODE_GRIDSIZE: return WriteDst(inst, params.gridSize[dim]);
+  case BRIG_OPCODE_GRIDGROUPS: return WriteDst(inst, (params.gridSize[dim] + workgroupSize[dim] - 1) / workgroupSize[dim]);
+  case BRIG_OPCODE_DIM: return WriteDst(inst, params.dimensions);
+  case BRIG_OPCODE_WORKITEMFLATID: return WriteDst(inst, flatId);
+  case BRIG_OPCODE_CURRENTWORKITEMFLATID:
+    return WriteDst(inst, id[0] + id[1] * currentSize[0] + id[2] * currentSize[0] * currentSize[1]);
+  case BRIG_OPCODE_WORKITEMFLATABSID:
+    return WriteDst(inst, absId[0] + absId[1] * params.gridSize[0] + absId[2] * params.gridSize[0] * params.gridSize[1]);
+  case BRIG_OPCODE_WAVEID: return WriteDst(inst, flatId / CPU_WAVESIZE);
+  case BRIG_OPCODE_MAXWAVEID: return WriteDst(inst, CPU_MAX_WORKGROUP_SIZE / CPU_WAVESIZE - 1);
+  case BRIG_OPCODE_LANEID: return WriteDst(inst, flatId % CPU_WAVESIZE);
+  case BRIG_OPCODE_CUID: return WriteDst(inst, 0);
+  case BRIG_OPCODE_MAXCUID: return WriteDst(inst, 0);
+  case BRIG_OPCODE_CLOCK:
+    return WriteDst(inst, std::chrono::duration_cast<std::chrono::nanoseconds>(TestClock::now().time_since_epoch()).count());
+  case BRIG_OPCODE_PACKETID: return WriteDst(inst, params.packetId);
+  case BRIG_OPCODE_PACKETCOMPLETIONSIG: return WriteDst(inst, params.completionSignal);
+  case BRIG_OPCODE_KERNARGBASEPTR: return WriteDst(inst, (uint64_t) (uintptr_t) params.kernarg);
+  case BRIG_OPCODE_GROUPBASEPTR: return WriteDst(inst, 0);
+  case BRIG_OPCODE_ACTIVELANEID: return WriteDst(inst, 0);
+  case BRIG_OPCODE_ACTIVELANECOUNT:
+  case BRIG_OPCODE_ACTIVELANEMASK:
+  {
+    // The only lane is active if its predicate is set.
+    Reg pred;
+    if (!ReadScalar(inst.operand(1), pred)) { return Unsupported(inst); }
+    if (inst.opcode() == BRIG_OPCODE_ACTIVELANECOUNT) { return WriteDst(inst, pred.lo & 1); }
+    OperandOperandList mask = inst.operand(0);
+    if (!mask) { return Unsupported(inst); }
+    for (unsigned i = 0; i < mask.elementCount(); ++i) {
+      OperandRegister reg = mask.elements(i);
+      if (!reg) { return Unsupported(inst); }
+      WriteRegister(reg, Reg(i == 0 ? (pred.lo & 1) : 0));
+    }
+    return STEP_OK;
+  }
+  default:
+    return Unsupported(inst);
+  }
+}
+
+}
+
+bool ExecuteKernel(Context* context, const CpuExecutable* executable, const CpuDispatchParams& params, std::string& unsupported)
+{
+  KernelExecutor executor(context, executable, params);
+  bool result = executor.Run();
+  unsupported = executor.Unsupported();
+  return result;
+}
+
+}
+
+}
@@ -0,0 +1,144 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_CPU_EXECUTOR_HPP
+#define HEXL_CPU_EXECUTOR_HPP
+
+#include "HexlContext.hpp"
+#include "hsa.h"
+#include "HSAILBrigContainer.h"
+#include "HSAILItems.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hexl {
+
+namespace cpu_runtime {
+
+/// Signal handle is the address of CpuSignal, so that kernels and host
+/// threads operate on the same value.
+class CpuSignal {
+public:
+  std::atomic<int64_t> value;
+
+  explicit CpuSignal(int64_t value_ = 0)
+    : value(value_) { }
+
+  uint64_t Handle() { return (uint64_t) (uintptr_t) this; }
+  static CpuSignal* FromHandle(uint64_t handle) { return reinterpret_cast<CpuSignal*>((uintptr_t) handle); }
+};
+
+/// User mode queue. Kernels access queue indices through queue address,
+/// so hsa_queue_t must be the first member.
+class CpuQueue {
+public:
+  hsa_queue_t queue;
+  std::atomic<uint64_t> readIndex;
+  std::atomic<uint64_t> writeIndex;
+  CpuSignal doorbell;
+
+  CpuQueue(uint32_t size, uint64_t id);
+  ~CpuQueue();
+
+  hsa_queue_t* Queue() { return &queue; }
+  static CpuQueue* FromAddress(uint64_t address) { return reinterpret_cast<CpuQueue*>((uintptr_t) address); }
+};
+
+/// Loaded BRIG modules: storage of variables and lookup of symbols.
+class CpuExecutable {
+public:
+  struct Variable {
+    BrigSegment segment;
+    /// Host address for global and readonly variables, offset in the
+    /// segment otherwise.
+    uint64_t address;
+    uint64_t size;
+  };
+
+  explicit CpuExecutable(Context* context_)
+    : context(context_), groupSize(0), privateSize(0), argSize(0) { }
+  ~CpuExecutable();
+
+  bool Load(const std::vector<BrigModule_t>& modules);
+
+  /// Kernel with given name (including '&'). Module linkage kernel is
+  /// searched in the module with given name if it is not empty.
+  HSAIL_ASM::DirectiveKernel FindKernel(const std::string& moduleName, const std::string& kernelName) const;
+  /// Definition of kernel or function, which may be in another module.
+  HSAIL_ASM::DirectiveExecutable Definition(HSAIL_ASM::DirectiveExecutable e) const;
+  const Variable* FindVariable(HSAIL_ASM::DirectiveVariable var) const;
+
+  uint32_t GroupSegmentSize() const { return (uint32_t) groupSize; }
+  uint32_t PrivateSegmentSize() const { return (uint32_t) privateSize; }
+  uint32_t ArgSegmentSize() const { return (uint32_t) argSize; }
+  uint32_t KernargSegmentSize(HSAIL_ASM::DirectiveKernel kernel) const;
+
+  /// Reason why modules cannot be executed (empty if they can).
+  const std::string& Unsupported() const { return unsupported; }
+
+private:
+  typedef std::pair<const HSAIL_ASM::BrigContainer*, unsigned> ItemKey;
+  template <typename T>
+  static ItemKey Key(T item) { return ItemKey(item.container(), item.brigOffset()); }
+
+  Context* context;
+  std::vector<std::unique_ptr<HSAIL_ASM::BrigContainer>> brigs;
+  std::map<ItemKey, Variable> variables;
+  std::map<ItemKey, uint64_t> kernargSizes;
+  std::map<std::string, HSAIL_ASM::DirectiveVariable> programVariables;
+  std::map<std::pair<const HSAIL_ASM::BrigContainer*, std::string>, HSAIL_ASM::DirectiveVariable> moduleVariables;
+  std::map<std::string, HSAIL_ASM::DirectiveExecutable> programExecutables;
+  std::map<std::pair<const HSAIL_ASM::BrigContainer*, std::string>, HSAIL_ASM::DirectiveExecutable> moduleExecutables;
+  std::map<std::string, const HSAIL_ASM::BrigContainer*> moduleNames;
+  std::vector<void*> storage;
+  uint64_t groupSize, privateSize, argSize;
+  std::string unsupported;
+
+  void Allocate(HSAIL_ASM::DirectiveVariable var, ItemKey kernel, uint64_t& kernargOffset);
+  void Initialize(HSAIL_ASM::DirectiveVariable var, char* ptr, uint64_t size);
+};
+
+/// Work-items are executed one at a time, so every wave has one lane.
+static const uint32_t CPU_WAVESIZE = 1;
+static const uint32_t CPU_MAX_WORKGROUP_SIZE = 1024;
+
+struct CpuDispatchParams {
+  HSAIL_ASM::DirectiveKernel kernel;
+  unsigned model;
+  unsigned profile;
+  unsigned dimensions;
+  uint16_t workgroupSize[3];
+  uint32_t gridSize[3];
+  uint32_t groupSegmentSize;
+  void* kernarg;
+  uint64_t packetId;
+  uint64_t completionSignal;
+  unsigned timeout;
+};
+
+/// Runs all work-items of the dispatch on the calling thread. Returns
+/// false if execution failed, unsupported is set if the kernel uses
+/// instructions which are not implemented.
+bool ExecuteKernel(Context* context, const CpuExecutable* executable, const CpuDispatchParams& params, std::string& unsupported);
+
+}
+
+}
+
+#endif // HEXL_CPU_EXECUTOR_HPP
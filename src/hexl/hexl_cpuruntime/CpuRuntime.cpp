@@ -0,0 +1,497 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "CpuRuntime.hpp"
+#include "CpuExecutor.hpp"
+#include "HexlTest.hpp"
+#include "RuntimeContext.hpp"
+#include "HSAILTestGenBrigContext.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+using namespace hexl;
+using namespace hexl::runtime;
+
+namespace hexl {
+
+namespace cpu_runtime {
+
+class CpuRuntimeContext;
+
+  class CpuRuntimeContextState : public runtime::RuntimeState {
+  private:
+    CpuRuntimeContext* runtime;
+    Context* context;
+    HostThreads hostThreads;
+    std::vector<std::string> keys;
+
+    const uint32_t TIMEOUT;
+
+  public:
+    CpuRuntimeContextState(CpuRuntimeContext* runtime_, Context* context_, uint32_t timeout)
+      : runtime(runtime_), context(context_), hostThreads(this), TIMEOUT(timeout) { }
+
+    ~CpuRuntimeContextState()
+    {
+      for (size_t i = 0; i < keys.size(); ++i) {
+        context->Delete(keys[keys.size() - 1 - i]);
+      }
+    }
+
+    template <typename T>
+    void Put(const std::string& key, T* t)
+    {
+      keys.push_back(key);
+      context->Move(key, t);
+    }
+
+    CpuRuntimeContext* Runtime() { return runtime; }
+
+    void NotSupported(const std::string& what)
+    {
+      context->Info() << "Not supported by CPU runtime: " << what << std::endl;
+      context->Move(TEST_STATUS_KEY, new TestStatus(NA));
+    }
+
+    Context* GetContext() override { return context; }
+
+    bool StartThread(unsigned id, Command* command) override
+    {
+      return hostThreads.StartThread(id, command);
+    }
+
+    bool WaitThreads() override
+    {
+      return hostThreads.WaitThreads();
+    }
+
+    virtual bool ModuleCreateFromBrig(const std::string& moduleId = "module", const std::string& brigId = "brig") override
+    {
+      HSAIL_ASM::BrigContainer* brig = context->Get<HSAIL_ASM::BrigContainer>(brigId);
+      BrigModule_t module = brig->getBrigModule();
+      context->Put(moduleId, module);
+      return true;
+    }
+
+    class CpuProgram {
+    public:
+      std::vector<BrigModule_t> modules;
+    };
+
+    virtual bool ProgramCreate(const std::string& programId = "program") override
+    {
+      // Addresses are host pointers, so small model kernels can only be
+      // executed by 32-bit host.
+      if (!context->IsLarge() && sizeof(void*) > 4) {
+        NotSupported("small machine model on 64-bit host");
+        return false;
+      }
+      Put(programId, new CpuProgram());
+      return true;
+    }
+
+    virtual bool ProgramAddModule(const std::string& programId = "program", const std::string& moduleId = "module") override
+    {
+      CpuProgram* program = context->Get<CpuProgram>(programId);
+      BrigModule_t module = context->Get<BrigModuleHeader>(moduleId);
+      program->modules.push_back(module);
+      return true;
+    }
+
+    class CpuCode {
+    public:
+      std::vector<BrigModule_t> modules;
+    };
+
+    virtual bool ProgramFinalize(const std::string& codeId = "code", const std::string& programId = "program") override
+    {
+      // Nothing to finalize: modules are interpreted.
+      CpuProgram* program = context->Get<CpuProgram>(programId);
+      CpuCode* code = new CpuCode();
+      code->modules = program->modules;
+      Put(codeId, code);
+      return true;
+    }
+
+    virtual bool ExecutableCreate(const std::string& executableId = "executable") override
+    {
+      Put(executableId, new CpuExecutable(context));
+      return true;
+    }
+
+    virtual bool ExecutableLoadCode(const std::string& executableId = "executable", const std::string& codeId = "code") override
+    {
+      CpuExecutable* executable = context->Get<CpuExecutable>(executableId);
+      CpuCode* code = context->Get<CpuCode>(codeId);
+      if (!executable->Load(code->modules)) { return false; }
+      if (!executable->Unsupported().empty()) {
+        NotSupported(executable->Unsupported());
+        return false;
+      }
+      return true;
+    }
+
+    virtual bool ExecutableFreeze(const std::string& executableId = "executable") override
+    {
+      return true;
+    }
+
+    class CpuBuffer {
+    private:
+      void *ptr;
+
+    public:
+      explicit CpuBuffer(void *ptr_)
+        : ptr(ptr_) { }
+      ~CpuBuffer() { alignedFree(ptr); }
+
+      void* Ptr() { return ptr; }
+    };
+
+    virtual bool BufferCreate(const std::string& bufferId, size_t size, const std::string& initValuesId) override
+    {
+      size = (std::max)(size, (size_t) 256);
+      void *ptr = alignedMalloc(size, 256);
+      if (!initValuesId.empty()) {
+        size_t written = WriteRuntimeValues(context, initValuesId, ptr);
+        assert(written <= size); (void) written;
+      }
+      Put(bufferId, new CpuBuffer(ptr));
+      return true;
+    }
+
+    virtual bool BufferValidate(const std::string& bufferId, const std::string& expectedValuesId, ValueType memoryType, const std::string& method = "") override
+    {
+      CpuBuffer *buf = context->Get<CpuBuffer>(bufferId);
+      context->Info() << "Validating buffer " << bufferId << " with expected values " << expectedValuesId << "(method: " << method << ")" << std::endl;
+      Values* expectedValues = context->Get<Values>(expectedValuesId);
+      return ValidateMemory(context, memoryType, *expectedValues, buf->Ptr(), method);
+    }
+
+    virtual bool ImageCreate(const std::string& imageId, const std::string& imageParamsId, bool optionalFormat) override
+    {
+      NotSupported("images");
+      return false;
+    }
+
+    virtual bool ImageInitialize(const std::string& imageId, const std::string& imageParamsId, const std::string& initValueId) override
+    {
+      NotSupported("images");
+      return false;
+    }
+
+    virtual bool ImageWrite(const std::string& imageId, const std::string& writeValuesId, const ImageRegion& region) override
+    {
+      NotSupported("images");
+      return false;
+    }
+
+    virtual bool ImageValidate(const std::string& imageId, const std::string& expectedValuesId, ValueType memoryType, const std::string& method = "") override
+    {
+      NotSupported("images");
+      return false;
+    }
+
+    virtual bool SamplerCreate(const std::string& samplerId, const std::string& samplerParamsId) override
+    {
+      NotSupported("samplers");
+      return false;
+    }
+
+    struct CpuDispatch {
+      const CpuExecutable* executable;
+      CpuDispatchParams params;
+      void* kernarg;
+      size_t kernargOffset;
+      CpuSignal completionSignal;
+
+      CpuDispatch()
+        : executable(0), kernarg(0), kernargOffset(0), completionSignal(1) { }
+      ~CpuDispatch() { alignedFree(kernarg); }
+    };
+
+    virtual bool DispatchCreate(const std::string& dispatchId, const std::string& executableId, const std::string& kernelName) override;
+
+    Value GetValue(const std::string& dispatchId, DispatchArgType argType, const std::string& argKey)
+    {
+      switch (argType) {
+      case DARG_VALUE:
+        return context->GetValue(argKey);
+      case DARG_BUFFER:
+      {
+        CpuBuffer* buf = context->Get<CpuBuffer>(argKey);
+        return Value(MV_POINTER, P(buf->Ptr()));
+      }
+      case DARG_SIGNAL:
+      {
+        CpuSignal* signal = context->Get<CpuSignal>(argKey);
+        return Value(MV_UINT64, signal->Handle());
+      }
+      case DARG_QUEUE:
+      {
+        CpuQueue* queue = context->Get<CpuQueue>(argKey);
+        return Value(context->IsLarge() ? MV_UINT64 : MV_UINT32, (uint64_t) (uintptr_t) queue->Queue());
+      }
+      case DARG_GROUPOFFSET :
+      {
+        Value dynamicOffset = context->GetValue(argKey);
+        assert(dynamicOffset.Type() == MV_UINT32);
+        Value groupSize = context->GetValue(dispatchId, "staticgroupsize");
+        return Value(MV_UINT32, groupSize.U32() + dynamicOffset.U32());
+      }
+      default:
+        assert(!"Unsupported arg type in GetValue"); return Value(MV_UINT64, 0);
+      }
+    }
+
+    bool DispatchArg(const std::string& dispatchId, DispatchArgType argType, const std::string& argKey) override
+    {
+      if (argType == DARG_IMAGE || argType == DARG_SAMPLER) {
+        NotSupported("images");
+        return false;
+      }
+      CpuDispatch* d = context->Get<CpuDispatch>(dispatchId);
+      char *kernarg = (char *) d->kernarg;
+      switch (argType) {
+      case DARG_VALUES:
+      {
+        Values* values = context->Get<Values>(argKey);
+        assert(values->size() > 0);
+        Value v = (*values)[0];
+        d->kernargOffset = ((d->kernargOffset + v.Size() - 1) / v.Size()) * v.Size();
+        WriteTo(kernarg + d->kernargOffset, *values);
+        d->kernargOffset += v.Size() * values->size();
+        break;
+      }
+      default:
+      {
+        Value v = GetValue(dispatchId, argType, argKey);
+        d->kernargOffset = ((d->kernargOffset + v.Size() - 1) / v.Size()) * v.Size();
+        v.WriteTo(kernarg + d->kernargOffset);
+        d->kernargOffset += v.Size();
+        break;
+      }
+      }
+      return true;
+    }
+
+    virtual bool DispatchExecute(const std::string& dispatchId = "dispatch") override;
+
+    virtual bool SignalCreate(const std::string& signalId, uint64_t signalInitialValue = 1) override
+    {
+      Put(signalId, new CpuSignal((int64_t) signalInitialValue));
+      return true;
+    }
+
+    virtual bool SignalSend(const std::string& signalId, uint64_t signalSendValue = 1) override
+    {
+      CpuSignal* signal = context->Get<CpuSignal>(signalId);
+      signal->value.store((int64_t) signalSendValue);
+      return true;
+    }
+
+    virtual bool SignalWait(const std::string& signalId, uint64_t expectedValue = 1) override
+    {
+      CpuSignal* signal = context->Get<CpuSignal>(signalId);
+      int64_t acquiredValue;
+      bool result = true;
+      TestClock::time_point beg = TestClock::now();
+      while ((acquiredValue = signal->value.load()) != (int64_t) expectedValue) {
+        double elapsed = ElapsedSeconds(beg);
+        if (elapsed > TIMEOUT) {
+          context->Info() << "Signal '" << signalId << "' wait timed out, elapsed time: " <<
+            elapsed << "s" << std::endl;
+          result = false;
+          break;
+        }
+        std::this_thread::yield();
+      }
+      context->Info() << "Signal '" << signalId << "' handle: " << std::hex << signal->Handle() << std::dec
+                      << ", expected value: " << expectedValue << ", acquired value: " << acquiredValue << std::endl;
+      return result;
+    }
+
+    virtual bool QueueCreate(const std::string& queueId, uint32_t size = 0) override;
+
+    virtual bool IsDetectSupported() override
+    {
+      context->Move(TEST_STATUS_KEY, new TestStatus(NA));
+      return false;
+    }
+
+    virtual bool IsBreakSupported() override
+    {
+      context->Move(TEST_STATUS_KEY, new TestStatus(NA));
+      return false;
+    }
+
+    virtual bool IsQueueError() override
+    {
+      return false;
+    }
+  };
+
+class CpuRuntimeContext : public runtime::RuntimeContext {
+private:
+  std::unique_ptr<CpuQueue> queue;
+  std::atomic<uint64_t> queueIds;
+
+public:
+  explicit CpuRuntimeContext(Context* context)
+    : RuntimeContext(context), queueIds(0) { }
+
+  bool Init() override
+  {
+    // Instructions are executed by TestGen emulator, which depends on
+    // global machine model and profile.
+    TESTGEN::BrigSettings::init(context->IsLarge() ? BRIG_MACHINE_LARGE : BRIG_MACHINE_SMALL, ModuleProfile(), false);
+    queue.reset(new CpuQueue(1024, NextQueueId()));
+    context->Put("queueid", Value(MV_UINT32, queue->Queue()->id));
+    context->Put("queueptr", Value(context->IsLarge() ? MV_UINT64 : MV_UINT32, (uintptr_t) queue->Queue()));
+    return true;
+  }
+
+  runtime::RuntimeState* NewState(Context* context) override
+  {
+    return new CpuRuntimeContextState(this, context, TestTimeout(context, CPURUNTIMEDEFAULTTIMEOUT));
+  }
+
+  std::string Description() const override { return "CPU runtime"; }
+  uint32_t Wavesize() override { return CPU_WAVESIZE; }
+  uint32_t WavesPerGroup() override { return CPU_MAX_WORKGROUP_SIZE / CPU_WAVESIZE; }
+  bool IsLittleEndianness() override { return true; }
+
+  CpuQueue* Queue() { return queue.get(); }
+  uint64_t NextQueueId() { return queueIds++; }
+};
+
+bool CpuRuntimeContextState::DispatchCreate(const std::string& dispatchId, const std::string& executableId, const std::string& kernelName)
+{
+  CpuExecutable* executable = context->Get<CpuExecutable>(executableId);
+  bool hasMain = context->Has(dispatchId, "main_module_name");
+  std::string mainModuleName = hasMain ? (std::string("&") + context->GetString(dispatchId, "main_module_name")) : "";
+  HSAIL_ASM::DirectiveKernel kernel = executable->FindKernel(mainModuleName, "&" + kernelName);
+  if (!kernel) {
+    context->Error() << "Kernel &" << kernelName << " is not found" << std::endl;
+    return false;
+  }
+
+  CpuDispatch* d = new CpuDispatch();
+  d->executable = executable;
+  d->kernarg = alignedMalloc((std::max)(executable->KernargSegmentSize(kernel), (uint32_t) 16), 16);
+  memset(d->kernarg, 0, (std::max)(executable->KernargSegmentSize(kernel), (uint32_t) 16));
+  Put(dispatchId, d);
+
+  // Packet is written to the queue so that kernels reading it see the
+  // same values as on an agent.
+  CpuQueue* queue = Runtime()->Queue();
+  uint64_t packetId = queue->writeIndex++;
+  context->Put(dispatchId, "dispatchpacketid", Value(MV_UINT64, packetId));
+  hsa_kernel_dispatch_packet_t* p = (hsa_kernel_dispatch_packet_t*) queue->Queue()->base_address + (packetId % queue->Queue()->size);
+  memset(((uint8_t*) p) + 4, 0, sizeof(hsa_kernel_dispatch_packet_t) - 4);
+
+  CpuDispatchParams& params = d->params;
+  params.kernel = kernel;
+  params.model = context->IsLarge() ? BRIG_MACHINE_LARGE : BRIG_MACHINE_SMALL;
+  params.profile = Runtime()->ModuleProfile();
+  params.groupSegmentSize = executable->GroupSegmentSize();
+  context->Put(dispatchId, "staticgroupsize", Value(MV_UINT32, params.groupSegmentSize));
+  if (context->Has(dispatchId, "dynamicgroupsize")) {
+    params.groupSegmentSize += context->GetValue(dispatchId, "dynamicgroupsize").U32();
+  }
+  params.kernarg = d->kernarg;
+  params.packetId = packetId;
+  params.completionSignal = d->completionSignal.Handle();
+  context->Put(dispatchId, "packetcompletionsig", Value(MV_UINT64, params.completionSignal));
+  for (unsigned i = 0; i < 3; ++i) {
+    params.workgroupSize[i] = context->GetValue(dispatchId, "workgroupSize[" + std::to_string(i) + "]").U16();
+    params.gridSize[i] = context->GetValue(dispatchId, "gridSize[" + std::to_string(i) + "]").U32();
+  }
+  params.dimensions = 0;
+  params.timeout = TIMEOUT;
+
+  p->workgroup_size_x = params.workgroupSize[0];
+  p->workgroup_size_y = params.workgroupSize[1];
+  p->workgroup_size_z = params.workgroupSize[2];
+  p->grid_size_x = params.gridSize[0];
+  p->grid_size_y = params.gridSize[1];
+  p->grid_size_z = params.gridSize[2];
+  p->private_segment_size = executable->PrivateSegmentSize();
+  p->group_segment_size = params.groupSegmentSize;
+  p->kernarg_address = d->kernarg;
+  p->completion_signal.handle = params.completionSignal;
+  return true;
+}
+
+bool CpuRuntimeContextState::DispatchExecute(const std::string& dispatchId)
+{
+  CpuDispatch* d = context->Get<CpuDispatch>(dispatchId);
+  assert(d);
+  d->params.dimensions = context->GetValue(dispatchId, "dimensions").U16();
+  CpuQueue* queue = Runtime()->Queue();
+  hsa_kernel_dispatch_packet_t* p = (hsa_kernel_dispatch_packet_t*) queue->Queue()->base_address + (d->params.packetId % queue->Queue()->size);
+  p->setup = (uint16_t) (d->params.dimensions << HSA_KERNEL_DISPATCH_PACKET_SETUP_DIMENSIONS);
+  p->header = (uint16_t) (HSA_PACKET_TYPE_KERNEL_DISPATCH << HSA_PACKET_HEADER_TYPE);
+
+  std::string unsupported;
+  bool result = ExecuteKernel(context, d->executable, d->params, unsupported);
+  if (!unsupported.empty()) {
+    NotSupported(unsupported);
+    return false;
+  }
+  p->header = (uint16_t) (HSA_PACKET_TYPE_INVALID << HSA_PACKET_HEADER_TYPE);
+  queue->readIndex.store(d->params.packetId + 1);
+  if (!result) { return false; }
+  d->completionSignal.value.store(0);
+  return true;
+}
+
+bool CpuRuntimeContextState::QueueCreate(const std::string& queueId, uint32_t size)
+{
+  Put(queueId, new CpuQueue(size == 0 ? 1024 : size, Runtime()->NextQueueId()));
+  return true;
+}
+
+}
+
+runtime::RuntimeContext* CreateCpuRuntimeContext(Context* context)
+{
+  return new cpu_runtime::CpuRuntimeContext(context);
+}
+
+  template <>
+  void Print<cpu_runtime::CpuRuntimeContextState::CpuProgram>(const cpu_runtime::CpuRuntimeContextState::CpuProgram&, std::ostream& out) { }
+
+  template <>
+  void Print<cpu_runtime::CpuRuntimeContextState::CpuCode>(const cpu_runtime::CpuRuntimeContextState::CpuCode&, std::ostream& out) { }
+
+  template <>
+  void Print<cpu_runtime::CpuExecutable>(const cpu_runtime::CpuExecutable&, std::ostream& out) { }
+
+  template <>
+  void Print<cpu_runtime::CpuRuntimeContextState::CpuBuffer>(const cpu_runtime::CpuRuntimeContextState::CpuBuffer&, std::ostream& out) { }
+
+  template <>
+  void Print<cpu_runtime::CpuRuntimeContextState::CpuDispatch>(const cpu_runtime::CpuRuntimeContextState::CpuDispatch&, std::ostream& out) { }
+
+  template <>
+  void Print<cpu_runtime::CpuSignal>(const cpu_runtime::CpuSignal&, std::ostream& out) { }
+
+  template <>
+  void Print<cpu_runtime::CpuQueue>(const cpu_runtime::CpuQueue&, std::ostream& out) { }
+}
@@ -0,0 +1,32 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HEXL_CPU_RUNTIME_HPP
+#define HEXL_CPU_RUNTIME_HPP
+
+#include "RuntimeCommon.hpp"
+
+#define CPURUNTIMEDEFAULTTIMEOUT 120
+
+namespace hexl {
+
+/// Runtime which executes BRIG kernels on the host by interpreting them
+/// (-rt cpu). Does not need an HSA agent.
+runtime::RuntimeContext* CreateCpuRuntimeContext(Context* context);
+
+}
+
+#endif // HEXL_CPU_RUNTIME_HPP
@@ -762,7 +762,11 @@ void EBuffer::ScenarioInit()
 {
   CommandsBuilder* commands = te->TestScenario()->Commands();
   if (Values* values = data.release()) {
-    te->InitialContext()->Move(IdData(), values);
+    if (type == HOST_INPUT_BUFFER) {
+      MoveValues(te->InitialContext(), IdData(), values);
+    } else {
+      te->InitialContext()->Move(IdData(), values);
+    }
   }
   commands->BufferCreate(Id(), Size(), (type == HOST_INPUT_BUFFER) ? IdData() : "");
 }
@@ -3958,6 +3962,7 @@ Values* EmittedTest::ExpectedResults() const
 
 void EmittedTest::ExpectedResults(Values* result) const
 {
+  result->reserve(result->size() + geometry->GridSize() * ResultCount());
   for (size_t i = 0; i < geometry->GridSize(); ++i) {
     for (uint64_t j = 0; j < ResultCount(); ++j) {
       result->push_back(ExpectedResult(i, j));
@@ -58,6 +58,20 @@ namespace hexl {
       unsigned Count() const { return count; }
     };
 
+    class AtAction : public Action<T> {
+    private:
+      uint64_t index;
+      Action<T>& a;
+
+    public:
+      AtAction(uint64_t index_, Action<T>& a_)
+        : index(index_), a(a_) { }
+
+      void operator()(const T& item) {
+        if (index-- == 0) { a(item); }
+      }
+    };
+
     class HasAction : public Action<T> {
     private:
       const T& t;
@@ -98,12 +112,27 @@ namespace hexl {
   public:
     virtual void Iterate(Action<T>& a) const = 0;
 
-    unsigned Count() const {
+    /// Number of items. Sequences which know it without iterating override
+    /// this, as well as At.
+    virtual uint64_t Size() const {
       CountAction counter;
       Iterate(counter);
       return counter.Count();
     }
 
+    /// Applies a to the item with given index.
+    virtual void At(uint64_t index, Action<T>& a) const {
+      assert(index < Size());
+      AtAction at(index, a);
+      Iterate(at);
+    }
+
+    unsigned Count() const { return (unsigned) Size(); }
+
+    /// Appends sizes of dimensions: index of an item is a mixed radix number
+    /// with these digits. Products have a dimension per component.
+    virtual void Dimensions(std::vector<uint64_t>& sizes) const { sizes.push_back(Size()); }
+
     bool Has(const T& value) const {
       HasAction has(value);
       Iterate(has);
@@ -132,6 +161,8 @@ namespace hexl {
   class EmptySequence : public Sequence<T> {
   public:
     void Iterate(Action<T>& a) const { }
+    uint64_t Size() const { return 0; }
+    void At(uint64_t index, Action<T>& a) const { assert(false); }
   };
 
   template<typename T>
@@ -142,6 +173,8 @@ namespace hexl {
   public:
     explicit OneValueSequence(const T& value_) : value(value_) { }
     void Iterate(Action<T>& a) const { a(value); }
+    uint64_t Size() const { return 1; }
+    void At(uint64_t index, Action<T>& a) const { assert(index == 0); a(value); }
   };
 
   template<typename T>
@@ -160,6 +193,9 @@ namespace hexl {
       for (unsigned i = 0; i < length; ++i) 
         a(values[i]);
     }
+
+    uint64_t Size() const { return length; }
+    void At(uint64_t index, Action<T>& a) const { assert(index < length); a(values[index]); }
   };
 
   template<typename T>
@@ -183,6 +219,9 @@ namespace hexl {
     void Iterate(Action<T>& a) const {
       for (size_t i = 0; i < index; ++i) { a(values[i]); }
     }
+
+    uint64_t Size() const { return index; }
+    void At(uint64_t i, Action<T>& a) const { assert(i < index); a(values[i]); }
   };
 
   template <typename T>
@@ -250,6 +289,25 @@ namespace hexl {
     }
   };
 
+  template <typename P1, typename P2>
+  class ForwardPairAtAction : public Action<P1> {
+  private:
+    Sequence<P2>* p2s;
+    uint64_t index2;
+    Action<Pair<P1, P2>>& p;
+
+  public:
+    ForwardPairAtAction(Sequence<P2>* p2s_, uint64_t index2_, Action<Pair<P1, P2>>& p_)
+      : p2s(p2s_), index2(index2_), p(p_) { }
+
+    void operator()(const P1& p1) {
+      ApplyPairAction<P1, P2> action(p1, p);
+      p2s->At(index2, action);
+    }
+  };
+
+  /// Items are ordered with the last component changing fastest, so index
+  /// of the product is a mixed radix number with digits indexing components.
   template <typename P1, typename P2>
   class SequenceProduct2 : public Sequence<Pair<P1, P2>> {
   private:
@@ -264,6 +322,20 @@ namespace hexl {
       ForwardPairAction<P1, P2> p1a(p2s, a);
       p1s->Iterate(p1a);
     }
+
+    uint64_t Size() const { return p1s->Size() * p2s->Size(); }
+
+    void Dimensions(std::vector<uint64_t>& sizes) const {
+      p1s->Dimensions(sizes);
+      p2s->Dimensions(sizes);
+    }
+
+    void At(uint64_t index, Action<Pair<P1, P2>>& a) const {
+      uint64_t size2 = p2s->Size();
+      assert(index < p1s->Size() * size2);
+      ForwardPairAtAction<P1, P2> p1a(p2s, index % size2, a);
+      p1s->At(index / size2, p1a);
+    }
   };
 
   template <typename P1, typename P2, typename P3>
@@ -491,6 +563,13 @@ namespace hexl {
       MapAction ma(ap, a);
       s->Iterate(ma);
     }
+
+    uint64_t Size() const { return s->Size(); }
+
+    void At(uint64_t index, Action<T*>& a) const {
+      MapAction ma(ap, a);
+      s->At(index, ma);
+    }
   };
 
   template<typename T, typename P1, typename P2>
@@ -522,6 +601,13 @@ namespace hexl {
       MapAction ma(ap, a);
       s->Iterate(ma);
     }
+
+    uint64_t Size() const { return s->Size(); }
+
+    void At(uint64_t index, Action<T*>& a) const {
+      MapAction ma(ap, a);
+      s->At(index, ma);
+    }
   };
 
   template<typename T, typename P1, typename P2, typename P3>
@@ -553,6 +639,13 @@ namespace hexl {
       MapAction ma(ap, a);
       s->Iterate(ma);
     }
+
+    uint64_t Size() const { return s->Size(); }
+
+    void At(uint64_t index, Action<T*>& a) const {
+      MapAction ma(ap, a);
+      s->At(index, ma);
+    }
   };
 
   template<typename T, typename P1, typename P2, typename P3, typename P4>
@@ -584,6 +677,13 @@ namespace hexl {
       MapAction ma(ap, a);
       s->Iterate(ma);
     }
+
+    uint64_t Size() const { return s->Size(); }
+
+    void At(uint64_t index, Action<T*>& a) const {
+      MapAction ma(ap, a);
+      s->At(index, ma);
+    }
   };
 
   template<typename T, typename P1, typename P2, typename P3, typename P4, typename P5>
@@ -615,6 +715,13 @@ namespace hexl {
       MapAction ma(ap, a);
       s->Iterate(ma);
     }
+
+    uint64_t Size() const { return s->Size(); }
+
+    void At(uint64_t index, Action<T*>& a) const {
+      MapAction ma(ap, a);
+      s->At(index, ma);
+    }
   };
 
   template <typename T, typename P1>
@@ -683,6 +790,26 @@ namespace hexl {
       SubsequenceAction<T> as(bits, a);
       sequence->Iterate(as);
     }
+
+    uint64_t Size() const {
+      uint64_t size = 0, count = sequence->Size();
+      for (unsigned i = 0; i < count && i < 32; ++i) {
+        if (bits & (1u << i)) { size++; }
+      }
+      return size;
+    }
+
+    /// Does nothing if index is out of range.
+    void At(uint64_t index, Action<T>& a) const {
+      assert(index < Size());
+      uint64_t count = sequence->Size();
+      for (unsigned i = 0; i < count && i < 32; ++i) {
+        if ((bits & (1u << i)) && index-- == 0) {
+          sequence->At(i, a);
+          return;
+        }
+      }
+    }
   };
 
   template <typename T>
@@ -693,6 +820,12 @@ namespace hexl {
     mutable std::vector<SubsetSequence<T>*, ArenaAllocator<SubsetSequence<T>*>> subsequences;
     unsigned count;
 
+    void Create() const {
+      for (size_t i = subsequences.size(); i < (uint64_t) (1 << count); ++i) {
+        subsequences.push_back(NEWA SubsetSequence<T>(sequence, (unsigned) i));
+      }
+    }
+
   public:
     explicit SubsetsSequence(Arena* ap_, const Sequence<T>* sequence_)
       : ap(ap_), sequence(sequence_), subsequences(ap_), count(sequence->Count())
@@ -701,13 +834,19 @@ namespace hexl {
     }
 
     void Iterate(Action<Sequence<T>*>& a) const {
-      for (size_t i = subsequences.size(); i < (uint64_t) (1 << count); ++i) {
-        subsequences.push_back(NEWA SubsetSequence<T>(sequence, (unsigned) i));
-      }
+      Create();
       for (SubsetSequence<T>* subsequence : subsequences) {
         a(subsequence);
       }
     }
+
+    uint64_t Size() const { return (uint64_t) 1 << count; }
+
+    void At(uint64_t index, Action<Sequence<T>*>& a) const {
+      assert(index < Size());
+      Create();
+      a(subsequences[index]);
+    }
   };
 
   template <typename T>
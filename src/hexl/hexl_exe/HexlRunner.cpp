@@ -72,6 +72,7 @@ int HexlRunner::ParseOptions()
 #ifdef ENABLE_HEXL_AGENT
   optReg.RegisterOption("agent");
   optReg.RegisterOption("remote");
+  optReg.RegisterOption("inflight");
 #endif // ENABLE_HEXL_AGENT
   optReg.RegisterOption("hxl");
   optReg.RegisterOption("test");
@@ -91,6 +92,18 @@ int HexlRunner::ParseOptions()
   optReg.RegisterOption("match");
   optReg.RegisterOption("testlog");
   optReg.RegisterOption("testsummary");
+  optReg.RegisterOption("testtiming");
+  optReg.RegisterOption("durations");
+  optReg.RegisterOption("schedule");
+  optReg.RegisterBooleanOption("incremental");
+  optReg.RegisterOption("resultcache");
+  optReg.RegisterOption("codecache");
+  optReg.RegisterOption("codecachedir");
+  optReg.RegisterOption("kernargarena");
+  optReg.RegisterOption("bufferpool");
+  optReg.RegisterOption("timeouts");
+  optReg.RegisterOption("waitspin");
+  optReg.RegisterOption("lookahead");
   optReg.RegisterOption("rtlib");
   optReg.RegisterOption("timeout");
   int n;
@@ -152,22 +165,22 @@ void HexlRunner::Run()
 {
   int result = 4;
   result = ParseOptions();
-  context->Put("hexl.options", &options);
-  context->Put("hexl.stats", new AllStats());
+  context->Put(CK_OPTIONS, &options);
+  context->Put(CK_STATS, new AllStats());
   ResourceManager* rm = new DirectoryResourceManager(options.GetString("testbase", "."), options.GetString("results", "."));
-  context->Put("hexl.rm", rm);
+  context->Put(CK_RM, rm);
   runtime::RuntimeContext* runtime = CreateRuntimeContext(context.get());
   if (runtime) {
     std::cout << "Runtime: " << runtime->Description() << std::endl;
   } else {
     result = 17;
   }
-  context->Put("hexl.runtime", runtime);
-  context->Put("hexl.testFactory", testFactory.get());
+  context->Put(CK_RUNTIME, runtime);
+  context->Put(CK_TEST_FACTORY, testFactory.get());
   if (result == 0) {
 #ifdef ENABLE_HEXL_AGENT
     if (options.IsSet("remote")) {
-      RemoteTestRunner* remoteTestRunner = new RemoteTestRunner(context, options.GetString("remote"));
+      RemoteTestRunner* remoteTestRunner = new RemoteTestRunner(context.get(), options.GetString("remote"));
       if (!remoteTestRunner->Connect()) {
         result = 19;
       } else {
@@ -180,7 +193,7 @@ void HexlRunner::Run()
     }
 #ifdef ENABLE_HEXL_AGENT
     if (options.IsSet("agent")) {
-      Agent agent(testRunner, testFactory, options.GetString("agent"));
+      Agent agent(testRunner, testFactory.get(), options.GetString("agent"));
       agent.Loop();
       return;
     }
@@ -20,12 +20,23 @@
 #include "Scenario.hpp"
 #include "Utils.hpp"
 #include "DllApi.hpp"
+#include "HexlResource.hpp"
 #include <cstring>
 #include <algorithm>
 #include <sstream>
 #include <time.h>
 #include <set>
 #include <bitset>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#ifdef _WIN32
+#include <process.h>
+#else // _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif // _WIN32
 
 #if defined(_WIN32) || defined(_WIN64)  // Windows
   #include <intrin.h>
@@ -71,6 +82,8 @@ const HsaApiTable* HsaApi::InitApiTable() {
 
   GET_FUNCTION(hsa_executable_create);
   GET_FUNCTION(hsa_code_object_destroy);
+  GET_FUNCTION(hsa_code_object_serialize);
+  GET_FUNCTION(hsa_code_object_deserialize);
   GET_FUNCTION(hsa_executable_load_code_object);
   GET_FUNCTION(hsa_executable_symbol_get_info);
   GET_FUNCTION(hsa_executable_get_symbol);
@@ -79,6 +92,7 @@ const HsaApiTable* HsaApi::InitApiTable() {
   GET_FUNCTION(hsa_executable_destroy);
 
 //  GET_FUNCTION();
+  GET_FUNCTION(hsa_queue_load_read_index_relaxed);
   GET_FUNCTION(hsa_queue_load_write_index_relaxed);
   GET_FUNCTION(hsa_queue_store_write_index_relaxed);
   GET_FUNCTION(hsa_queue_add_write_index_relaxed);
@@ -145,8 +159,8 @@ bool RegionMatchSystem(HsailRuntimeContext* runtime, hsa_region_t region);
 
 void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
 {
-  HsailRuntimeContext* runtime = static_cast<HsailRuntimeContext*>(data);
-  runtime->QueueError(status);
+  HsailRuntimeContext::WorkerQueue* wq = static_cast<HsailRuntimeContext::WorkerQueue*>(data);
+  wq->runtime->QueueError(wq, status);
 }
 
   class HsailRuntimeContextState : public runtime::RuntimeState {
@@ -155,18 +169,35 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
     Context* context;
     HostThreads hostThreads;
     std::vector<std::string> keys;
+    unsigned worker;
+    // Pooled resources held by the test, checked for leaks at test end.
+    std::atomic<int> signalsInUse, queuesInUse, kernargsInUse;
+    // Set if a dispatch did not complete, so its signals may still be
+    // used by the agent.
+    std::atomic<bool> dispatchIncomplete;
+    // Queues created by the test, their errors are errors of the test.
+    std::mutex testQueuesMutex;
+    std::vector<HsailRuntimeContext::WorkerQueue*> testQueues;
 
     const uint32_t TIMEOUT;
 
   public:
-    HsailRuntimeContextState(HsailRuntimeContext* runtime_, Context* context_, uint32_t timeout)
-      : runtime(runtime_), context(context_), hostThreads(this), TIMEOUT(timeout) { }
+    HsailRuntimeContextState(HsailRuntimeContext* runtime_, Context* context_, unsigned worker_, uint32_t timeout)
+      : runtime(runtime_), context(context_), hostThreads(this), worker(worker_),
+        signalsInUse(0), queuesInUse(0), kernargsInUse(0), dispatchIncomplete(false), TIMEOUT(timeout) { }
 
     ~HsailRuntimeContextState()
     {
       for (size_t i = 0; i < keys.size(); ++i) {
         context->Delete(keys[keys.size() - 1 - i]);
       }
+#ifndef _WIN32
+      if (signalsInUse || queuesInUse || kernargsInUse) {
+        context->Error() << "Runtime resources not released at test end: " << signalsInUse << " signals, " <<
+          queuesInUse << " queues, " << kernargsInUse << " kernarg segments" << std::endl;
+        Runtime()->AddLeaks(signalsInUse, queuesInUse, kernargsInUse);
+      }
+#endif // _WIN32
     }
 
     template <typename T>
@@ -178,6 +209,26 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
 
     HsailRuntimeContext* Runtime() { return runtime; }
 
+    void HsaError(const char *msg, hsa_status_t err) { Runtime()->HsaError(context, msg, err); }
+    void HsaError(const char *msg) { context->Error() << msg << std::endl; }
+
+    /// Error on the worker dispatch queue or on a queue created by the test.
+    bool AnyQueueError(hsa_status_t* status = 0)
+    {
+      if (runtime->IsQueueError(worker)) {
+        if (status) { *status = runtime->QueueErrorStatus(worker); }
+        return true;
+      }
+      std::lock_guard<std::mutex> lock(testQueuesMutex);
+      for (HsailRuntimeContext::WorkerQueue* wq : testQueues) {
+        if (wq->error) {
+          if (status) { *status = wq->errorStatus; }
+          return true;
+        }
+      }
+      return false;
+    }
+
     Context* GetContext() override { return context; }
 
     bool StartThread(unsigned id, Command* command) override
@@ -202,10 +253,11 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
     private:
       HsailRuntimeContextState* rt;
       hsa_ext_program_t program;
+      uint64_t hash;
 
     public:
-      HsailProgram(HsailRuntimeContextState* rt_, hsa_ext_program_t program_)
-        : rt(rt_), program(program_) { }
+      HsailProgram(HsailRuntimeContextState* rt_, hsa_ext_program_t program_, uint64_t hash_)
+        : rt(rt_), program(program_), hash(hash_) { }
       ~HsailProgram()
       {
 #ifndef _WIN32
@@ -214,23 +266,29 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
       }
 
       hsa_ext_program_t Program() { return program; }
+      /// Hash of program parameters and added modules, see CodeCacheKey.
+      uint64_t Hash() const { return hash; }
+      void AddHash(const void* data, size_t size) { hash = HashBytes(data, size, hash); }
     };
 
     void ProgramDestroy(hsa_ext_program_t program)
     {
       hsa_status_t status = Runtime()->Hsa()->hsa_ext_program_destroy(program);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_program_destroy failed", status); }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_program_destroy failed", status); }
     }
 
     virtual bool ProgramCreate(const std::string& programId = "program") override
     {
       hsa_ext_program_t program;
       hsa_machine_model_t machineModel = context->IsLarge() ? HSA_MACHINE_MODEL_LARGE : HSA_MACHINE_MODEL_SMALL;
+      hsa_profile_t profile = Runtime()->ProgramProfile();
+      hsa_default_float_rounding_mode_t roundingMode = HSA_DEFAULT_FLOAT_ROUNDING_MODE_ZERO;
       hsa_status_t status =
         Runtime()->Hsa()->hsa_ext_program_create(
-          machineModel, Runtime()->ProgramProfile(), HSA_DEFAULT_FLOAT_ROUNDING_MODE_ZERO, "", &program);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_program_create failed", status); return false; }
-      Put(programId, new HsailProgram(this, program));
+          machineModel, profile, roundingMode, "", &program);
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_program_create failed", status); return false; }
+      uint32_t params[] = { (uint32_t) machineModel, (uint32_t) profile, (uint32_t) roundingMode };
+      Put(programId, new HsailProgram(this, program, HashBytes(params, sizeof(params))));
       return true;
     }
 
@@ -239,7 +297,8 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
       HsailProgram* program = context->Get<HsailProgram>(programId);
       BrigModule_t module = context->Get<BrigModuleHeader>(moduleId);
       hsa_status_t status = Runtime()->Hsa()->hsa_ext_program_add_module(program->Program(), module);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_add_module failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_add_module failed", status); return false; }
+      if (Runtime()->IsCodeCacheEnabled()) { program->AddHash(module, (size_t) module->byteCount); }
       return true;
     }
 
@@ -247,15 +306,16 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
     private:
       HsailRuntimeContextState* rt;
       hsa_code_object_t code;
+      bool owned;
 
     public:
-      HsailCode(HsailRuntimeContextState* rt_, hsa_code_object_t code_)
-        : rt(rt_), code(code_) { }
+      HsailCode(HsailRuntimeContextState* rt_, hsa_code_object_t code_, bool owned_ = true)
+        : rt(rt_), code(code_), owned(owned_) { }
       ~HsailCode()
       {
 #ifndef _WIN32
         // Temporarily disable due to crash on Windows.
-        rt->CodeDestroy(code);
+        if (owned) { rt->CodeDestroy(code); }
 #endif // _WIN32
       }
 
@@ -265,7 +325,7 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
     void CodeDestroy(hsa_code_object_t code)
     {
       hsa_status_t status = Runtime()->Hsa()->hsa_code_object_destroy(code);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_code_object_destroy failed", status); }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_code_object_destroy failed", status); }
     }
 
 
@@ -274,15 +334,27 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
       HsailProgram* program = context->Get<HsailProgram>(programId);
       hsa_isa_t isa;
       hsa_status_t status = Runtime()->Hsa()->hsa_agent_get_info(Runtime()->Agent(), HSA_AGENT_INFO_ISA, &isa);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_agent_get_info(HSA_AGENT_INFO_ISA) failed", status); return 0; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_agent_get_info(HSA_AGENT_INFO_ISA) failed", status); return 0; }
       hsa_ext_control_directives_t cd;
       memset(&cd, 0, sizeof(cd));
       hsa_code_object_t codeObject;
+      // Programs with the same modules finalized with the same parameters
+      // (call convention, control directives, options and code object
+      // type below) share code object.
+      uint64_t key = 0;
+      if (Runtime()->IsCodeCacheEnabled()) {
+        key = Runtime()->CodeCacheKey(program->Hash());
+        if (Runtime()->CodeCacheFind(key, codeObject)) {
+          Put(codeId, new HsailCode(this, codeObject, false));
+          return true;
+        }
+      }
       status = Runtime()->Hsa()->hsa_ext_program_finalize(
         program->Program(),
         isa, 0, cd, "", HSA_CODE_OBJECT_TYPE_PROGRAM, &codeObject);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_finalize_program failed", status); return false; }
-      Put(codeId, new HsailCode(this, codeObject));
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_finalize_program failed", status); return false; }
+      bool cached = Runtime()->IsCodeCacheEnabled() && Runtime()->CodeCacheAdd(key, codeObject);
+      Put(codeId, new HsailCode(this, codeObject, !cached));
       return true;
     }
 
@@ -307,14 +379,14 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
     void ExecutableDestroy(hsa_executable_t executable)
     {
       hsa_status_t status = Runtime()->Hsa()->hsa_executable_destroy(executable);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_destroy failed", status); }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_destroy failed", status); }
     }
 
     virtual bool ExecutableCreate(const std::string& executableId = "executable") override
     {
       hsa_executable_t executable;
       hsa_status_t status = Runtime()->Hsa()->hsa_executable_create(Runtime()->ProgramProfile(), HSA_EXECUTABLE_STATE_UNFROZEN, "", &executable);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_create failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_create failed", status); return false; }
       Put(executableId, new HsailExecutable(this, executable));
       return true;
     }
@@ -324,7 +396,7 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
       HsailExecutable* executable = context->Get<HsailExecutable>(executableId);
       HsailCode* code = context->Get<HsailCode>(codeId);
       hsa_status_t status = Runtime()->Hsa()->hsa_executable_load_code_object(executable->Executable(), Runtime()->Agent(), code->Code(), "");
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_load_code failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_load_code failed", status); return false; }
       return true;
     }
 
@@ -332,75 +404,43 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
     {
       HsailExecutable* executable = context->Get<HsailExecutable>(executableId);
       hsa_status_t status = Runtime()->Hsa()->hsa_executable_freeze(executable->Executable(), "");
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_freeze failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_freeze failed", status); return false; }
       return true;
     }
 
     class HsailBuffer {
     private:
       HsailRuntimeContextState* rt;
-      void *ptr;
+      HsailRuntimeContext::HostBuffer buffer;
 
     public:
-      HsailBuffer(HsailRuntimeContextState* rt_, void *ptr_)
-        : rt(rt_), ptr(ptr_) { }
+      HsailBuffer(HsailRuntimeContextState* rt_, const HsailRuntimeContext::HostBuffer& buffer_)
+        : rt(rt_), buffer(buffer_) { }
       ~HsailBuffer()
       {
 #ifndef _WIN32
-        rt->BufferDestroy(ptr);
+        rt->BufferDestroy(buffer);
 #endif // _WIN32
       }
 
-      void* Ptr() { return ptr; }
+      void* Ptr() { return buffer.ptr; }
     };
 
-    void BufferDestroy(void *ptr)
+    void BufferDestroy(const HsailRuntimeContext::HostBuffer& buffer)
     {
-      hsa_status_t status;
-      switch (Runtime()->RuntimeProfile()) {
-      case HSA_PROFILE_FULL:
-        status = Runtime()->Hsa()->hsa_memory_deregister(ptr);
-        if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_deregister failed", status); }
-        alignedFree(ptr);
-        break;
-      case HSA_PROFILE_BASE:
-        status = Runtime()->Hsa()->hsa_memory_free(ptr);
-        if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_free failed", status); }
-        break;
-      default:
-        assert(false); return;
-      }
+      Runtime()->BufferRelease(buffer, !dispatchIncomplete);
     }
 
     virtual bool BufferCreate(const std::string& bufferId, size_t size, const std::string& initValuesId) override
     {
-      size = (std::max)(size, (size_t) 256);
-      void *ptr;
-      hsa_status_t status;
-      switch (Runtime()->RuntimeProfile()) {
-      case HSA_PROFILE_FULL:
-        ptr = alignedMalloc(size, 256);
-        status = Runtime()->Hsa()->hsa_memory_register(ptr, size);
-        if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_register failed", status); alignedFree(ptr); return false; }
-        break;
-      case HSA_PROFILE_BASE:
-        status = Runtime()->Hsa()->hsa_memory_allocate(Runtime()->SystemRegion(), size, &ptr);
-        if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_allocate failed", status); return false; }
-        break;
-      default:
-        assert(false); return false;
-      }
+      HsailRuntimeContext::HostBuffer buffer;
+      if (!Runtime()->BufferAcquire(size, buffer)) { return false; }
+      void *ptr = buffer.ptr;
       if (!initValuesId.empty()) {
-        Values* initValues = context->Get<Values>(initValuesId);
-        assert(initValues->size() <= size);
-        char *vptr = (char *) ptr;
-        for (size_t i = 0; i < initValues->size(); ++i) {
-          Value v = context->GetRuntimeValue((*initValues)[i]);
-          v.WriteTo(vptr);
-          vptr += v.Size();
-        }
+        size_t written = WriteRuntimeValues(context, initValuesId, ptr);
+        assert(written <= buffer.size); (void) written;
       }
-      Put(bufferId, new HsailBuffer(this, ptr));
+      Put(bufferId, new HsailBuffer(this, buffer));
       return true;
     }
 
@@ -451,14 +491,14 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
       hsa_status_t status;
       /*
       status = Runtime()->Hsa()->hsa_memory_deregister(data);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_deregister (image data) failed", status); }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_deregister (image data) failed", status); }
       */
 
       status = Runtime()->Hsa()->hsa_ext_image_destroy(Runtime()->Agent(), image);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_image_destroy failed", status); }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_image_destroy failed", status); }
       //alignedFree(data);
       status = Runtime()->Hsa()->hsa_memory_free(data);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_free failed", status); }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_free failed", status); }
     }
 
     virtual bool ImageInitialize(const std::string& imageId, const std::string& imageParamsId,
@@ -476,17 +516,20 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
       hsaRegion.range.y = (uint32_t)imageParams->height;
       hsaRegion.range.z = (uint32_t)imageParams->depth;
 
-      auto size = imageParams->width * imageParams->height * imageParams->depth;
-      auto buff = new char[size * initValue.Size()];
-      auto cbuff = buff;
-      for (uint32_t i = 0; i < size; ++i) {
-        initValue.WriteTo(cbuff);
-        cbuff += initValue.Size();
+      size_t bytes = imageParams->width * imageParams->height * imageParams->depth * initValue.Size();
+      auto buff = new char[bytes];
+      // Fill with the texel value by doubling the filled prefix.
+      size_t filled = (std::min)(initValue.Size(), bytes);
+      if (filled > 0) { initValue.WriteTo(buff); }
+      while (filled > 0 && filled < bytes) {
+        size_t chunk = (std::min)(filled, bytes - filled);
+        memcpy(buff + filled, buff, chunk);
+        filled += chunk;
       }
       hsa_status_t status = Runtime()->Hsa()->hsa_ext_image_import(Runtime()->Agent(), buff,
         imageParams->width * initValue.Size(), imageParams->width * imageParams->height * initValue.Size(), image->Image(), &hsaRegion);
       delete[] buff;
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_image_import failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_image_import failed", status); return false; }
       return true;
     }
 
@@ -513,7 +556,7 @@ void HsaQueueErrorCallback(hsa_status_t status, hsa_queue_t *source, void *data)
       hsa_status_t status = Runtime()->Hsa()->hsa_ext_image_import(Runtime()->Agent(), buff,
         region.size_x, region.size_x * region.size_y, image->Image(), &hsaRegion);
       delete[] buff;
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_image_import failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_image_import failed", status); return false; }
       return true;
     }
 
@@ -553,7 +596,7 @@ class ImageRegionMatcher {
         format.channel_type = (hsa_ext_image_channel_type_t) ip->channelType;
         uint32_t capability_mask;
         status = Runtime()->Hsa()->hsa_ext_image_get_capability(Runtime()->Agent(), (hsa_ext_image_geometry_t) ip->geometry, &format, &capability_mask);
-        if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_image_get_capability failed", status); return false; }
+        if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_image_get_capability failed", status); return false; }
         bool supported;
         switch (access_permission) {
         case HSA_ACCESS_PERMISSION_RO: supported = capability_mask & HSA_EXT_IMAGE_CAPABILITY_READ_ONLY; break;
@@ -582,7 +625,7 @@ class ImageRegionMatcher {
         context->Move(TEST_STATUS_KEY, new TestStatus(NA));
         return false;
       } else if (status != HSA_STATUS_SUCCESS) {
-        Runtime()->HsaError("hsa_ext_image_data_get_info failed", status);
+        HsaError("hsa_ext_image_data_get_info failed", status);
         return false;
       }
 
@@ -593,14 +636,14 @@ class ImageRegionMatcher {
 
       /*
       status = Runtime()->Hsa()->hsa_memory_register(imageData, size);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_register (image data) failed", status); alignedFree(imageData); return 0; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_register (image data) failed", status); alignedFree(imageData); return 0; }
       */
 
 //*
   hsa_region_t region = Runtime()->GetRegion(ImageRegionMatcher(image_info));
-  if (!region.handle) { Runtime()->HsaError("Failed to find image region"); return 0; }
+  if (!region.handle) { HsaError("Failed to find image region"); return 0; }
   status = Runtime()->Hsa()->hsa_memory_allocate(region, image_info.size, &imageData);
-  if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_allocate failed", status); return 0; }
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_allocate failed", status); return 0; }
 //*/
 
       status = Runtime()->Hsa()->hsa_ext_image_create(Runtime()->Agent(), &image_descriptor, imageData, access_permission, &image);
@@ -609,7 +652,7 @@ class ImageRegionMatcher {
         return false;
       }
       if (status != HSA_STATUS_SUCCESS) {
-        Runtime()->HsaError("hsa_ext_image_create failed", status);
+        HsaError("hsa_ext_image_create failed", status);
         Runtime()->Hsa()->hsa_memory_free(imageData);
         return false;
       }
@@ -647,7 +690,7 @@ class ImageRegionMatcher {
     void SamplerDestroy(hsa_ext_sampler_t sampler)
     {
       hsa_status_t status = Runtime()->Hsa()->hsa_ext_sampler_destroy(Runtime()->Agent(), sampler);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_sampler_destroy failed", status); }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_sampler_destroy failed", status); }
     }
 
     virtual bool SamplerCreate(const std::string& samplerId, const std::string& samplerParamsId)
@@ -659,7 +702,7 @@ class ImageRegionMatcher {
       sampler_descriptor.filter_mode = (hsa_ext_sampler_filter_mode_t) params->Filter();
       hsa_ext_sampler_t sampler;
       hsa_status_t status = Runtime()->Hsa()->hsa_ext_sampler_create(Runtime()->Agent(), &sampler_descriptor, &sampler);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_ext_sampler_create failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_ext_sampler_create failed", status); return false; }
       Put(samplerId, new HsailSampler(this, sampler));
       return true;
     }
@@ -670,13 +713,13 @@ class ImageRegionMatcher {
       hsa_executable_symbol_t kernel;
       uint64_t packetId;
       hsa_kernel_dispatch_packet_t* packet;
-      uint64_t timeout;
       size_t kernargOffset;
       void* kernargAddr;
       hsa_signal_t completionSignal;
+      bool completed;
 
       HsailDispatch(HsailRuntimeContextState* rt_)
-        : rt(rt_) { }
+        : rt(rt_), completed(false) { }
 
       ~HsailDispatch() {
 #ifndef _WIN32
@@ -687,8 +730,14 @@ class ImageRegionMatcher {
 
     void DispatchDestroy(HsailDispatch* dispatch)
     {
-      Runtime()->Hsa()->hsa_memory_free(dispatch->kernargAddr);
-      Runtime()->Hsa()->hsa_signal_destroy(dispatch->completionSignal);
+      if (dispatch->kernargAddr) {
+        Runtime()->KernargFree(dispatch->kernargAddr, dispatch->completed);
+        kernargsInUse--;
+      }
+      if (dispatch->completionSignal.handle) {
+        Runtime()->SignalRelease(dispatch->completionSignal, dispatch->completed);
+        signalsInUse--;
+      }
     }
 
     virtual bool DispatchCreate(const std::string& dispatchId, const std::string& executableId, const std::string& kernelName) override
@@ -709,7 +758,7 @@ class ImageRegionMatcher {
           Runtime()->Agent(),
           0,
           &kernel);
-        if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_get_symbol failed", status); return false; }
+        if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_get_symbol failed", status); return false; }
       } else {
         IterateData<hsa_executable_symbol_t, int> idata(Runtime(), &kernel);
         status = Runtime()->Hsa()->hsa_executable_iterate_symbols(executable->Executable(), IterateExecutableSymbolsGetKernel, &idata);
@@ -718,10 +767,13 @@ class ImageRegionMatcher {
 
       uint32_t kernargSize;
       status = Runtime()->Hsa()->hsa_executable_symbol_get_info(kernel, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE, &kernargSize);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE) failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE) failed", status); return false; }
+      uint32_t kernargAlignment;
+      status = Runtime()->Hsa()->hsa_executable_symbol_get_info(kernel, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_ALIGNMENT, &kernargAlignment);
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_ALIGNMENT) failed", status); return false; }
 
-      hsa_queue_t* queue = Runtime()->QueueNoError();
-      if (!queue) { runtime->HsaError("Queue is not available"); return false; }
+      hsa_queue_t* queue = Runtime()->QueueNoError(worker);
+      if (!queue) { HsaError("Queue is not available"); return false; }
       uint64_t packetId = Runtime()->Hsa()->hsa_queue_add_write_index_relaxed(queue, 1);
       context->Put(dispatchId, "dispatchpacketid", Value(MV_UINT64, packetId));
       hsa_kernel_dispatch_packet_t* p = (hsa_kernel_dispatch_packet_t*) queue->base_address + (packetId % queue->size);
@@ -729,22 +781,22 @@ class ImageRegionMatcher {
 
       status = Runtime()->Hsa()->hsa_executable_symbol_get_info(
         kernel, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_OBJECT, &p->kernel_object);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_OBJECT) failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_OBJECT) failed", status); return false; }
 
       if (kernargSize > 0) {
-        status = Runtime()->Hsa()->hsa_memory_allocate(Runtime()->KernargRegion(), kernargSize, &p->kernarg_address);
-        if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_memory_allocate(kernargRegion) failed", status); return false; }
+        if (!Runtime()->KernargAllocate(kernargSize, kernargAlignment, &p->kernarg_address)) { return false; }
+        kernargsInUse++;
       } else {
         p->kernarg_address = 0;
       }
 
       status = Runtime()->Hsa()->hsa_executable_symbol_get_info(
         kernel, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_PRIVATE_SEGMENT_SIZE, &p->private_segment_size);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_PRIVATE_SEGMENT_SIZE) failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_PRIVATE_SEGMENT_SIZE) failed", status); return false; }
       bool dynamicCallStack = false;
       status = Runtime()->Hsa()->hsa_executable_symbol_get_info(
         kernel, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_DYNAMIC_CALLSTACK, &dynamicCallStack);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_symbol_get_info(HSA_CODE_SYMBOL_INFO_KERNEL_DYNAMIC_CALLSTACK) failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_symbol_get_info(HSA_CODE_SYMBOL_INFO_KERNEL_DYNAMIC_CALLSTACK) failed", status); return false; }
       if (dynamicCallStack) {
         // Set to max minimum allowed by the spec for now (64k per work-group).
         // TODO: a strategy for choosing this size, for example, based on expected number of frames/extra allocation used by test.
@@ -754,14 +806,14 @@ class ImageRegionMatcher {
 
       status = Runtime()->Hsa()->hsa_executable_symbol_get_info(
         kernel, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_GROUP_SEGMENT_SIZE, &p->group_segment_size);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_GROUP_SEGMENT_SIZE) failed", status); return false; }
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_executable_symbol_get_info(HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_GROUP_SEGMENT_SIZE) failed", status); return false; }
       context->Put(dispatchId, "staticgroupsize", Value(MV_UINT32, p->group_segment_size));
       if (context->Has(dispatchId, "dynamicgroupsize")) {
         p->group_segment_size += context->GetValue(dispatchId, "dynamicgroupsize").U32();
       }
 
-      status = Runtime()->Hsa()->hsa_signal_create(1, 0, 0, &p->completion_signal);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_signal_create(completion_signal) failed", status); return false; }
+      if (!Runtime()->SignalAcquire(1, &p->completion_signal)) { return false; }
+      signalsInUse++;
       context->Put(dispatchId, "packetcompletionsig", Value(MV_UINT64, p->completion_signal.handle));
 
       p->workgroup_size_x = context->GetValue(dispatchId, "workgroupSize[0]").U16();
@@ -776,7 +828,6 @@ class ImageRegionMatcher {
       d->kernel = kernel;
       d->packetId = packetId;
       d->packet = p;
-      d->timeout = TIMEOUT * CLOCKS_PER_SEC;
       d->kernargOffset = 0;
       d->kernargAddr = p->kernarg_address;
       d->completionSignal = p->completion_signal;
@@ -867,7 +918,7 @@ class ImageRegionMatcher {
       HsailDispatch* d = context->Get<HsailDispatch>(dispatchId);
       assert(d);
 
-      hsa_queue_t* queue = Runtime()->Queue();
+      hsa_queue_t* queue = Runtime()->Queue(worker);
 
       // Notify.
       uint16_t header = (1 << HSA_PACKET_HEADER_BARRIER) |
@@ -879,17 +930,28 @@ class ImageRegionMatcher {
       Runtime()->Hsa()->hsa_signal_store_release(queue->doorbell_signal, d->packetId);
 
       // Wait for kernel completion.
-      hsa_signal_value_t result;
-      clock_t beg = clock();
-      do {
-        result = Runtime()->Hsa()->hsa_signal_wait_acquire(d->completionSignal, HSA_SIGNAL_CONDITION_EQ, 0, d->timeout, HSA_WAIT_STATE_ACTIVE);
-        clock_t clocks = clock() - beg;
-        if (clocks > (clock_t) d->timeout && result != 0) {
-          context->Error() << "Kernel execution timed out, elapsed time: " << (long) clocks << " clocks (clocks per second " << (long) CLOCKS_PER_SEC << ")" << std::endl;
-          return false;
-        }
-      } while (result!= 0 && !runtime->IsQueueError());
-      return !runtime->IsQueueError();
+      TestClock::time_point beg = TestClock::now();
+      hsa_signal_value_t result = Runtime()->SignalWaitTimeout(d->completionSignal, HSA_SIGNAL_CONDITION_EQ, 0, TIMEOUT,
+        [this]() { return AnyQueueError(); });
+      hsa_status_t queueStatus;
+      bool queueError = AnyQueueError(&queueStatus);
+      if (result != 0 && !queueError) {
+        context->Error() << "Kernel execution timed out, elapsed time: " << ElapsedSeconds(beg) << "s" << std::endl;
+        context->Error() << "Queue " << queue->id <<
+          ": read index " << Runtime()->Hsa()->hsa_queue_load_read_index_relaxed(queue) <<
+          ", write index " << Runtime()->Hsa()->hsa_queue_load_write_index_relaxed(queue) <<
+          ", packet id " << d->packetId <<
+          ", completion signal value " << result << std::endl;
+        dispatchIncomplete = true;
+        return false;
+      }
+      if (queueError) {
+        HsaError("Queue error", queueStatus);
+        dispatchIncomplete = true;
+        return false;
+      }
+      d->completed = true;
+      return true;
     }
 
     class HsailSignal {
@@ -912,16 +974,15 @@ class ImageRegionMatcher {
 
     void SignalDestroy(hsa_signal_t signal)
     {
-      hsa_status_t status = Runtime()->Hsa()->hsa_signal_destroy(signal);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_signal_destroy failed", status); }
+      Runtime()->SignalRelease(signal, !dispatchIncomplete);
+      signalsInUse--;
     }
 
     virtual bool SignalCreate(const std::string& signalId, uint64_t signalInitialValue = 1) override
     {
-      hsa_status_t status;
       hsa_signal_t signal;
-      status = Runtime()->Hsa()->hsa_signal_create(signalInitialValue, 0, 0, &signal);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_signal_create failed", status); return false; }
+      if (!Runtime()->SignalAcquire(signalInitialValue, &signal)) { return false; }
+      signalsInUse++;
       Put(signalId, new HsailSignal(this, signal));
       return true;
     }
@@ -935,21 +996,15 @@ class ImageRegionMatcher {
 
     virtual bool SignalWait(const std::string& signalId, uint64_t expectedValue = 1) override
     {
-      uint64_t timeout = TIMEOUT * CLOCKS_PER_SEC;
       HsailSignal* signal = context->Get<HsailSignal>(signalId);
-      hsa_signal_value_t acquiredValue;
       bool result = true;
-      clock_t beg = clock();
-      do {
-        acquiredValue = Runtime()->Hsa()->hsa_signal_wait_acquire(signal->Signal(), HSA_SIGNAL_CONDITION_EQ, expectedValue, timeout, HSA_WAIT_STATE_ACTIVE);
-        clock_t clocks = clock() - beg;
-        if (clocks > (clock_t) timeout && acquiredValue != (hsa_signal_value_t) expectedValue) {
-          context->Info() << "Signal '" << signalId << "' wait timed out, elapsed time: " <<
-            (uint64_t)clocks << " clocks (clocks per second " << (uint64_t)CLOCKS_PER_SEC << ")" << std::endl;
-          result = false;
-          break;
-        }
-      } while ((hsa_signal_value_t) expectedValue != acquiredValue);
+      TestClock::time_point beg = TestClock::now();
+      hsa_signal_value_t acquiredValue = Runtime()->SignalWaitTimeout(signal->Signal(), HSA_SIGNAL_CONDITION_EQ, expectedValue, TIMEOUT);
+      if (acquiredValue != (hsa_signal_value_t) expectedValue) {
+        context->Info() << "Signal '" << signalId << "' wait timed out, elapsed time: " <<
+          ElapsedSeconds(beg) << "s" << std::endl;
+        result = false;
+      }
       context->Info() << "Signal '" << signalId << "' handle: " << std::hex << signal->Signal().handle << std::dec
                       << ", expected value: " << expectedValue << ", acquired value: " << acquiredValue << std::endl;
       return result;
@@ -958,44 +1013,52 @@ class ImageRegionMatcher {
     class HsailQueue {
     private:
       HsailRuntimeContextState* rt;
-      hsa_queue_t* queue;
+      HsailRuntimeContext::WorkerQueue* wq;
 
     public:
-      HsailQueue(HsailRuntimeContextState* rt_, hsa_queue_t* queue_)
-        : rt(rt_), queue(queue_) { }
+      HsailQueue(HsailRuntimeContextState* rt_, HsailRuntimeContext::WorkerQueue* wq_)
+        : rt(rt_), wq(wq_) { }
       ~HsailQueue()
       {
 #ifndef _WIN32
-        rt->QueueDestroy(queue);
+        rt->QueueDestroy(wq);
 #endif // _WIN32
       }
 
-      hsa_queue_t* Queue() { return queue; }
+      hsa_queue_t* Queue() { return wq->queue; }
     };
 
-    void QueueDestroy(hsa_queue_t* queue)
+    void QueueDestroy(HsailRuntimeContext::WorkerQueue* wq)
     {
-      hsa_status_t status = Runtime()->Hsa()->hsa_queue_destroy(queue);
-      if (status != HSA_STATUS_SUCCESS) { Runtime()->HsaError("hsa_queue_destroy failed", status); }
+      {
+        std::lock_guard<std::mutex> lock(testQueuesMutex);
+        testQueues.erase(std::find(testQueues.begin(), testQueues.end(), wq));
+      }
+      // Queue in error is not reused by QueueRelease. Tests may expect the
+      // error (see IsQueueError), so it is only logged.
+      if (wq->error) { HsaError("Queue error", wq->errorStatus); }
+      Runtime()->QueueRelease(wq);
+      queuesInUse--;
     }
 
     virtual bool QueueCreate(const std::string& queueId, uint32_t size = 0) override
     {
-      hsa_queue_t* queue;
       hsa_status_t status;
       if (size == 0) {
         status = Runtime()->Hsa()->hsa_agent_get_info(runtime->Agent(), HSA_AGENT_INFO_QUEUE_MAX_SIZE, &size);
         if (status != HSA_STATUS_SUCCESS) {
-          runtime->HsaError("hsa_agent_get_info failed", status);
+          HsaError("hsa_agent_get_info failed", status);
           return false;
         }
       }
-      status = Runtime()->Hsa()->hsa_queue_create(runtime->Agent(), size, HSA_QUEUE_TYPE_MULTI, HsaQueueErrorCallback, runtime, UINT32_MAX, UINT32_MAX, &queue);
-      if (status != HSA_STATUS_SUCCESS) {
-        runtime->HsaError("hsa_queue_create failed", status);
-        return false;
+      HsailRuntimeContext::WorkerQueue* wq = Runtime()->QueueAcquire(size);
+      if (!wq) { return false; }
+      queuesInUse++;
+      {
+        std::lock_guard<std::mutex> lock(testQueuesMutex);
+        testQueues.push_back(wq);
       }
-      Put(queueId, new HsailQueue(this, queue));
+      Put(queueId, new HsailQueue(this, wq));
       return true;
     }
 
@@ -1035,7 +1098,7 @@ class ImageRegionMatcher {
 
     virtual bool IsQueueError() override
     {
-      return Runtime()->IsQueueError();
+      return AnyQueueError();
     }
   };
 
@@ -1048,48 +1111,75 @@ class ImageRegionMatcher {
 HsailRuntimeContext::HsailRuntimeContext(Context* context)
   : RuntimeContext(context),
     hsaApi(context, context->Opts(), context->Opts()->GetString("rtlib", HSARUNTIMEDEFAULTNAME)),
-    queue(0), queueSize(0), queueError(false)
+    queueSize(0),
+    codeCacheEnabled(context->Opts()->GetString("codecache", "on") != "off"),
+    codeCacheDir(context->Opts()->GetString("codecachedir", "")),
+    codeCacheSeed(0), codeCacheHits(0), codeCacheDiskHits(0), codeCacheMisses(0),
+    kernargsLeaked(0), kernargsAbandoned(0),
+    bufferPoolBytes(0),
+    timestampFrequency(0),
+    waitSpin(context->Opts()->GetUnsigned("waitspin", 100))
 {
+  std::string mode = context->Opts()->GetString("bufferpool", "on");
+  if (mode == "off") { bufferPoolMode = BUFFER_POOL_OFF; }
+  else if (mode == "poison") { bufferPoolMode = BUFFER_POOL_POISON; }
+  else if (mode == "guard") { bufferPoolMode = BUFFER_POOL_GUARD; }
+  else { bufferPoolMode = BUFFER_POOL_ON; }
 }
 
 runtime::RuntimeState* HsailRuntimeContext::NewState(Context* context)
 {
-  this->context = context;
-  return new HsailRuntimeContextState(this, context, context->Opts()->GetUnsigned("timeout", HSAILRUNTIMEDEFAULTTIMEOUT));
+  // Each test runner worker dispatches to its own queue, so that tests
+  // running concurrently do not share queue and error state.
+  unsigned worker = context->Contains(CK_WORKER) ? context->GetValue(CK_WORKER).U32() : 0;
+  return new HsailRuntimeContextState(this, context, worker, TestTimeout(context, HSAILRUNTIMEDEFAULTTIMEOUT));
 }
 
-void HsailRuntimeContext::QueueDestroy()
+HsailRuntimeContext::WorkerQueue* HsailRuntimeContext::GetWorkerQueue(unsigned worker)
 {
-  assert(queue);
+  std::lock_guard<std::mutex> lock(queuesMutex);
+  while (queues.size() <= worker) {
+    queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue(this)));
+  }
+  return queues[worker].get();
+}
+
+void HsailRuntimeContext::QueueDestroy(WorkerQueue* wq)
+{
+  assert(wq->queue);
   hsa_status_t status;
-  status = Hsa()->hsa_queue_destroy(queue);
+  status = Hsa()->hsa_queue_destroy(wq->queue);
   if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_queue_destroy failed", status); }
-  queue = 0;
+  wq->queue = 0;
 }
 
-bool HsailRuntimeContext::QueueInit()
+bool HsailRuntimeContext::QueueInit(WorkerQueue* wq)
 {
-  assert(!queue);
-  hsa_status_t status = Hsa()->hsa_queue_create(agent, queueSize, HSA_QUEUE_TYPE_SINGLE, HsaQueueErrorCallback, this, UINT32_MAX, UINT32_MAX, &queue);
-  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_queue_create failed", status); return false; }
+  assert(!wq->queue);
+  hsa_status_t status = Hsa()->hsa_queue_create(agent, queueSize, HSA_QUEUE_TYPE_SINGLE, HsaQueueErrorCallback, wq, UINT32_MAX, UINT32_MAX, &wq->queue);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_queue_create failed", status); wq->queue = 0; return false; }
   return true;
 }
 
-void HsailRuntimeContext::QueueError(hsa_status_t status)
+void HsailRuntimeContext::QueueError(WorkerQueue* wq, hsa_status_t status)
 {
   // Note: cannot simply do QueueError here because of cleanup of other resource.
   // That's why queue restart is done in DispatchCreate after previous test
   // has already completed. Here. simply note the fact that queue is in error state.
-  HsaError("Queue error", status);
-  queueError = true;
+  // The error is reported to the test log by the state which dispatches to
+  // the queue or created it (see HsailRuntimeContextState::AnyQueueError).
+  wq->errorStatus = status;
+  wq->error = true;
 }
 
-hsa_queue_t* HsailRuntimeContext::QueueNoError()
+hsa_queue_t* HsailRuntimeContext::QueueNoError(unsigned worker)
 {
-  if (queueError && queue) { QueueDestroy(); }
-  if (!queue) { QueueInit(); }
-  queueError = false;
-  return queue;
+  WorkerQueue* wq = GetWorkerQueue(worker);
+  if (wq->error && wq->queue) { QueueDestroy(wq); }
+  if (!wq->queue) { QueueInit(wq); }
+  wq->error = false;
+  wq->errorStatus = HSA_STATUS_SUCCESS;
+  return wq->queue;
 }
 
 static hsa_status_t IterateAgentGetHsaDevice(hsa_agent_t agent, void *data) {
@@ -1140,6 +1230,8 @@ hsa_status_t IterateExecutableSymbolsGetKernel(hsa_executable_t executable, hsa_
   return HSA_STATUS_SUCCESS;
 }
 
+static const unsigned KERNARG_ARENA_DEFAULT_SIZE = 1024 * 1024;
+
 bool HsailRuntimeContext::Init() {
   if (!hsaApi.Init()) { return false; }
   hsa_status_t status;
@@ -1151,7 +1243,7 @@ bool HsailRuntimeContext::Init() {
   if (!agent.handle) { HsaError("Failed to find agent"); return false; }
   status = Hsa()->hsa_agent_get_info(agent, HSA_AGENT_INFO_QUEUE_MAX_SIZE, &queueSize);
   if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_agent_get_info failed", status); return false; }
-  if (!QueueInit()) { return false; }
+  if (!QueueInit(GetWorkerQueue(0))) { return false; }
 
   status = Hsa()->hsa_agent_get_info(agent, HSA_AGENT_INFO_PROFILE, &profile);
   if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_agent_get_info failed", status); return false; }
@@ -1170,6 +1262,24 @@ bool HsailRuntimeContext::Init() {
   systemRegion = GetRegion(RegionMatchSystem);
   if (!systemRegion.handle) { context->Error() << "Failed to find system region" << std::endl; return false; }
 
+  if (codeCacheEnabled && !CodeCacheInit()) { return false; }
+
+  status = Hsa()->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY, &timestampFrequency);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY) failed", status); return false; }
+  if (timestampFrequency == 0) { timestampFrequency = 1000000000; }
+
+  size_t arenaSize = context->Opts()->GetUnsigned("kernargarena", KERNARG_ARENA_DEFAULT_SIZE);
+  if (arenaSize > 0) {
+    size_t maxSize = 0;
+    status = Hsa()->hsa_region_get_info(kernargRegion, HSA_REGION_INFO_ALLOC_MAX_SIZE, &maxSize);
+    if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_region_get_info(HSA_REGION_INFO_ALLOC_MAX_SIZE) failed", status); return false; }
+    arenaSize = (std::min)(arenaSize, maxSize);
+    void* arena = 0;
+    status = Hsa()->hsa_memory_allocate(kernargRegion, arenaSize, &arena);
+    if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_allocate(kernargRegion) failed", status); return false; }
+    kernargArena.Init(arena, arenaSize);
+  }
+
   context->Put("queueid", Value(MV_UINT32, Queue()->id));
   context->Put("queueptr", Value(context->IsLarge() ? MV_UINT64 : MV_UINT32, (uintptr_t) Queue()));
   return true;
@@ -1178,12 +1288,507 @@ bool HsailRuntimeContext::Init() {
 void HsailRuntimeContext::Dispose()
 {
   if (context) {
-    QueueDestroy();
+    for (std::unique_ptr<WorkerQueue>& wq : queues) {
+      if (wq->queue) { QueueDestroy(wq.get()); }
+    }
+    queues.clear();
+#ifndef _WIN32
+    for (auto& c : codeCache) {
+      hsa_status_t status = Hsa()->hsa_code_object_destroy(c.second);
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_code_object_destroy failed", status); }
+    }
+#endif // _WIN32
+    codeCache.clear();
+#ifndef _WIN32
+    for (hsa_signal_t signal : signalPool) {
+      hsa_status_t status = Hsa()->hsa_signal_destroy(signal);
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_signal_destroy failed", status); }
+    }
+    for (auto& q : queuePool) { QueueDestroy(q.second.get()); }
+    for (auto& c : bufferPool) {
+      for (const HostBuffer& buffer : c.second) { HostBufferFree(buffer); }
+    }
+    if (kernargArena.Base()) {
+      hsa_status_t status = Hsa()->hsa_memory_free(kernargArena.Base());
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_free(kernarg arena) failed", status); }
+    }
+#endif // _WIN32
+    signalPool.clear();
+    queuePool.clear();
+    bufferPool.clear();
+    bufferPoolBytes = 0;
+    kernargArena.Init(0, 0);
     Hsa()->hsa_shut_down();
     context = 0;
   }
 }
 
+static const size_t CODE_CACHE_MAX_SIZE = 4096;
+
+bool HsailRuntimeContext::CodeCacheInit()
+{
+  hsa_isa_t isa;
+  hsa_status_t status = Hsa()->hsa_agent_get_info(agent, HSA_AGENT_INFO_ISA, &isa);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_agent_get_info(HSA_AGENT_INFO_ISA) failed", status); return false; }
+  uint32_t isaNameLength = 0;
+  status = Hsa()->hsa_isa_get_info(isa, HSA_ISA_INFO_NAME_LENGTH, 0, &isaNameLength);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_isa_get_info(HSA_ISA_INFO_NAME_LENGTH) failed", status); return false; }
+  std::vector<char> isaName(isaNameLength + 1, 0);
+  status = Hsa()->hsa_isa_get_info(isa, HSA_ISA_INFO_NAME, 0, &isaName[0]);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_isa_get_info(HSA_ISA_INFO_NAME) failed", status); return false; }
+  codeCacheSeed = HashBytes(&isaName[0], isaNameLength);
+  // Code objects on disk may be reused only with the same finalizer.
+  if (!codeCacheDir.empty()) {
+    std::string fingerprint = Fingerprint();
+    codeCacheSeed = HashBytes(fingerprint.data(), fingerprint.size(), codeCacheSeed);
+  }
+  return true;
+}
+
+uint64_t HsailRuntimeContext::CodeCacheKey(uint64_t programHash) const
+{
+  return HashBytes(&programHash, sizeof(programHash), codeCacheSeed);
+}
+
+std::string HsailRuntimeContext::CodeCacheFileName(uint64_t key) const
+{
+  std::ostringstream name;
+  name << codeCacheDir << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".hco";
+  return name.str();
+}
+
+static hsa_status_t CodeObjectAlloc(size_t size, hsa_callback_data_t data, void **address)
+{
+  *address = malloc(size);
+  return *address ? HSA_STATUS_SUCCESS : HSA_STATUS_ERROR_OUT_OF_RESOURCES;
+}
+
+bool HsailRuntimeContext::CodeCacheFind(uint64_t key, hsa_code_object_t& code)
+{
+  std::lock_guard<std::mutex> lock(codeCacheMutex);
+  auto c = codeCache.find(key);
+  if (c != codeCache.end()) {
+    code = c->second;
+    codeCacheHits++;
+    return true;
+  }
+  if (!codeCacheDir.empty() && codeCache.size() < CODE_CACHE_MAX_SIZE) {
+    std::string data = LoadBinaryFile(CodeCacheFileName(key));
+    if (!data.empty() &&
+        Hsa()->hsa_code_object_deserialize(&data[0], data.size(), "", &code) == HSA_STATUS_SUCCESS) {
+      codeCache[key] = code;
+      codeCacheDiskHits++;
+      return true;
+    }
+  }
+  codeCacheMisses++;
+  return false;
+}
+
+bool HsailRuntimeContext::CodeCacheAdd(uint64_t key, hsa_code_object_t code)
+{
+  std::lock_guard<std::mutex> lock(codeCacheMutex);
+  if (!codeCacheDir.empty()) {
+    void* data = 0;
+    size_t size = 0;
+    hsa_callback_data_t callbackData = { 0 };
+    hsa_status_t status = Hsa()->hsa_code_object_serialize(code, CodeObjectAlloc, callbackData, "", &data, &size);
+    if (status != HSA_STATUS_SUCCESS) {
+      HsaError("hsa_code_object_serialize failed", status);
+    } else {
+      // Several runner processes may write the same code object.
+      std::string fileName = CodeCacheFileName(key);
+#ifdef _WIN32
+      std::string tmpName = fileName + "." + std::to_string(_getpid());
+#else // _WIN32
+      std::string tmpName = fileName + "." + std::to_string(getpid());
+#endif // _WIN32
+      {
+        std::ofstream out(tmpName.c_str(), std::ofstream::binary);
+        out.write(static_cast<const char*>(data), size);
+      }
+      if (std::rename(tmpName.c_str(), fileName.c_str()) != 0) { std::remove(tmpName.c_str()); }
+      free(data);
+    }
+  }
+  if (codeCache.size() >= CODE_CACHE_MAX_SIZE || codeCache.find(key) != codeCache.end()) { return false; }
+  codeCache[key] = code;
+  return true;
+}
+
+static void PrintPoolStats(std::ostream& out, const char* name, const HsailRuntimeContext::PoolStats& stats)
+{
+  out << name << ": " << stats.created << " created, " << stats.reused << " reused, " <<
+    stats.destroyed << " not reusable";
+  if (stats.leaked > 0) { out << ", " << stats.leaked << " leaked"; }
+  out << std::endl;
+}
+
+void HsailRuntimeContext::PrintStats(std::ostream& out)
+{
+  if (codeCacheEnabled) {
+    std::lock_guard<std::mutex> lock(codeCacheMutex);
+    out << "Code object cache: " << codeCacheHits << " hits, " << codeCacheDiskHits << " loaded from disk, " <<
+      codeCacheMisses << " misses" << std::endl;
+  }
+  if (kernargArena.Base()) {
+    out << "Kernarg arena: " << kernargArena.Allocations() << " allocations, peak " << kernargArena.Peak() <<
+      " of " << kernargArena.Size() << " bytes, " << kernargArena.Fallbacks() << " allocated from region" << std::endl;
+  }
+  std::lock_guard<std::mutex> lock(poolMutex);
+  PrintPoolStats(out, "Signals", signalStats);
+  PrintPoolStats(out, "Queues", queueStats);
+  if (bufferPoolMode != BUFFER_POOL_OFF) { PrintPoolStats(out, "Host buffers", bufferStats); }
+  if (kernargsLeaked > 0 || kernargsAbandoned > 0) {
+    out << "Kernarg segments: " << kernargsLeaked << " leaked, " << kernargsAbandoned << " not freed after incomplete dispatch" << std::endl;
+  }
+}
+
+void KernargArena::Init(void* base, size_t size)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->base = (char*) base;
+  this->size = size;
+  freeRanges.clear();
+  usedRanges.clear();
+  if (size > 0) { freeRanges[0] = size; }
+  used = 0;
+}
+
+void* KernargArena::Allocate(size_t size, size_t alignment)
+{
+  alignment = (std::max)(alignment, ALIGNMENT);
+  size = ((size + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto r = freeRanges.begin(); r != freeRanges.end(); ++r) {
+    uintptr_t address = (uintptr_t) (base + r->first);
+    size_t padding = (size_t) (((address + alignment - 1) / alignment) * alignment - address);
+    if (r->second < padding + size) { continue; }
+    size_t offset = r->first + padding;
+    if (r->second > padding + size) { freeRanges[offset + size] = r->second - padding - size; }
+    if (padding > 0) { r->second = padding; } else { freeRanges.erase(r); }
+    usedRanges[offset] = size;
+    used += size;
+    peak = (std::max)(peak, used);
+    allocations++;
+    return base + offset;
+  }
+  return 0;
+}
+
+bool KernargArena::Free(void* ptr)
+{
+  if (!base || (char*) ptr < base || (char*) ptr >= base + size) { return false; }
+  std::lock_guard<std::mutex> lock(mutex);
+  auto u = usedRanges.find((char*) ptr - base);
+  assert(u != usedRanges.end());
+  size_t offset = u->first, length = u->second;
+  usedRanges.erase(u);
+  used -= length;
+  auto next = freeRanges.lower_bound(offset);
+  if (next != freeRanges.end() && offset + length == next->first) {
+    length += next->second;
+    next = freeRanges.erase(next);
+  }
+  if (next != freeRanges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += length;
+      return true;
+    }
+  }
+  freeRanges[offset] = length;
+  return true;
+}
+
+bool HsailRuntimeContext::KernargAllocate(size_t size, size_t alignment, void** ptr)
+{
+  if (kernargArena.Base()) {
+    *ptr = kernargArena.Allocate(size, alignment);
+    if (*ptr) { return true; }
+    kernargArena.AddFallback();
+  }
+  hsa_status_t status = Hsa()->hsa_memory_allocate(kernargRegion, size, ptr);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_allocate(kernargRegion) failed", status); return false; }
+  return true;
+}
+
+void HsailRuntimeContext::KernargFree(void* ptr, bool reusable)
+{
+  if (!ptr) { return; }
+  if (!reusable) {
+    // Kernel of incomplete dispatch may still read the segment. Arena
+    // range stays allocated until the arena is freed.
+    std::lock_guard<std::mutex> lock(poolMutex);
+    kernargsAbandoned++;
+    return;
+  }
+  if (kernargArena.Free(ptr)) { return; }
+  hsa_status_t status = Hsa()->hsa_memory_free(ptr);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_free(kernarg) failed", status); }
+}
+
+static const size_t SIGNAL_POOL_MAX_SIZE = 1024;
+static const size_t QUEUE_POOL_MAX_SIZE = 16;
+
+bool HsailRuntimeContext::SignalAcquire(hsa_signal_value_t initialValue, hsa_signal_t* signal)
+{
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!signalPool.empty()) {
+      *signal = signalPool.back();
+      signalPool.pop_back();
+      signalStats.reused++;
+      Hsa()->hsa_signal_store_relaxed(*signal, initialValue);
+      return true;
+    }
+    signalStats.created++;
+  }
+  hsa_status_t status = Hsa()->hsa_signal_create(initialValue, 0, 0, signal);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_signal_create failed", status); return false; }
+  return true;
+}
+
+void HsailRuntimeContext::SignalRelease(hsa_signal_t signal, bool reusable)
+{
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (reusable && signalPool.size() < SIGNAL_POOL_MAX_SIZE) {
+      signalPool.push_back(signal);
+      return;
+    }
+    signalStats.destroyed++;
+  }
+  hsa_status_t status = Hsa()->hsa_signal_destroy(signal);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_signal_destroy failed", status); }
+}
+
+HsailRuntimeContext::WorkerQueue* HsailRuntimeContext::QueueAcquire(uint32_t size)
+{
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    auto q = queuePool.find(size);
+    if (q != queuePool.end()) {
+      WorkerQueue* wq = q->second.release();
+      queuePool.erase(q);
+      queueStats.reused++;
+      return wq;
+    }
+    queueStats.created++;
+  }
+  std::unique_ptr<WorkerQueue> wq(new WorkerQueue(this));
+  hsa_status_t status = Hsa()->hsa_queue_create(agent, size, HSA_QUEUE_TYPE_MULTI, HsaQueueErrorCallback, wq.get(), UINT32_MAX, UINT32_MAX, &wq->queue);
+  if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_queue_create failed", status); return 0; }
+  wq->initial = *wq->queue;
+  return wq.release();
+}
+
+void HsailRuntimeContext::QueueRelease(WorkerQueue* wq)
+{
+  std::unique_ptr<WorkerQueue> q(wq);
+  // Read index cannot be reset, so only queues which were not used for
+  // dispatch are reused.
+  bool reusable = !q->error &&
+    Hsa()->hsa_queue_load_read_index_relaxed(q->queue) == 0 &&
+    Hsa()->hsa_queue_load_write_index_relaxed(q->queue) == 0 &&
+    memcmp(&q->initial, q->queue, sizeof(hsa_queue_t)) == 0;
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (reusable && queuePool.size() < QUEUE_POOL_MAX_SIZE) {
+      uint32_t size = q->queue->size;
+      queuePool.insert(std::make_pair(size, std::move(q)));
+      return;
+    }
+    queueStats.destroyed++;
+  }
+  QueueDestroy(q.get());
+}
+
+static const size_t BUFFER_POOL_MIN_SIZE = 256;
+static const size_t BUFFER_POOL_MAX_CLASS = 16 * 1024 * 1024;
+static const size_t BUFFER_POOL_MAX_BYTES = 256 * 1024 * 1024;
+static const uint8_t BUFFER_POISON = 0xA5;
+
+/// Size of pooled buffer for requested size: power of two, or multiple of
+/// minimum size for guarded buffers. Returns 0 if buffer is not pooled.
+size_t HsailRuntimeContext::BufferPoolSize(size_t size) const
+{
+  size = (std::max)(size, BUFFER_POOL_MIN_SIZE);
+  if (bufferPoolMode == BUFFER_POOL_OFF || size > BUFFER_POOL_MAX_CLASS) { return 0; }
+  if (bufferPoolMode == BUFFER_POOL_GUARD && profile == HSA_PROFILE_FULL) {
+    return ((size + BUFFER_POOL_MIN_SIZE - 1) / BUFFER_POOL_MIN_SIZE) * BUFFER_POOL_MIN_SIZE;
+  }
+  size_t c = BUFFER_POOL_MIN_SIZE;
+  while (c < size) { c <<= 1; }
+  return c;
+}
+
+bool HsailRuntimeContext::HostBufferAllocate(size_t size, HostBuffer& buffer)
+{
+  hsa_status_t status;
+  buffer.size = size;
+  switch (profile) {
+  case HSA_PROFILE_FULL:
+    if (bufferPoolMode == BUFFER_POOL_GUARD) {
+      // Buffer ends at a page without access, so writes beyond it fault.
+#ifdef _WIN32
+      SYSTEM_INFO si;
+      GetSystemInfo(&si);
+      size_t page = si.dwPageSize;
+#else
+      size_t page = (size_t) sysconf(_SC_PAGESIZE);
+#endif // _WIN32
+      size_t dataSize = ((size + page - 1) / page) * page;
+      buffer.mapSize = dataSize + page;
+#ifdef _WIN32
+      buffer.base = VirtualAlloc(0, buffer.mapSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+      DWORD oldProtect;
+      if (!buffer.base || !VirtualProtect((char*) buffer.base + dataSize, page, PAGE_NOACCESS, &oldProtect)) {
+        context->Error() << "Failed to allocate guarded buffer" << std::endl;
+        if (buffer.base) { VirtualFree(buffer.base, 0, MEM_RELEASE); }
+        return false;
+      }
+#else
+      buffer.base = mmap(0, buffer.mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (buffer.base == MAP_FAILED || mprotect((char*) buffer.base + dataSize, page, PROT_NONE) != 0) {
+        context->Error() << "Failed to allocate guarded buffer" << std::endl;
+        if (buffer.base != MAP_FAILED) { munmap(buffer.base, buffer.mapSize); }
+        return false;
+      }
+#endif // _WIN32
+      buffer.ptr = (char*) buffer.base + dataSize - size;
+    } else {
+      buffer.ptr = alignedMalloc(size, 256);
+    }
+    status = Hsa()->hsa_memory_register(buffer.ptr, size);
+    if (status != HSA_STATUS_SUCCESS) {
+      HsaError("hsa_memory_register failed", status);
+      HostBuffer unregistered = buffer;
+      unregistered.size = 0;
+      HostBufferFree(unregistered);
+      return false;
+    }
+    return true;
+  case HSA_PROFILE_BASE:
+    status = Hsa()->hsa_memory_allocate(systemRegion, size, &buffer.ptr);
+    if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_allocate failed", status); return false; }
+    return true;
+  default:
+    assert(false); return false;
+  }
+}
+
+void HsailRuntimeContext::HostBufferFree(const HostBuffer& buffer)
+{
+  hsa_status_t status;
+  switch (profile) {
+  case HSA_PROFILE_FULL:
+    if (buffer.size > 0) {
+      status = Hsa()->hsa_memory_deregister(buffer.ptr);
+      if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_deregister failed", status); }
+    }
+    if (buffer.base) {
+#ifdef _WIN32
+      VirtualFree(buffer.base, 0, MEM_RELEASE);
+#else
+      munmap(buffer.base, buffer.mapSize);
+#endif // _WIN32
+    } else {
+      alignedFree(buffer.ptr);
+    }
+    break;
+  case HSA_PROFILE_BASE:
+    status = Hsa()->hsa_memory_free(buffer.ptr);
+    if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_memory_free failed", status); }
+    break;
+  default:
+    assert(false); return;
+  }
+}
+
+bool HsailRuntimeContext::BufferAcquire(size_t size, HostBuffer& buffer)
+{
+  size_t poolSize = BufferPoolSize(size);
+  bool reused = false;
+  if (poolSize > 0) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    auto c = bufferPool.find(poolSize);
+    if (c != bufferPool.end() && !c->second.empty()) {
+      buffer = c->second.back();
+      c->second.pop_back();
+      bufferPoolBytes -= buffer.size;
+      bufferStats.reused++;
+      reused = true;
+    } else {
+      bufferStats.created++;
+    }
+  }
+  if (!reused) {
+    size_t allocSize = poolSize > 0 ? poolSize : (std::max)(size, BUFFER_POOL_MIN_SIZE);
+    if (!HostBufferAllocate(allocSize, buffer)) { return false; }
+  }
+  if (bufferPoolMode == BUFFER_POOL_POISON) {
+    memset(buffer.ptr, BUFFER_POISON, buffer.size);
+  } else if (reused) {
+    memset(buffer.ptr, 0, buffer.size);
+  }
+  return true;
+}
+
+void HsailRuntimeContext::BufferRelease(const HostBuffer& buffer, bool reusable)
+{
+  if (BufferPoolSize(buffer.size) == buffer.size) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (reusable && bufferPoolBytes + buffer.size <= BUFFER_POOL_MAX_BYTES) {
+      bufferPool[buffer.size].push_back(buffer);
+      bufferPoolBytes += buffer.size;
+      return;
+    }
+    bufferStats.destroyed++;
+  }
+  HostBufferFree(buffer);
+}
+
+static bool SignalConditionSatisfied(hsa_signal_condition_t condition, hsa_signal_value_t value, hsa_signal_value_t compareValue)
+{
+  switch (condition) {
+  case HSA_SIGNAL_CONDITION_EQ: return value == compareValue;
+  case HSA_SIGNAL_CONDITION_NE: return value != compareValue;
+  case HSA_SIGNAL_CONDITION_LT: return value < compareValue;
+  case HSA_SIGNAL_CONDITION_GTE: return value >= compareValue;
+  default: assert(false); return true;
+  }
+}
+
+hsa_signal_value_t HsailRuntimeContext::SignalWaitTimeout(hsa_signal_t signal, hsa_signal_condition_t condition, hsa_signal_value_t compareValue,
+                                                          double timeout, const std::function<bool()>& stop)
+{
+  // Blocked waits return at least this often to check timeout and stop.
+  const uint64_t blockedSlice = timestampFrequency / 10;
+  TestClock::time_point begin = TestClock::now();
+  hsa_signal_value_t value;
+  for (;;) {
+    double elapsed = ElapsedSeconds(begin);
+    double spinLeft = waitSpin * 1e-6 - elapsed;
+    if (spinLeft > 0) {
+      uint64_t hint = (std::max)((uint64_t) (spinLeft * timestampFrequency), (uint64_t) 1);
+      value = Hsa()->hsa_signal_wait_acquire(signal, condition, compareValue, hint, HSA_WAIT_STATE_ACTIVE);
+    } else {
+      value = Hsa()->hsa_signal_wait_acquire(signal, condition, compareValue, blockedSlice, HSA_WAIT_STATE_BLOCKED);
+    }
+    if (SignalConditionSatisfied(condition, value, compareValue)) { return value; }
+    if ((stop && stop()) || ElapsedSeconds(begin) > timeout) { return value; }
+  }
+}
+
+void HsailRuntimeContext::AddLeaks(unsigned signals, unsigned queues, unsigned kernargs)
+{
+  std::lock_guard<std::mutex> lock(poolMutex);
+  signalStats.leaked += signals;
+  queueStats.leaked += queues;
+  kernargsLeaked += kernargs;
+}
+
 hsa_region_t HsailRuntimeContext::GetRegion(RegionMatch match)
 {
   hsa_region_t region;
@@ -1533,6 +2138,19 @@ void HsailRuntimeContext::PrintInfo(std::ostream& out)
   if (status != HSA_STATUS_SUCCESS) { HsaError("hsa_iterate_agents failed", status); return; }
 }
 
+std::string HsailRuntimeContext::Fingerprint()
+{
+  // Runtime library is identified by its contents, device by system and
+  // agent info.
+  std::string libFileName = hsaApi.LibraryFileName("hsa_init");
+  std::string lib = LoadBinaryFile(libFileName);
+  std::ostringstream out;
+  out << Description() << std::endl;
+  out << libFileName << " " << std::hex << HashBytes(lib.data(), lib.size()) << std::dec << std::endl;
+  PrintInfo(out);
+  return out.str();
+}
+
 #undef CHECK_HSA_STATUS
 
 bool RegionMatchKernarg(HsailRuntimeContext* runtime, hsa_region_t region)
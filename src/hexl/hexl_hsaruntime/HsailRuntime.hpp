@@ -26,6 +26,10 @@
 #include "HSAILTool.h"
 #include "HSAILBrigContainer.h"
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #define HSAILRUNTIMEDEFAULTTIMEOUT 120
 
@@ -49,6 +53,7 @@ struct HsaApiTable {
   hsa_status_t (*hsa_agent_get_exception_policies)(hsa_agent_t agent, hsa_profile_t profile, uint16_t *mask);
   hsa_status_t (*hsa_queue_create)(hsa_agent_t agent, size_t size, hsa_queue_type_t type, void (*callback)(hsa_status_t status, hsa_queue_t *queue, void *data), void *data, uint32_t private_segment_size, uint32_t group_segment_size, hsa_queue_t **queue);
   hsa_status_t (*hsa_queue_destroy)(hsa_queue_t *queue);
+  uint64_t (*hsa_queue_load_read_index_relaxed)(hsa_queue_t *queue);
   uint64_t (*hsa_queue_load_write_index_relaxed)(hsa_queue_t *queue);
   void (*hsa_queue_store_write_index_relaxed)(hsa_queue_t *queue, uint64_t value);
   uint64_t (*hsa_queue_add_write_index_relaxed)(hsa_queue_t *queue, uint64_t value);
@@ -98,6 +103,18 @@ struct HsaApiTable {
     const char *options);
   hsa_status_t (*hsa_code_object_destroy)(
     hsa_code_object_t code_object);
+  hsa_status_t (*hsa_code_object_serialize)(
+    hsa_code_object_t code_object,
+    hsa_status_t (*alloc_callback)(size_t size, hsa_callback_data_t data, void **address),
+    hsa_callback_data_t callback_data,
+    const char *options,
+    void **serialized_code_object,
+    size_t *serialized_code_object_size);
+  hsa_status_t (*hsa_code_object_deserialize)(
+    void *serialized_code_object,
+    size_t serialized_code_object_size,
+    const char *options,
+    hsa_code_object_t *code_object);
   hsa_status_t (*hsa_executable_symbol_get_info)(
     hsa_executable_symbol_t executable_symbol,
     hsa_executable_symbol_info_t attribute,
@@ -154,21 +171,131 @@ class HsailRuntimeContext;
 
 typedef std::function<bool(HsailRuntimeContext*, hsa_region_t)> RegionMatch;
 
+/// First-fit sub-allocator of kernarg segments in one block of kernarg
+/// region (see -kernargarena). Freed ranges are coalesced, so the block is
+/// recycled as dispatches of finished tests are destroyed.
+class KernargArena {
+public:
+  static const size_t ALIGNMENT = 16;
+
+  KernargArena()
+    : base(0), size(0), used(0), peak(0), allocations(0), fallbacks(0) { }
+
+  void Init(void* base, size_t size);
+  void* Base() const { return base; }
+  /// Returns 0 if there is no free range of given size and alignment.
+  void* Allocate(size_t size, size_t alignment);
+  /// Returns false if ptr was not allocated from the arena.
+  bool Free(void* ptr);
+
+  size_t Size() const { return size; }
+  size_t Peak() const { return peak; }
+  unsigned Allocations() const { return allocations; }
+  unsigned Fallbacks() const { return fallbacks; }
+  void AddFallback() { std::lock_guard<std::mutex> lock(mutex); fallbacks++; }
+
+private:
+  std::mutex mutex;
+  char* base;
+  size_t size;
+  std::map<size_t, size_t> freeRanges, usedRanges;
+  size_t used, peak;
+  unsigned allocations, fallbacks;
+};
+
 class HsailRuntimeContext : public runtime::RuntimeContext {
+public:
+  // Dispatch queue owned by one test runner worker (see "hexl.worker"),
+  // or queue created by a test (see QueueAcquire).
+  struct WorkerQueue {
+    HsailRuntimeContext* runtime;
+    hsa_queue_t* queue;
+    volatile bool error;
+    hsa_status_t errorStatus;
+    // Queue descriptor as created, pooled queue is reused only if kernels
+    // did not modify it.
+    hsa_queue_t initial;
+
+    explicit WorkerQueue(HsailRuntimeContext* runtime_)
+      : runtime(runtime_), queue(0), error(false), errorStatus(HSA_STATUS_SUCCESS) { }
+  };
+
+  struct PoolStats {
+    unsigned created, reused, destroyed, leaked;
+
+    PoolStats() : created(0), reused(0), destroyed(0), leaked(0) { }
+  };
+
+  // Modes of host buffer pool (see -bufferpool).
+  enum BufferPoolMode {
+    BUFFER_POOL_OFF,
+    BUFFER_POOL_ON,
+    BUFFER_POOL_POISON,
+    BUFFER_POOL_GUARD,
+  };
+
+  // Host buffer of BufferCreate. Guarded buffer ends at an inaccessible
+  // page, base and mapSize describe the whole mapping.
+  struct HostBuffer {
+    void* ptr;
+    size_t size;
+    void* base;
+    size_t mapSize;
+
+    HostBuffer() : ptr(0), size(0), base(0), mapSize(0) { }
+  };
+
 private:
   HsaApi hsaApi;
   hsa_agent_t agent;
-  hsa_queue_t* queue;
+  std::mutex queuesMutex;
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
   uint32_t queueSize;
-  volatile bool queueError;
   hsa_profile_t profile;
   uint32_t wavesize;
   uint32_t wavesPerGroup;
   hsa_endianness_t endianness;
   hsa_region_t kernargRegion, systemRegion;
 
-  bool QueueInit();
-  void QueueDestroy();
+  // Finalized code objects, keyed by hash of BRIG modules and finalization
+  // parameters (see -codecache). Cached code objects are destroyed only
+  // with the runtime.
+  std::mutex codeCacheMutex;
+  std::map<uint64_t, hsa_code_object_t> codeCache;
+  bool codeCacheEnabled;
+  std::string codeCacheDir;
+  uint64_t codeCacheSeed;
+  unsigned codeCacheHits, codeCacheDiskHits, codeCacheMisses;
+
+  KernargArena kernargArena;
+
+  // Signals and queues released by finished tests, reused by later tests.
+  std::mutex poolMutex;
+  std::vector<hsa_signal_t> signalPool;
+  std::multimap<uint32_t, std::unique_ptr<WorkerQueue>> queuePool;
+  PoolStats signalStats, queueStats;
+  unsigned kernargsLeaked, kernargsAbandoned;
+
+  // Idle host buffers by size, allocated (and registered for full profile)
+  // across tests.
+  BufferPoolMode bufferPoolMode;
+  std::map<size_t, std::vector<HostBuffer>> bufferPool;
+  size_t bufferPoolBytes;
+  PoolStats bufferStats;
+
+  // Signal waits spin for waitSpin microseconds, then block (see -waitspin).
+  uint64_t timestampFrequency;
+  unsigned waitSpin;
+
+  size_t BufferPoolSize(size_t size) const;
+  bool HostBufferAllocate(size_t size, HostBuffer& buffer);
+  void HostBufferFree(const HostBuffer& buffer);
+
+  WorkerQueue* GetWorkerQueue(unsigned worker);
+  bool CodeCacheInit();
+  std::string CodeCacheFileName(uint64_t key) const;
+  bool QueueInit(WorkerQueue* wq);
+  void QueueDestroy(WorkerQueue* wq);
 
 public:
   HsailRuntimeContext(Context* context);
@@ -186,12 +313,16 @@ public:
   const Options* Opts() const { return context->Opts(); }
   virtual runtime::RuntimeState* NewState(Context* context);
 
-  void HsaError(const char *msg, hsa_status_t err) {
+  void HsaError(Context* errorContext, const char *msg, hsa_status_t err) {
     const char *hsamsg = "";
     if (Hsa()->hsa_status_string) {
       Hsa()->hsa_status_string(err, &hsamsg);
     }
-    context->Error() << msg << ": error " << err << ": " << hsamsg << std::endl;
+    errorContext->Error() << msg << ": error " << err << ": " << hsamsg << std::endl;
+  }
+
+  void HsaError(const char *msg, hsa_status_t err) {
+    HsaError(context, msg, err);
   }
 
   void HsaError(const char *msg) {
@@ -206,12 +337,13 @@ public:
   hsa_agent_t Agent() { return agent; }
   hsa_agent_t* Agents() { return &agent; }
   uint32_t AgentCount() { return 1; }
-  hsa_queue_t* Queue() { return queue; }
-  hsa_queue_t* QueueNoError();
-  void QueueError(hsa_status_t status);
-  bool IsQueueError() const { return queueError; }
+  hsa_queue_t* Queue(unsigned worker = 0) { return GetWorkerQueue(worker)->queue; }
+  hsa_queue_t* QueueNoError(unsigned worker = 0);
+  void QueueError(WorkerQueue* wq, hsa_status_t status);
+  bool IsQueueError(unsigned worker = 0) { return GetWorkerQueue(worker)->error; }
+  hsa_status_t QueueErrorStatus(unsigned worker = 0) { return GetWorkerQueue(worker)->errorStatus; }
 
-  uint32_t QueueSize() const { return queue->size; }
+  uint32_t QueueSize() { return Queue()->size; }
   const HsaApi& Hsa() const { return hsaApi; }
   hsa_region_t GetRegion(RegionMatch match = 0);
 
@@ -234,6 +366,50 @@ public:
   void PrintAgentInfo(std::ostream& out, hsa_agent_t agent);
   void PrintRegionInfo(std::ostream& out, hsa_region_t region);
   void PrintInfo(std::ostream& out);
+  void PrintStats(std::ostream& out) override;
+  std::string Fingerprint();
+
+  bool IsCodeCacheEnabled() const { return codeCacheEnabled; }
+  /// Returns key of code object finalized for the agent ISA with given
+  /// hash of program and finalization parameters.
+  uint64_t CodeCacheKey(uint64_t programHash) const;
+  /// Finds code object in memory or on disk. Found code object is owned
+  /// by the cache.
+  bool CodeCacheFind(uint64_t key, hsa_code_object_t& code);
+  /// Returns true if code object is taken by the cache, otherwise it
+  /// remains owned by the caller.
+  bool CodeCacheAdd(uint64_t key, hsa_code_object_t code);
+
+  /// Kernarg segment from the arena, or from kernarg region if the arena
+  /// is disabled or full.
+  bool KernargAllocate(size_t size, size_t alignment, void** ptr);
+  /// Segment which may still be read by the kernel (reusable is false) is
+  /// not freed.
+  void KernargFree(void* ptr, bool reusable);
+
+  /// Signal from the pool, set to initial value.
+  bool SignalAcquire(hsa_signal_value_t initialValue, hsa_signal_t* signal);
+  /// Returns signal to the pool. Signal which may still be used by the
+  /// agent (dispatch did not complete) is not reusable and is destroyed.
+  void SignalRelease(hsa_signal_t signal, bool reusable);
+  /// Idle queue of given size from the pool, or new queue. Returns 0 on
+  /// failure.
+  WorkerQueue* QueueAcquire(uint32_t size);
+  /// Returns queue to the pool if it is unused, otherwise destroys it.
+  void QueueRelease(WorkerQueue* wq);
+  /// Host buffer of at least given size from the pool, or new buffer.
+  bool BufferAcquire(size_t size, HostBuffer& buffer);
+  /// Returns buffer to the pool, or frees it if it is too large, the
+  /// pool is full or it may still be written by the agent (not reusable).
+  void BufferRelease(const HostBuffer& buffer, bool reusable);
+  /// Waits until signal value satisfies condition, at most timeout seconds
+  /// of wall time or until stop returns true. Spins first, then blocks, so
+  /// that long waits do not occupy a host core. Returns the last acquired
+  /// value.
+  hsa_signal_value_t SignalWaitTimeout(hsa_signal_t signal, hsa_signal_condition_t condition, hsa_signal_value_t compareValue,
+                                       double timeout, const std::function<bool()>& stop = std::function<bool()>());
+  /// Counts resources not released by a test.
+  void AddLeaks(unsigned signals, unsigned queues, unsigned kernargs);
 };
 
 HsailRuntimeContext* HsailRuntimeFromContext(runtime::RuntimeContext* runtime);
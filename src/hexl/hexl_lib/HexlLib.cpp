@@ -21,6 +21,9 @@
 #ifdef ENABLE_HEXL_HSARUNTIME
 #include "HsailRuntime.hpp"
 #endif // ENABLE_HEXL_HSARUNTIME
+#ifdef ENABLE_HEXL_CPURUNTIME
+#include "CpuRuntime.hpp"
+#endif // ENABLE_HEXL_CPURUNTIME
 #ifdef ENABLE_HEXL_ORCA
 #include "OrcaRuntime.hpp"
 #endif // ENABLE_HEXL_ORCA
@@ -42,6 +45,11 @@ runtime::RuntimeContext* CreateRuntimeContext(Context* context) {
     runtime = CreateHsailRuntimeContext(context);
   } else
 #endif // ENABLE_HEXL_HSARUNTIME
+#ifdef ENABLE_HEXL_CPURUNTIME
+  if (rt == "cpu") {
+    runtime = CreateCpuRuntimeContext(context);
+  } else
+#endif // ENABLE_HEXL_CPURUNTIME
 #ifdef ENABLE_HEXL_ORCA
   if (rt == "orca") {
     runtime = CreateOrcaRuntimeContext(context);
@@ -0,0 +1,803 @@
+/*
+   Copyright 2014-2015 Heterogeneous System Architecture (HSA) Foundation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Stand-in HSA runtime (libhsa-stub). Exports the entry points loaded by
+// hexl_hsaruntime, so that '-rt hsa -rtlib ./libhsa-stub.so' runs the harness
+// without an HSA agent. Kernels are not executed: dispatches complete after
+// the injected latency and tests are expected to fail validation.
+//
+// Injected latencies (microseconds) are read from the environment:
+//   HSA_STUB_DISPATCH_LATENCY_US  - time to process one dispatch packet.
+//   HSA_STUB_FINALIZE_LATENCY_US  - time to finalize a program.
+//   HSA_STUB_ALLOCATE_LATENCY_US  - time to allocate memory in a region.
+// HSA_STUB_KERNARG_SIZE sets kernarg segment size reported for kernels.
+
+#define HSA_EXPORT 1
+#ifdef _WIN32
+#define HSA_EXPORT_DECORATOR __declspec(dllexport)
+#endif
+
+#include "hsa.h"
+#include "hsa_ext_finalize.h"
+#include "hsa_ext_image.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace {
+
+const uint64_t AGENT_HANDLE = 1;
+const uint64_t ISA_HANDLE = 1;
+const uint64_t SYSTEM_REGION_HANDLE = 1;
+const uint64_t KERNARG_REGION_HANDLE = 2;
+const uint32_t QUEUE_MIN_SIZE = 64;
+const uint32_t QUEUE_MAX_SIZE = 1024;
+const size_t REGION_SIZE = (size_t) 1 << 30;
+const size_t REGION_GRANULE = 4096;
+const size_t REGION_ALIGNMENT = 4096;
+const char* const ISA_NAME = "AMD:AMDGPU:stub";
+const char* const KERNEL_NAME = "&__hsa_stub_kernel";
+
+uint64_t EnvValue(const char* name, uint64_t def)
+{
+  const char* value = getenv(name);
+  if (!value || !*value) { return def; }
+  return strtoull(value, 0, 10);
+}
+
+struct Config {
+  uint64_t dispatchLatency;
+  uint64_t finalizeLatency;
+  uint64_t allocateLatency;
+  uint32_t kernargSize;
+
+  Config()
+    : dispatchLatency(EnvValue("HSA_STUB_DISPATCH_LATENCY_US", 0)),
+      finalizeLatency(EnvValue("HSA_STUB_FINALIZE_LATENCY_US", 0)),
+      allocateLatency(EnvValue("HSA_STUB_ALLOCATE_LATENCY_US", 0)),
+      kernargSize((uint32_t) EnvValue("HSA_STUB_KERNARG_SIZE", 4096)) { }
+};
+
+const Config& Cfg()
+{
+  static Config config;
+  return config;
+}
+
+void Delay(uint64_t us)
+{
+  if (us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+}
+
+void* AlignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  void* ptr = 0;
+  if (posix_memalign(&ptr, alignment, size) != 0) { return 0; }
+  return ptr;
+#endif
+}
+
+void AlignedFree(void* ptr)
+{
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+/// Signal handle is the address of StubSignal.
+class StubSignal {
+public:
+  explicit StubSignal(hsa_signal_value_t value_)
+    : value(value_) { }
+
+  hsa_signal_t Handle() { hsa_signal_t s; s.handle = (uint64_t) (uintptr_t) this; return s; }
+  static StubSignal* FromHandle(hsa_signal_t s) { return reinterpret_cast<StubSignal*>((uintptr_t) s.handle); }
+
+  hsa_signal_value_t Load() const { return value.load(std::memory_order_acquire); }
+
+  void Store(hsa_signal_value_t v)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    value.store(v, std::memory_order_release);
+    cv.notify_all();
+  }
+
+  void Notify()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    cv.notify_all();
+  }
+
+  static bool Satisfied(hsa_signal_condition_t condition, hsa_signal_value_t v, hsa_signal_value_t compare)
+  {
+    switch (condition) {
+    case HSA_SIGNAL_CONDITION_EQ: return v == compare;
+    case HSA_SIGNAL_CONDITION_NE: return v != compare;
+    case HSA_SIGNAL_CONDITION_LT: return v < compare;
+    case HSA_SIGNAL_CONDITION_GTE: return v >= compare;
+    default: return true;
+    }
+  }
+
+  /// Timeout is in nanoseconds (see HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY).
+  hsa_signal_value_t Wait(hsa_signal_condition_t condition, hsa_signal_value_t compare, uint64_t timeout)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto satisfied = [&]() { return Satisfied(condition, value.load(std::memory_order_acquire), compare); };
+    if (timeout == UINT64_MAX) {
+      cv.wait(lock, satisfied);
+    } else {
+      cv.wait_for(lock, std::chrono::nanoseconds(timeout), satisfied);
+    }
+    return value.load(std::memory_order_acquire);
+  }
+
+private:
+  std::atomic<hsa_signal_value_t> value;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+/// User mode queue. hsa_queue_t must be the first member: the queue
+/// indices are found from its address.
+class StubQueue {
+public:
+  hsa_queue_t queue;
+  std::atomic<uint64_t> readIndex;
+  std::atomic<uint64_t> writeIndex;
+
+  StubQueue(uint32_t size, uint64_t id)
+    : readIndex(0), writeIndex(0), doorbell(-1), stop(false)
+  {
+    memset(&queue, 0, sizeof(queue));
+    queue.type = HSA_QUEUE_TYPE_MULTI;
+    queue.features = HSA_QUEUE_FEATURE_KERNEL_DISPATCH;
+    queue.size = size;
+    queue.id = id;
+    queue.doorbell_signal = doorbell.Handle();
+    packets = (hsa_kernel_dispatch_packet_t*) AlignedAlloc(size * sizeof(hsa_kernel_dispatch_packet_t), 64);
+    for (uint32_t i = 0; i < size; ++i) {
+      memset(&packets[i], 0, sizeof(hsa_kernel_dispatch_packet_t));
+      packets[i].header = HSA_PACKET_TYPE_INVALID << HSA_PACKET_HEADER_TYPE;
+    }
+    queue.base_address = packets;
+    thread = std::thread(&StubQueue::Process, this);
+  }
+
+  ~StubQueue()
+  {
+    stop.store(true);
+    doorbell.Notify();
+    thread.join();
+    AlignedFree(packets);
+  }
+
+  static StubQueue* FromQueue(const hsa_queue_t* queue) { return reinterpret_cast<StubQueue*>(const_cast<hsa_queue_t*>(queue)); }
+
+private:
+  StubSignal doorbell;
+  hsa_kernel_dispatch_packet_t* packets;
+  std::atomic<bool> stop;
+  std::thread thread;
+
+  uint16_t Header(hsa_kernel_dispatch_packet_t* p)
+  {
+    return reinterpret_cast<std::atomic<uint16_t>*>(&p->header)->load(std::memory_order_acquire);
+  }
+
+  void Process()
+  {
+    while (!stop.load()) {
+      uint64_t index = readIndex.load();
+      hsa_kernel_dispatch_packet_t* p = &packets[index % queue.size];
+      uint8_t type = (Header(p) >> HSA_PACKET_HEADER_TYPE) & ((1 << HSA_PACKET_HEADER_WIDTH_TYPE) - 1);
+      if (doorbell.Load() < (hsa_signal_value_t) index || type == HSA_PACKET_TYPE_INVALID) {
+        doorbell.Wait(HSA_SIGNAL_CONDITION_GTE, (hsa_signal_value_t) index, 1000000);
+        continue;
+      }
+      hsa_signal_t completion;
+      completion.handle = 0;
+      switch (type) {
+      case HSA_PACKET_TYPE_KERNEL_DISPATCH:
+        Delay(Cfg().dispatchLatency);
+        completion = p->completion_signal;
+        break;
+      case HSA_PACKET_TYPE_BARRIER_AND:
+      case HSA_PACKET_TYPE_BARRIER_OR:
+        completion = reinterpret_cast<hsa_barrier_and_packet_t*>(p)->completion_signal;
+        break;
+      default:
+        break;
+      }
+      reinterpret_cast<std::atomic<uint16_t>*>(&p->header)->store(HSA_PACKET_TYPE_INVALID << HSA_PACKET_HEADER_TYPE, std::memory_order_release);
+      readIndex.store(index + 1);
+      if (completion.handle) {
+        StubSignal* s = StubSignal::FromHandle(completion);
+        s->Store(s->Load() - 1);
+      }
+    }
+  }
+};
+
+struct StubProgram {
+  hsa_machine_model_t model;
+  hsa_profile_t profile;
+  hsa_default_float_rounding_mode_t rounding;
+  std::vector<hsa_ext_module_t> modules;
+};
+
+struct StubCodeObject {
+  uint32_t moduleCount;
+};
+
+struct StubSymbol {
+  std::string name;
+};
+
+struct StubExecutable {
+  hsa_executable_state_t state;
+  std::mutex mutex;
+  std::map<std::string, std::unique_ptr<StubSymbol>> symbols;
+
+  StubSymbol* Symbol(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<StubSymbol>& symbol = symbols[name];
+    if (!symbol) { symbol.reset(new StubSymbol()); symbol->name = name; }
+    return symbol.get();
+  }
+};
+
+struct StubImage {
+  void* data;
+};
+
+template <typename T>
+T* FromHandle(uint64_t handle) { return reinterpret_cast<T*>((uintptr_t) handle); }
+
+template <typename T>
+uint64_t ToHandle(T* ptr) { return (uint64_t) (uintptr_t) ptr; }
+
+std::atomic<uint64_t> queueId(0);
+std::atomic<uint64_t> samplerId(0);
+
+bool IsAgent(hsa_agent_t agent) { return agent.handle == AGENT_HANDLE; }
+
+hsa_status_t CopyString(void* value, const char* str, size_t size)
+{
+  memset(value, 0, size);
+  strncpy((char*) value, str, size - 1);
+  return HSA_STATUS_SUCCESS;
+}
+
+}
+
+hsa_status_t HSA_API hsa_status_string(hsa_status_t status, const char **status_string)
+{
+  if (!status_string) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  switch (status) {
+  case HSA_STATUS_SUCCESS: *status_string = "HSA_STATUS_SUCCESS: stub runtime"; break;
+  case HSA_STATUS_ERROR_INVALID_ARGUMENT: *status_string = "HSA_STATUS_ERROR_INVALID_ARGUMENT: stub runtime"; break;
+  case HSA_STATUS_ERROR_OUT_OF_RESOURCES: *status_string = "HSA_STATUS_ERROR_OUT_OF_RESOURCES: stub runtime"; break;
+  default: *status_string = "HSA_STATUS_ERROR: stub runtime"; break;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_init()
+{
+  Cfg();
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_shut_down()
+{
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_system_get_info(hsa_system_info_t attribute, void *value)
+{
+  if (!value) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  switch (attribute) {
+  case HSA_SYSTEM_INFO_VERSION_MAJOR: *(uint16_t*) value = 1; break;
+  case HSA_SYSTEM_INFO_VERSION_MINOR: *(uint16_t*) value = 0; break;
+  case HSA_SYSTEM_INFO_TIMESTAMP:
+    *(uint64_t*) value = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    break;
+  case HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY: *(uint64_t*) value = 1000000000; break;
+  case HSA_SYSTEM_INFO_SIGNAL_MAX_WAIT: *(uint64_t*) value = UINT64_MAX; break;
+  case HSA_SYSTEM_INFO_ENDIANNESS: *(hsa_endianness_t*) value = HSA_ENDIANNESS_LITTLE; break;
+  case HSA_SYSTEM_INFO_MACHINE_MODEL:
+    *(hsa_machine_model_t*) value = sizeof(void*) == 8 ? HSA_MACHINE_MODEL_LARGE : HSA_MACHINE_MODEL_SMALL;
+    break;
+  case HSA_SYSTEM_INFO_EXTENSIONS: memset(value, 0, 128); break;
+  default: return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_iterate_agents(hsa_status_t (*callback)(hsa_agent_t agent, void *data), void *data)
+{
+  if (!callback) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  hsa_agent_t agent;
+  agent.handle = AGENT_HANDLE;
+  hsa_status_t status = callback(agent, data);
+  return status == HSA_STATUS_INFO_BREAK ? HSA_STATUS_SUCCESS : status;
+}
+
+hsa_status_t HSA_API hsa_agent_get_info(hsa_agent_t agent, hsa_agent_info_t attribute, void *value)
+{
+  if (!IsAgent(agent) || !value) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  switch (attribute) {
+  case HSA_AGENT_INFO_NAME: return CopyString(value, "hsa-stub", 64);
+  case HSA_AGENT_INFO_VENDOR_NAME: return CopyString(value, "HSA Conformance", 64);
+  case HSA_AGENT_INFO_FEATURE: *(hsa_agent_feature_t*) value = HSA_AGENT_FEATURE_KERNEL_DISPATCH; break;
+  case HSA_AGENT_INFO_MACHINE_MODEL:
+    *(hsa_machine_model_t*) value = sizeof(void*) == 8 ? HSA_MACHINE_MODEL_LARGE : HSA_MACHINE_MODEL_SMALL;
+    break;
+  case HSA_AGENT_INFO_PROFILE: *(hsa_profile_t*) value = HSA_PROFILE_FULL; break;
+  case HSA_AGENT_INFO_DEFAULT_FLOAT_ROUNDING_MODE:
+    *(hsa_default_float_rounding_mode_t*) value = HSA_DEFAULT_FLOAT_ROUNDING_MODE_NEAR;
+    break;
+  case HSA_AGENT_INFO_BASE_PROFILE_DEFAULT_FLOAT_ROUNDING_MODES:
+    *(hsa_default_float_rounding_mode_t*) value = HSA_DEFAULT_FLOAT_ROUNDING_MODE_NEAR;
+    break;
+  case HSA_AGENT_INFO_FAST_F16_OPERATION: *(bool*) value = false; break;
+  case HSA_AGENT_INFO_WAVEFRONT_SIZE: *(uint32_t*) value = 64; break;
+  case HSA_AGENT_INFO_WORKGROUP_MAX_DIM: {
+    uint16_t* dim = (uint16_t*) value;
+    dim[0] = dim[1] = dim[2] = 256;
+    break;
+  }
+  case HSA_AGENT_INFO_WORKGROUP_MAX_SIZE: *(uint32_t*) value = 256; break;
+  case HSA_AGENT_INFO_GRID_MAX_DIM: {
+    hsa_dim3_t* dim = (hsa_dim3_t*) value;
+    dim->x = dim->y = dim->z = UINT32_MAX;
+    break;
+  }
+  case HSA_AGENT_INFO_GRID_MAX_SIZE: *(uint32_t*) value = UINT32_MAX; break;
+  case HSA_AGENT_INFO_FBARRIER_MAX_SIZE: *(uint32_t*) value = 32; break;
+  case HSA_AGENT_INFO_QUEUES_MAX: *(uint32_t*) value = 128; break;
+  case HSA_AGENT_INFO_QUEUE_MIN_SIZE: *(uint32_t*) value = QUEUE_MIN_SIZE; break;
+  case HSA_AGENT_INFO_QUEUE_MAX_SIZE: *(uint32_t*) value = QUEUE_MAX_SIZE; break;
+  case HSA_AGENT_INFO_QUEUE_TYPE: *(hsa_queue_type_t*) value = HSA_QUEUE_TYPE_MULTI; break;
+  case HSA_AGENT_INFO_NODE: *(uint32_t*) value = 0; break;
+  case HSA_AGENT_INFO_DEVICE: *(hsa_device_type_t*) value = HSA_DEVICE_TYPE_GPU; break;
+  case HSA_AGENT_INFO_CACHE_SIZE: memset(value, 0, 4 * sizeof(uint32_t)); break;
+  case HSA_AGENT_INFO_ISA: ((hsa_isa_t*) value)->handle = ISA_HANDLE; break;
+  case HSA_AGENT_INFO_EXTENSIONS: memset(value, 0, 128); break;
+  case HSA_AGENT_INFO_VERSION_MAJOR: *(uint16_t*) value = 1; break;
+  case HSA_AGENT_INFO_VERSION_MINOR: *(uint16_t*) value = 0; break;
+  default: return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_agent_get_exception_policies(hsa_agent_t agent, hsa_profile_t profile, uint16_t *mask)
+{
+  if (!IsAgent(agent) || !mask) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  *mask = 0;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_agent_iterate_regions(hsa_agent_t agent, hsa_status_t (*callback)(hsa_region_t region, void *data), void *data)
+{
+  if (!IsAgent(agent) || !callback) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  const uint64_t handles[] = { SYSTEM_REGION_HANDLE, KERNARG_REGION_HANDLE };
+  for (uint64_t handle : handles) {
+    hsa_region_t region;
+    region.handle = handle;
+    hsa_status_t status = callback(region, data);
+    if (status == HSA_STATUS_INFO_BREAK) { return HSA_STATUS_SUCCESS; }
+    if (status != HSA_STATUS_SUCCESS) { return status; }
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_region_get_info(hsa_region_t region, hsa_region_info_t attribute, void *value)
+{
+  if ((region.handle != SYSTEM_REGION_HANDLE && region.handle != KERNARG_REGION_HANDLE) || !value) {
+    return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  switch (attribute) {
+  case HSA_REGION_INFO_SEGMENT: *(hsa_region_segment_t*) value = HSA_REGION_SEGMENT_GLOBAL; break;
+  case HSA_REGION_INFO_GLOBAL_FLAGS:
+    *(uint32_t*) value = region.handle == SYSTEM_REGION_HANDLE ?
+      HSA_REGION_GLOBAL_FLAG_FINE_GRAINED :
+      (HSA_REGION_GLOBAL_FLAG_KERNARG | HSA_REGION_GLOBAL_FLAG_FINE_GRAINED);
+    break;
+  case HSA_REGION_INFO_SIZE: *(size_t*) value = REGION_SIZE; break;
+  case HSA_REGION_INFO_ALLOC_MAX_SIZE: *(size_t*) value = REGION_SIZE; break;
+  case HSA_REGION_INFO_RUNTIME_ALLOC_ALLOWED: *(bool*) value = true; break;
+  case HSA_REGION_INFO_RUNTIME_ALLOC_GRANULE: *(size_t*) value = REGION_GRANULE; break;
+  case HSA_REGION_INFO_RUNTIME_ALLOC_ALIGNMENT: *(size_t*) value = REGION_ALIGNMENT; break;
+  default: return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_memory_allocate(hsa_region_t region, size_t size, void **ptr)
+{
+  if ((region.handle != SYSTEM_REGION_HANDLE && region.handle != KERNARG_REGION_HANDLE) || !ptr) {
+    return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  if (size == 0 || size > REGION_SIZE) { return HSA_STATUS_ERROR_INVALID_ALLOCATION; }
+  Delay(Cfg().allocateLatency);
+  *ptr = AlignedAlloc(size, REGION_ALIGNMENT);
+  return *ptr ? HSA_STATUS_SUCCESS : HSA_STATUS_ERROR_OUT_OF_RESOURCES;
+}
+
+hsa_status_t HSA_API hsa_memory_free(void *ptr)
+{
+  AlignedFree(ptr);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_memory_register(void *ptr, size_t size)
+{
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_memory_deregister(void *ptr, size_t size)
+{
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_signal_create(hsa_signal_value_t initial_value, uint32_t num_consumers,
+                                       const hsa_agent_t *consumers, hsa_signal_t *signal)
+{
+  if (!signal || (num_consumers > 0 && !consumers)) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  *signal = (new StubSignal(initial_value))->Handle();
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_signal_destroy(hsa_signal_t signal)
+{
+  if (!signal.handle) { return HSA_STATUS_ERROR_INVALID_SIGNAL; }
+  delete StubSignal::FromHandle(signal);
+  return HSA_STATUS_SUCCESS;
+}
+
+void HSA_API hsa_signal_store_relaxed(hsa_signal_t signal, hsa_signal_value_t value)
+{
+  StubSignal::FromHandle(signal)->Store(value);
+}
+
+void HSA_API hsa_signal_store_release(hsa_signal_t signal, hsa_signal_value_t value)
+{
+  StubSignal::FromHandle(signal)->Store(value);
+}
+
+hsa_signal_value_t HSA_API hsa_signal_wait_acquire(hsa_signal_t signal, hsa_signal_condition_t condition,
+                                                   hsa_signal_value_t compare_value, uint64_t timeout_hint,
+                                                   hsa_wait_state_t wait_state_hint)
+{
+  return StubSignal::FromHandle(signal)->Wait(condition, compare_value, timeout_hint);
+}
+
+hsa_status_t HSA_API hsa_queue_create(hsa_agent_t agent, uint32_t size, hsa_queue_type_t type,
+                                      void (*callback)(hsa_status_t status, hsa_queue_t *source, void *data),
+                                      void *data, uint32_t private_segment_size,
+                                      uint32_t group_segment_size, hsa_queue_t **queue)
+{
+  if (!IsAgent(agent) || !queue) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  if (size < QUEUE_MIN_SIZE || size > QUEUE_MAX_SIZE || (size & (size - 1)) != 0) {
+    return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  *queue = &(new StubQueue(size, queueId++))->queue;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_queue_destroy(hsa_queue_t *queue)
+{
+  if (!queue) { return HSA_STATUS_ERROR_INVALID_QUEUE; }
+  delete StubQueue::FromQueue(queue);
+  return HSA_STATUS_SUCCESS;
+}
+
+uint64_t HSA_API hsa_queue_load_read_index_relaxed(const hsa_queue_t *queue)
+{
+  return StubQueue::FromQueue(queue)->readIndex.load(std::memory_order_relaxed);
+}
+
+uint64_t HSA_API hsa_queue_load_write_index_relaxed(const hsa_queue_t *queue)
+{
+  return StubQueue::FromQueue(queue)->writeIndex.load(std::memory_order_relaxed);
+}
+
+void HSA_API hsa_queue_store_write_index_relaxed(const hsa_queue_t *queue, uint64_t value)
+{
+  StubQueue::FromQueue(queue)->writeIndex.store(value, std::memory_order_relaxed);
+}
+
+uint64_t HSA_API hsa_queue_add_write_index_relaxed(const hsa_queue_t *queue, uint64_t value)
+{
+  return StubQueue::FromQueue(queue)->writeIndex.fetch_add(value, std::memory_order_relaxed);
+}
+
+hsa_status_t HSA_API hsa_isa_get_info(hsa_isa_t isa, hsa_isa_info_t attribute, uint32_t index, void* value)
+{
+  if (isa.handle != ISA_HANDLE || !value) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  switch (attribute) {
+  case HSA_ISA_INFO_NAME_LENGTH: *(uint32_t*) value = (uint32_t) strlen(ISA_NAME); break;
+  case HSA_ISA_INFO_NAME: memcpy(value, ISA_NAME, strlen(ISA_NAME)); break;
+  case HSA_ISA_INFO_CALL_CONVENTION_COUNT: *(uint32_t*) value = 1; break;
+  case HSA_ISA_INFO_CALL_CONVENTION_INFO_WAVEFRONT_SIZE:
+    if (index != 0) { return HSA_STATUS_ERROR_INVALID_INDEX; }
+    *(uint32_t*) value = 64;
+    break;
+  case HSA_ISA_INFO_CALL_CONVENTION_INFO_WAVEFRONTS_PER_COMPUTE_UNIT:
+    if (index != 0) { return HSA_STATUS_ERROR_INVALID_INDEX; }
+    *(uint32_t*) value = 40;
+    break;
+  default: return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_program_create(hsa_machine_model_t machine_model, hsa_profile_t profile,
+                                            hsa_default_float_rounding_mode_t default_float_rounding_mode,
+                                            const char *options, hsa_ext_program_t *program)
+{
+  if (!program) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  StubProgram* p = new StubProgram();
+  p->model = machine_model;
+  p->profile = profile;
+  p->rounding = default_float_rounding_mode;
+  program->handle = ToHandle(p);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_program_destroy(hsa_ext_program_t program)
+{
+  if (!program.handle) { return (hsa_status_t) HSA_EXT_STATUS_ERROR_INVALID_PROGRAM; }
+  delete FromHandle<StubProgram>(program.handle);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_program_add_module(hsa_ext_program_t program, hsa_ext_module_t module)
+{
+  if (!program.handle) { return (hsa_status_t) HSA_EXT_STATUS_ERROR_INVALID_PROGRAM; }
+  if (!module) { return (hsa_status_t) HSA_EXT_STATUS_ERROR_INVALID_MODULE; }
+  FromHandle<StubProgram>(program.handle)->modules.push_back(module);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_program_get_info(hsa_ext_program_t program, hsa_ext_program_info_t attribute, void *value)
+{
+  if (!program.handle) { return (hsa_status_t) HSA_EXT_STATUS_ERROR_INVALID_PROGRAM; }
+  if (!value) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  StubProgram* p = FromHandle<StubProgram>(program.handle);
+  switch (attribute) {
+  case HSA_EXT_PROGRAM_INFO_MACHINE_MODEL: *(hsa_machine_model_t*) value = p->model; break;
+  case HSA_EXT_PROGRAM_INFO_PROFILE: *(hsa_profile_t*) value = p->profile; break;
+  case HSA_EXT_PROGRAM_INFO_DEFAULT_FLOAT_ROUNDING_MODE: *(hsa_default_float_rounding_mode_t*) value = p->rounding; break;
+  default: return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_program_finalize(hsa_ext_program_t program, hsa_isa_t isa, int32_t call_convention,
+                                              hsa_ext_control_directives_t control_directives, const char *options,
+                                              hsa_code_object_type_t code_object_type, hsa_code_object_t *code_object)
+{
+  if (!program.handle) { return (hsa_status_t) HSA_EXT_STATUS_ERROR_INVALID_PROGRAM; }
+  if (isa.handle != ISA_HANDLE || !code_object) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  Delay(Cfg().finalizeLatency);
+  StubCodeObject* co = new StubCodeObject();
+  co->moduleCount = (uint32_t) FromHandle<StubProgram>(program.handle)->modules.size();
+  code_object->handle = ToHandle(co);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_code_object_destroy(hsa_code_object_t code_object)
+{
+  if (!code_object.handle) { return HSA_STATUS_ERROR_INVALID_CODE_OBJECT; }
+  delete FromHandle<StubCodeObject>(code_object.handle);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_code_object_serialize(hsa_code_object_t code_object,
+                                               hsa_status_t (*alloc_callback)(size_t size, hsa_callback_data_t data, void **address),
+                                               hsa_callback_data_t callback_data, const char *options,
+                                               void **serialized_code_object, size_t *serialized_code_object_size)
+{
+  if (!code_object.handle) { return HSA_STATUS_ERROR_INVALID_CODE_OBJECT; }
+  if (!alloc_callback || !serialized_code_object || !serialized_code_object_size) {
+    return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  StubCodeObject* co = FromHandle<StubCodeObject>(code_object.handle);
+  hsa_status_t status = alloc_callback(sizeof(StubCodeObject), callback_data, serialized_code_object);
+  if (status != HSA_STATUS_SUCCESS) { return status; }
+  memcpy(*serialized_code_object, co, sizeof(StubCodeObject));
+  *serialized_code_object_size = sizeof(StubCodeObject);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_code_object_deserialize(void *serialized_code_object, size_t serialized_code_object_size,
+                                                 const char *options, hsa_code_object_t *code_object)
+{
+  if (!serialized_code_object || !code_object) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  if (serialized_code_object_size != sizeof(StubCodeObject)) { return HSA_STATUS_ERROR_INVALID_CODE_OBJECT; }
+  StubCodeObject* co = new StubCodeObject();
+  memcpy(co, serialized_code_object, sizeof(StubCodeObject));
+  code_object->handle = ToHandle(co);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_executable_create(hsa_profile_t profile, hsa_executable_state_t executable_state,
+                                           const char *options, hsa_executable_t *executable)
+{
+  if (!executable) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  StubExecutable* e = new StubExecutable();
+  e->state = executable_state;
+  executable->handle = ToHandle(e);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_executable_destroy(hsa_executable_t executable)
+{
+  if (!executable.handle) { return HSA_STATUS_ERROR_INVALID_EXECUTABLE; }
+  delete FromHandle<StubExecutable>(executable.handle);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_executable_load_code_object(hsa_executable_t executable, hsa_agent_t agent,
+                                                     hsa_code_object_t code_object, const char *options)
+{
+  if (!executable.handle) { return HSA_STATUS_ERROR_INVALID_EXECUTABLE; }
+  if (!code_object.handle) { return HSA_STATUS_ERROR_INVALID_CODE_OBJECT; }
+  if (!IsAgent(agent)) { return HSA_STATUS_ERROR_INVALID_AGENT; }
+  StubExecutable* e = FromHandle<StubExecutable>(executable.handle);
+  if (e->state == HSA_EXECUTABLE_STATE_FROZEN) { return HSA_STATUS_ERROR_FROZEN_EXECUTABLE; }
+  e->Symbol(KERNEL_NAME);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_executable_freeze(hsa_executable_t executable, const char *options)
+{
+  if (!executable.handle) { return HSA_STATUS_ERROR_INVALID_EXECUTABLE; }
+  FromHandle<StubExecutable>(executable.handle)->state = HSA_EXECUTABLE_STATE_FROZEN;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_executable_get_symbol(hsa_executable_t executable, const char *module_name,
+                                               const char *symbol_name, hsa_agent_t agent,
+                                               int32_t call_convention, hsa_executable_symbol_t *symbol)
+{
+  if (!executable.handle) { return HSA_STATUS_ERROR_INVALID_EXECUTABLE; }
+  if (!symbol_name || !symbol) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  symbol->handle = ToHandle(FromHandle<StubExecutable>(executable.handle)->Symbol(symbol_name));
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_executable_iterate_symbols(hsa_executable_t executable,
+                                                    hsa_status_t (*callback)(hsa_executable_t executable, hsa_executable_symbol_t symbol, void* data),
+                                                    void* data)
+{
+  if (!executable.handle) { return HSA_STATUS_ERROR_INVALID_EXECUTABLE; }
+  if (!callback) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  hsa_executable_symbol_t symbol;
+  symbol.handle = ToHandle(FromHandle<StubExecutable>(executable.handle)->Symbol(KERNEL_NAME));
+  hsa_status_t status = callback(executable, symbol, data);
+  return status == HSA_STATUS_INFO_BREAK ? HSA_STATUS_SUCCESS : status;
+}
+
+hsa_status_t HSA_API hsa_executable_symbol_get_info(hsa_executable_symbol_t executable_symbol,
+                                                    hsa_executable_symbol_info_t attribute, void *value)
+{
+  if (!executable_symbol.handle) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  if (!value) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  StubSymbol* s = FromHandle<StubSymbol>(executable_symbol.handle);
+  switch (attribute) {
+  case HSA_EXECUTABLE_SYMBOL_INFO_TYPE: *(hsa_symbol_kind_t*) value = HSA_SYMBOL_KIND_KERNEL; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_NAME_LENGTH: *(uint32_t*) value = (uint32_t) s->name.size(); break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_NAME: memcpy(value, s->name.data(), s->name.size()); break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_AGENT: ((hsa_agent_t*) value)->handle = AGENT_HANDLE; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_IS_DEFINITION: *(bool*) value = true; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_OBJECT: *(uint64_t*) value = executable_symbol.handle; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE: *(uint32_t*) value = Cfg().kernargSize; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_ALIGNMENT: *(uint32_t*) value = 16; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_GROUP_SEGMENT_SIZE: *(uint32_t*) value = 0; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_PRIVATE_SEGMENT_SIZE: *(uint32_t*) value = 0; break;
+  case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_DYNAMIC_CALLSTACK: *(bool*) value = false; break;
+  default: return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_image_get_capability(hsa_agent_t agent, hsa_ext_image_geometry_t geometry,
+                                                  const hsa_ext_image_format_t *image_format,
+                                                  uint32_t *capability_mask)
+{
+  if (!IsAgent(agent) || !image_format || !capability_mask) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  *capability_mask = HSA_EXT_IMAGE_CAPABILITY_READ_ONLY | HSA_EXT_IMAGE_CAPABILITY_WRITE_ONLY |
+    HSA_EXT_IMAGE_CAPABILITY_READ_WRITE;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_image_data_get_info(hsa_agent_t agent, const hsa_ext_image_descriptor_t *image_descriptor,
+                                                 hsa_access_permission_t access_permission,
+                                                 hsa_ext_image_data_info_t *image_data_info)
+{
+  if (!IsAgent(agent) || !image_descriptor || !image_data_info) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  // 16 bytes per element is enough for any channel order and type.
+  size_t elements = (std::max)(image_descriptor->width, (size_t) 1) *
+    (std::max)(image_descriptor->height, (size_t) 1) *
+    (std::max)(image_descriptor->depth, (size_t) 1) *
+    (std::max)(image_descriptor->array_size, (size_t) 1);
+  image_data_info->size = elements * 16;
+  image_data_info->alignment = 16;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_image_create(hsa_agent_t agent, const hsa_ext_image_descriptor_t *image_descriptor,
+                                          const void *image_data, hsa_access_permission_t access_permission,
+                                          hsa_ext_image_t *image)
+{
+  if (!IsAgent(agent) || !image_descriptor || !image_data || !image) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  StubImage* i = new StubImage();
+  i->data = const_cast<void*>(image_data);
+  image->handle = ToHandle(i);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_image_destroy(hsa_agent_t agent, hsa_ext_image_t image)
+{
+  if (!IsAgent(agent) || !image.handle) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  delete FromHandle<StubImage>(image.handle);
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_image_import(hsa_agent_t agent, const void *src_memory,
+                                          size_t src_row_pitch, size_t src_slice_pitch,
+                                          hsa_ext_image_t dst_image, const hsa_ext_image_region_t *image_region)
+{
+  if (!IsAgent(agent) || !src_memory || !dst_image.handle || !image_region) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_sampler_create(hsa_agent_t agent, const hsa_ext_sampler_descriptor_t *sampler_descriptor,
+                                            hsa_ext_sampler_t *sampler)
+{
+  if (!IsAgent(agent) || !sampler_descriptor || !sampler) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  sampler->handle = ++samplerId;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t HSA_API hsa_ext_sampler_destroy(hsa_agent_t agent, hsa_ext_sampler_t sampler)
+{
+  if (!IsAgent(agent) || !sampler.handle) { return HSA_STATUS_ERROR_INVALID_ARGUMENT; }
+  return HSA_STATUS_SUCCESS;
+}
@@ -308,99 +308,126 @@ public:
   }
 };
 
+/// Applies a to items of ps selected by it, see TestSpecIterator::BeginGroup.
+template <typename P>
+void IterateGroup(hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P>* ps, hexl::Action<P>& a)
+{
+  hexl::TestGroup group(base);
+  ps->Dimensions(group.dimensions);
+  it.BeginGroup(group);
+  if (!group.selected) {
+    ps->Iterate(a);
+  } else {
+    for (uint64_t i : group.indices) { ps->At(i, a); }
+  }
+  it.EndGroup();
+}
+
 template <typename Test, typename P1>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction1<Test, P1> a(base, it);
-  p1s->Iterate(a);
+  IterateGroup(it, base, p1s, a);
 }
 
 template <typename Test, typename P1, typename P2>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction2<Test, P1, P2> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction3<Test, P1, P2, P3> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction4<Test, P1, P2, P3, P4> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction5<Test, P1, P2, P3, P4, P5> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5, typename P6>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s, hexl::Sequence<P6>* p6s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction6<Test, P1, P2, P3, P4, P5, P6> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s, p6s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5, typename P6, typename P7>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s, hexl::Sequence<P6>* p6s, hexl::Sequence<P7>* p7s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction7<Test, P1, P2, P3, P4, P5, P6, P7> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s, p6s, p7s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5, typename P6, typename P7, typename P8>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s, hexl::Sequence<P6>* p6s, hexl::Sequence<P7>* p7s, hexl::Sequence<P8>* p8s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction8<Test, P1, P2, P3, P4, P5, P6, P7, P8> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s, p6s, p7s, p8s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5, typename P6, typename P7, typename P8, typename P9>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s, hexl::Sequence<P6>* p6s, hexl::Sequence<P7>* p7s, hexl::Sequence<P8>* p8s, hexl::Sequence<P9>* p9s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction9<Test, P1, P2, P3, P4, P5, P6, P7, P8, P9> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s, p6s, p7s, p8s, p9s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5, typename P6, typename P7, typename P8, typename P9, typename P10>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s, hexl::Sequence<P6>* p6s, hexl::Sequence<P7>* p7s, hexl::Sequence<P8>* p8s, hexl::Sequence<P9>* p9s, hexl::Sequence<P10>* p10s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction10<Test, P1, P2, P3, P4, P5, P6, P7, P8, P9, P10> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s, p6s, p7s, p8s, p9s, p10s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5, typename P6, typename P7, typename P8, typename P9, typename P10, typename P11>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s, hexl::Sequence<P6>* p6s, hexl::Sequence<P7>* p7s, hexl::Sequence<P8>* p8s, hexl::Sequence<P9>* p9s, hexl::Sequence<P10>* p10s, hexl::Sequence<P11>* p11s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction11<Test, P1, P2, P3, P4, P5, P6, P7, P8, P9, P10, P11> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s, p6s, p7s, p8s, p9s, p10s, p11s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 template <typename Test, typename P1, typename P2, typename P3, typename P4, typename P5, typename P6, typename P7, typename P8, typename P9, typename P10, typename P11, typename P12>
 void TestForEach(hexl::Arena* ap, hexl::TestSpecIterator& it, const std::string& base, hexl::Sequence<P1>* p1s, hexl::Sequence<P2>* p2s, hexl::Sequence<P3>* p3s, hexl::Sequence<P4>* p4s, hexl::Sequence<P5>* p5s, hexl::Sequence<P6>* p6s, hexl::Sequence<P7>* p7s, hexl::Sequence<P8>* p8s, hexl::Sequence<P9>* p9s, hexl::Sequence<P10>* p10s, hexl::Sequence<P11>* p11s, hexl::Sequence<P12>* p12s)
 {
+  if (!it.Includes(base)) { return; }
   TestAction12<Test, P1, P2, P3, P4, P5, P6, P7, P8, P9, P10, P11, P12> a(base, it);
   auto ps = SequenceProduct(ap, p1s, p2s, p3s, p4s, p5s, p6s, p7s, p8s, p9s, p10s, p11s, p12s);
-  ps->Iterate(a);
+  IterateGroup(it, base, ps, a);
 }
 
 }
@@ -17,6 +17,10 @@
 #include "Options.hpp"
 #include "HexlTestFactory.hpp"
 #include "HexlTestRunner.hpp"
+#include "HexlShardRunner.hpp"
+#include "HexlTestJournal.hpp"
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include "HexlResource.hpp"
@@ -54,6 +58,16 @@ SysArchTests::SysArchTests()
     Add(NewSysArchMandatoryTests());
 }
 
+#ifdef ENABLE_HEXL_AGENT
+DECLARE_TESTSET_UNION(HexlTests);
+
+HexlTests::HexlTests()
+  : TestSetUnion("hexl")
+{
+    Add(NewAgentTests());
+}
+#endif // ENABLE_HEXL_AGENT
+
 DECLARE_TESTSET_UNION(HSATests);
 
 HSATests::HSATests()
@@ -61,6 +75,9 @@ HSATests::HSATests()
 {
     Add(new PrmTests());
     Add(new SysArchTests());
+#ifdef ENABLE_HEXL_AGENT
+    Add(new HexlTests());
+#endif // ENABLE_HEXL_AGENT
 }
 
 class HCTestFactory : public DefaultTestFactory {
@@ -108,16 +125,25 @@ public:
   HCRunner(int argc_, char **argv_)
     : argc(argc_), argv(argv_), context(new Context()),
       testFactory(new HCTestFactory(context.get())), runner(0),
-      coreConfig(0)
+#ifndef _WIN32
+      shardRunner(0),
+#endif // _WIN32
+      coreConfig(0), resumeJournal(0), excludeFilter(0),
+      shardIndex(0), shardCount(1), sampleFraction(0), sampleCount(0)
   {
-    context->Put("hexl.log.stream.debug", &std::cout);
-    context->Put("hexl.log.stream.info", &std::cout);
-    context->Put("hexl.log.stream.error", &std::cout);
+    context->Put(CK_LOG_DEBUG, &std::cout);
+    context->Put(CK_LOG_INFO, &std::cout);
+    context->Put(CK_LOG_ERROR, &std::cout);
   }
   ~HCRunner()
   { 
       delete testFactory; 
       delete coreConfig;
+      delete resumeJournal;
+      delete excludeFilter;
+#ifndef _WIN32
+      delete shardRunner;
+#endif // _WIN32
   }
 
   void Run();
@@ -129,9 +155,18 @@ private:
   Options options;
   TestFactory* testFactory;
   TestRunner* runner;
+#ifndef _WIN32
+  ShardTestRunner* shardRunner;
+#endif // _WIN32
   CoreConfig* coreConfig;
+  TestJournal* resumeJournal;
+  ExcludeListFilter* excludeFilter;
+  unsigned shardIndex, shardCount;
+  double sampleFraction;
+  unsigned sampleCount;
   TestRunner* CreateTestRunner();
   TestSet* CreateTestSet();
+  void ReportExcluded();
 };
 
 TestRunner* HCRunner::CreateTestRunner()
@@ -143,7 +178,7 @@ TestRunner* HCRunner::CreateTestRunner()
       std::cout << "Runner should be set to remote for -remote" << std::endl;
       exit(20);
     }
-    RemoteTestRunner* remoteTestRunner = new RemoteTestRunner(context, options.GetString("remote"));
+    RemoteTestRunner* remoteTestRunner = new RemoteTestRunner(context.get(), options.GetString("remote"));
     if (!remoteTestRunner->Connect()) {
       exit(19);
     }
@@ -154,6 +189,11 @@ TestRunner* HCRunner::CreateTestRunner()
     return new HTestRunner(context.get());
   } else if (runner == "simple") {
     return new SimpleTestRunner(context.get());
+#ifndef _WIN32
+  } else if (runner == "shard") {
+    assert(shardRunner);
+    return shardRunner->CreateWorkerRunner();
+#endif // _WIN32
   } else {
     std::cout << "Unsupported runner: " << runner << std::endl;
     exit(20);
@@ -164,18 +204,50 @@ TestSet* HCRunner::CreateTestSet()
 {
   TestSet* ts = testFactory->CreateTestSet(options.GetString("tests"));
   ts->InitContext(context.get());
+  // Tests are sampled and numbered for -shard before the exclude list and
+  // the resume journal drop any of them, so that every part gets the same
+  // tests however many of them were already completed.
+  if (options.IsSet("sample")) {
+    ts = new SampledTestSet(ts, sampleFraction, sampleCount, options.GetUnsigned("seed", 0));
+  }
+  if (shardCount > 1) {
+    ts = new ShardedTestSet(ts, shardIndex, shardCount);
+  }
   if (options.IsSet("exclude")) {
-    ExcludeListFilter* filter = new ExcludeListFilter();
-    filter->Load(context->RM(), options.GetString("exclude"));
-    TestSet* fts = filter->Filter(ts);
+    excludeFilter = new ExcludeListFilter();
+    excludeFilter->Load(context->RM(), options.GetString("exclude"));
+    TestSet* fts = excludeFilter->Filter(ts);
     if (fts != ts) {
       ts->InitContext(context.get());
       ts = fts;
     }
   }
+  if (options.IsSet("resume")) {
+    // Missing journal means nothing is completed yet.
+    resumeJournal = new TestJournal();
+    if (resumeJournal->Load(options.GetString("resume")) && resumeJournal->CompletedCount() > 0) {
+      CompletedTestsFilter* filter = new CompletedTestsFilter(resumeJournal);
+      ts = filter->Filter(ts);
+    }
+  }
   return ts;
 }
 
+void HCRunner::ReportExcluded()
+{
+  if (!excludeFilter) { return; }
+  excludeFilter->PrintSummary(std::cout);
+  if (options.IsSet("excludestats")) {
+    std::string name = options.GetString("excludestats");
+    std::ofstream out(name.c_str(), std::ofstream::out);
+    if (!out.is_open()) {
+      std::cout << "Failed to open exclude list statistics " << name << std::endl;
+      return;
+    }
+    excludeFilter->WriteStats(out);
+  }
+}
+
 void HCRunner::Run()
 {
   std::cout <<
@@ -188,14 +260,36 @@ void HCRunner::Run()
   optReg.RegisterOption("rt");
   optReg.RegisterOption("runner");
   optReg.RegisterOption("remote");
+  optReg.RegisterOption("inflight");
   optReg.RegisterOption("testbase");
   optReg.RegisterOption("results");
   optReg.RegisterOption("tests");
   optReg.RegisterOption("testloglevel");
   optReg.RegisterOption("testlog");
   optReg.RegisterOption("testsummary");
+  optReg.RegisterOption("testtiming");
+  optReg.RegisterOption("durations");
+  optReg.RegisterOption("schedule");
+  optReg.RegisterBooleanOption("incremental");
+  optReg.RegisterOption("resultcache");
+  optReg.RegisterOption("codecache");
+  optReg.RegisterOption("codecachedir");
+  optReg.RegisterOption("kernargarena");
+  optReg.RegisterOption("bufferpool");
+  optReg.RegisterOption("timeouts");
+  optReg.RegisterOption("waitspin");
+  optReg.RegisterOption("testgenbatch");
+  optReg.RegisterOption("jobs");
+  optReg.RegisterOption("shardtimeout");
+  optReg.RegisterOption("lookahead");
   optReg.RegisterOption("rtlib");
   optReg.RegisterOption("exclude");
+  optReg.RegisterOption("excludestats");
+  optReg.RegisterOption("journal");
+  optReg.RegisterOption("resume");
+  optReg.RegisterOption("shard");
+  optReg.RegisterOption("sample");
+  optReg.RegisterOption("seed");
   optReg.RegisterBooleanOption("dummy");
   optReg.RegisterBooleanOption("verbose");
   optReg.RegisterBooleanOption("dump");
@@ -227,19 +321,49 @@ void HCRunner::Run()
       std::cout << "Invalid profile option: '" << profile << "'" << std::endl;
       exit(7);
     }
+    if (options.IsSet("shard")) {
+      std::string shard = options.GetString("shard");
+      char end;
+      if (sscanf(shard.c_str(), "%u/%u%c", &shardIndex, &shardCount, &end) != 2 || shardIndex >= shardCount) {
+        std::cout << "Invalid shard option: '" << shard << "'" << std::endl;
+        exit(9);
+      }
+    }
+    if (options.IsSet("sample")) {
+      std::string sample = options.GetString("sample");
+      char end;
+      bool valid = sample.find('.') != std::string::npos ?
+        sscanf(sample.c_str(), "%lf%c", &sampleFraction, &end) == 1 && sampleFraction > 0 && sampleFraction <= 1 :
+        sscanf(sample.c_str(), "%u%c", &sampleCount, &end) == 1 && sampleCount > 0;
+      if (!valid) {
+        std::cout << "Invalid sample option: '" << sample << "'" << std::endl;
+        exit(10);
+      }
+    }
   }
-  context->Move("hexl.stats", new AllStats());
+  context->Move(CK_STATS, new AllStats());
   ResourceManager* rm = new DirectoryResourceManager(options.GetString("testbase", "."), options.GetString("results", "."));
-  context->Put("hexl.rm", rm);
-  context->Put("hexl.options", &options);
+  context->Put(CK_RM, rm);
+  context->Put(CK_OPTIONS, &options);
+#ifndef _WIN32
+  if (options.GetString("runner") == "shard") {
+    // Supervisor does not create runtime: workers are forked from here
+    // and continue below, each with its own runtime.
+    shardRunner = new ShardTestRunner(context.get());
+    if (shardRunner->Supervise()) {
+      delete rm;
+      return;
+    }
+  }
+#endif // _WIN32
   runtime::RuntimeContext* runtime = 0;
   runtime = CreateRuntimeContext(context.get());
   if (!runtime) {
     std::cout << "Failed to create runtime" << std::endl;
     exit(8);
   }
-  context->Put("hexl.runtime", runtime);
-  context->Put("hexl.testFactory", testFactory);
+  context->Put(CK_RUNTIME, runtime);
+  context->Put(CK_TEST_FACTORY, testFactory);
 
   coreConfig = CoreConfig::CreateAndInitialize(context.get());
   context->Put(CoreConfig::CONTEXT_KEY, coreConfig);
@@ -248,6 +372,7 @@ void HCRunner::Run()
   TestSet* tests = CreateTestSet();
   assert(tests);
   runner->RunTests(*tests);
+  ReportExcluded();
 
   // cleanup in reverse order. new never fails.
   delete runner; runner = 0;